@@ -0,0 +1,200 @@
+#include "BlockCache.h"
+
+static void on_code_write(void* context, unsigned short offset)
+{
+    invalidate_block_cache((BlockCache*) context, offset);
+}
+
+BlockCache* init_block_cache(RAM* ram)
+{
+    BlockCache* cache = (BlockCache*) calloc(1, sizeof(BlockCache));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    cache->ram = ram;
+
+    ram->codeWriteHandler = on_code_write;
+    ram->codeWriteContext = cache;
+
+    return cache;
+}
+
+static unsigned int page_of(uint16_t address)
+{
+    return address / RAM_PAGE_SIZE;
+}
+
+// The last byte of the block, its page is the second page the block may touch
+static uint16_t last_address(BasicBlock* block)
+{
+    return (uint16_t) (block->endAddress - 1);
+}
+
+static BasicBlock* translate_basic_block(BlockCache* cache, uint16_t address)
+{
+    // Code fetched from MMIO or unmapped pages is left to the interpreter
+    if (!ram_is_direct_read(cache->ram, address) || !ram_is_direct_read(cache->ram, (uint16_t) (address + 2)))
+    {
+        return NULL;
+    }
+
+    BasicBlock* block = (BasicBlock*) malloc(sizeof(BasicBlock));
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    block->startAddress = address;
+    block->instructionCount = 0;
+    block->valid = TRUE;
+
+    while (block->instructionCount < BLOCK_CACHE_MAX_INSTRUCTIONS)
+    {
+        // The block stops in front of an instruction that reaches into such a page
+        if (!ram_is_direct_read(cache->ram, (uint16_t) (address + 2)))
+        {
+            break;
+        }
+
+        unsigned char opCode = (unsigned char) read_memory_ram(cache->ram, address);
+        unsigned char low = (unsigned char) read_memory_ram(cache->ram, (uint16_t) (address + 1));
+        unsigned char high = (unsigned char) read_memory_ram(cache->ram, (uint16_t) (address + 2));
+
+        DecodedInstruction* instruction = &block->instructions[block->instructionCount++];
+        instruction->handler = instruction_handlers[opCode];
+        instruction->operand = (uint16_t) (low | (high << 8));
+        instruction->nextAddress = (uint16_t) (address + instruction_lengths[opCode]);
+        instruction->cycles = instruction_cycles[opCode];
+
+        address = instruction->nextAddress;
+
+        if (instruction_ends_block[opCode])
+        {
+            break;
+        }
+    }
+
+    block->endAddress = address;
+
+    unsigned int startPage = page_of(block->startAddress);
+    unsigned int endPage = page_of(last_address(block));
+
+    block->pageNext = cache->pageBlocks[startPage];
+    cache->pageBlocks[startPage] = block;
+
+    ram_add_code_page(cache->ram, startPage);
+    if (endPage != startPage)
+    {
+        ram_add_code_page(cache->ram, endPage);
+    }
+
+    cache->blocks[block->startAddress] = block;
+
+    return block;
+}
+
+static void free_retired_blocks(BlockCache* cache)
+{
+    while (cache->retiredBlocks != NULL)
+    {
+        BasicBlock* next = cache->retiredBlocks->pageNext;
+        free(cache->retiredBlocks);
+        cache->retiredBlocks = next;
+    }
+}
+
+BasicBlock* lookup_basic_block(BlockCache* cache, uint16_t address)
+{
+    if (cache->retiredBlocks != NULL)
+    {
+        free_retired_blocks(cache);
+    }
+
+    BasicBlock* block = cache->blocks[address];
+    if (block != NULL)
+    {
+        return block;
+    }
+
+    return translate_basic_block(cache, address);
+}
+
+static BOOL block_covers(BasicBlock* block, uint16_t address)
+{
+    // Unsigned distance handles blocks that wrap around the end of the address space
+    return (uint16_t) (address - block->startAddress) < (uint16_t) (block->endAddress - block->startAddress);
+}
+
+// Unlinks the covering blocks from one page chain and moves them to the retired list
+static void invalidate_page(BlockCache* cache, unsigned int page, uint16_t address)
+{
+    BasicBlock** link = &cache->pageBlocks[page];
+
+    while (*link != NULL)
+    {
+        BasicBlock* block = *link;
+
+        if (!block_covers(block, address))
+        {
+            link = &block->pageNext;
+            continue;
+        }
+
+        *link = block->pageNext;
+
+        unsigned int startPage = page_of(block->startAddress);
+        unsigned int endPage = page_of(last_address(block));
+
+        ram_remove_code_page(cache->ram, startPage);
+        if (endPage != startPage)
+        {
+            ram_remove_code_page(cache->ram, endPage);
+        }
+
+        cache->blocks[block->startAddress] = NULL;
+
+        block->valid = FALSE;
+        block->pageNext = cache->retiredBlocks;
+        cache->retiredBlocks = block;
+    }
+}
+
+void invalidate_block_cache(BlockCache* cache, uint16_t address)
+{
+    // A block touching this page starts either in it or in the previous one
+    unsigned int page = page_of(address);
+
+    invalidate_page(cache, page, address);
+    invalidate_page(cache, (page + RAM_PAGE_COUNT - 1) % RAM_PAGE_COUNT, address);
+}
+
+void free_block_cache(BlockCache* cache)
+{
+    for (int page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        BasicBlock* block = cache->pageBlocks[page];
+
+        while (block != NULL)
+        {
+            BasicBlock* next = block->pageNext;
+
+            ram_remove_code_page(cache->ram, page_of(block->startAddress));
+            if (page_of(last_address(block)) != page_of(block->startAddress))
+            {
+                ram_remove_code_page(cache->ram, page_of(last_address(block)));
+            }
+
+            free(block);
+            block = next;
+        }
+    }
+
+    free_retired_blocks(cache);
+
+    cache->ram->codeWriteHandler = NULL;
+    cache->ram->codeWriteContext = NULL;
+
+    free(cache);
+}
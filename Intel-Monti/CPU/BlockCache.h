@@ -0,0 +1,62 @@
+#pragma once
+
+#include "cpu.h"
+
+// Upper bound of instructions in one basic block.
+// 32 instructions span at most 96 bytes, so a block never touches more than two RAM pages
+#define BLOCK_CACHE_MAX_INSTRUCTIONS 32
+
+// An instruction with its operand bytes already fetched
+struct DecodedInstruction
+{
+	InstructionHandler handler;
+	uint16_t operand;
+
+	// Address of the following instruction, the value PC must hold while the handler runs
+	uint16_t nextAddress;
+
+	// T-states from the opcode map, the handler adds the extra cost of a taken conditional call or return
+	unsigned char cycles;
+} typedef DecodedInstruction;
+
+// Straight-line run of instructions that ends with the first control transfer (jump, call, return, RST, PCHL, HLT)
+struct BasicBlock
+{
+	uint16_t startAddress;
+	// Address right after the last instruction byte of the block (may wrap around 0xFFFF)
+	uint16_t endAddress;
+
+	// Cleared when the guest writes into the block, the executing loop stops at the next instruction
+	BOOL valid;
+
+	// Next block starting in the same RAM page
+	struct BasicBlock* pageNext;
+
+	int instructionCount;
+	DecodedInstruction instructions[BLOCK_CACHE_MAX_INSTRUCTIONS];
+} typedef BasicBlock;
+
+// Translation cache of decoded basic blocks keyed by guest PC.
+// Registers itself as the code write handler of the RAM to drop blocks that the guest overwrites
+struct BlockCache
+{
+	RAM* ram;
+
+	// Direct-mapped lookup by start address
+	BasicBlock* blocks[RAM_MEMORY_SIZE];
+
+	// Blocks grouped by the page of their start address, walked on invalidation
+	BasicBlock* pageBlocks[RAM_PAGE_COUNT];
+
+	// Invalidated blocks are freed at the next lookup, the executing loop may still hold one of them
+	BasicBlock* retiredBlocks;
+} typedef BlockCache;
+
+BlockCache* init_block_cache(RAM* ram);
+void free_block_cache(BlockCache* cache);
+
+// Returns the block starting at the address, decoding it on a miss
+BasicBlock* lookup_basic_block(BlockCache* cache, uint16_t address);
+
+// Drops every cached block that covers the address
+void invalidate_block_cache(BlockCache* cache, uint16_t address);
\ No newline at end of file
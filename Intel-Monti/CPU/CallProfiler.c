@@ -0,0 +1,165 @@
+#include <stdlib.h>
+
+#include "CallProfiler.h"
+
+// Returns -1 when the tree can not grow
+static int add_node(CallProfile* profile, uint16_t function, int parent)
+{
+    if (profile->nodeCount == profile->nodeCapacity)
+    {
+        int capacity = profile->nodeCapacity == 0 ? 256 : profile->nodeCapacity * 2;
+
+        CallNode* nodes = (CallNode*) realloc(profile->nodes, (size_t) capacity * sizeof(CallNode));
+        if (nodes == NULL)
+        {
+            return -1;
+        }
+
+        profile->nodes = nodes;
+        profile->nodeCapacity = capacity;
+    }
+
+    int index = profile->nodeCount++;
+    CallNode* node = &profile->nodes[index];
+
+    node->function = function;
+    node->cycles = 0;
+    node->parent = parent;
+    node->firstChild = -1;
+    node->nextSibling = -1;
+
+    if (parent >= 0)
+    {
+        node->nextSibling = profile->nodes[parent].firstChild;
+        profile->nodes[parent].firstChild = index;
+    }
+
+    return index;
+}
+
+static int find_child(CallProfile* profile, int parent, uint16_t function)
+{
+    for (int child = profile->nodes[parent].firstChild; child >= 0; child = profile->nodes[child].nextSibling)
+    {
+        if (profile->nodes[child].function == function)
+        {
+            return child;
+        }
+    }
+
+    return add_node(profile, function, parent);
+}
+
+CallProfile* init_call_profile(uint64_t cycles)
+{
+    CallProfile* profile = (CallProfile*) malloc(sizeof(CallProfile));
+    if (profile == NULL)
+    {
+        return NULL;
+    }
+
+    profile->nodes = NULL;
+    profile->nodeCount = 0;
+    profile->nodeCapacity = 0;
+    profile->depth = 0;
+    profile->current = 0;
+    profile->lastCycles = cycles;
+    profile->lostCalls = 0;
+
+    if (add_node(profile, 0, -1) < 0)
+    {
+        free(profile);
+        return NULL;
+    }
+
+    return profile;
+}
+
+void free_call_profile(CallProfile* profile)
+{
+    free(profile->nodes);
+    free(profile);
+}
+
+void call_profile_flush(CallProfile* profile, uint64_t cycles)
+{
+    profile->nodes[profile->current].cycles += cycles - profile->lastCycles;
+    profile->lastCycles = cycles;
+}
+
+void call_profile_enter(CallProfile* profile, uint16_t function, uint16_t stackPointer, uint64_t cycles)
+{
+    // The calling instruction is charged to the caller
+    call_profile_flush(profile, cycles);
+
+    // Frames the guest abandoned by moving SP up without returning
+    call_profile_leave(profile, stackPointer, cycles);
+
+    if (profile->depth == CALL_PROFILE_MAX_DEPTH)
+    {
+        profile->lostCalls++;
+        return;
+    }
+
+    int node = find_child(profile, profile->current, function);
+    if (node < 0)
+    {
+        profile->lostCalls++;
+        return;
+    }
+
+    CallFrame* frame = &profile->frames[profile->depth++];
+    frame->node = node;
+    frame->stackPointer = stackPointer;
+
+    profile->current = node;
+}
+
+void call_profile_leave(CallProfile* profile, uint16_t stackPointer, uint64_t cycles)
+{
+    if (!call_profile_frame_left(profile, stackPointer))
+    {
+        return;
+    }
+
+    // The returning instruction is charged to the callee
+    call_profile_flush(profile, cycles);
+
+    while (call_profile_frame_left(profile, stackPointer))
+    {
+        profile->depth--;
+    }
+
+    profile->current = profile->depth > 0 ? profile->frames[profile->depth - 1].node : 0;
+}
+
+static BOOL write_path(const CallProfile* profile, int node, FILE* stream)
+{
+    const CallNode* callNode = &profile->nodes[node];
+
+    if (callNode->parent < 0)
+    {
+        return fputs("root", stream) >= 0;
+    }
+
+    return write_path(profile, callNode->parent, stream) && fprintf(stream, ";0x%04X", callNode->function) >= 0;
+}
+
+BOOL write_folded_stacks(const CallProfile* profile, FILE* stream)
+{
+    // Every node has its own path, so each one is a line of its own
+    for (int node = 0; node < profile->nodeCount; node++)
+    {
+        if (profile->nodes[node].cycles == 0)
+        {
+            continue;
+        }
+
+        if (!write_path(profile, node, stream) || fprintf(stream, " %llu\n", (unsigned long long) profile->nodes[node].cycles) < 0)
+        {
+            return FALSE;
+        }
+    }
+
+    return ferror(stream) == 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../Tools/Bool.h"
+
+// Frames of the shadow call stack, deeper calls are charged to the deepest tracked frame
+#define CALL_PROFILE_MAX_DEPTH 256
+
+// CALL, Ccc and RST push a return address and jump
+#define CALL_PROFILE_IS_CALL(opCode) \
+	(((opCode) & 0xcf) == 0xcd || ((opCode) & 0xc7) == 0xc4 || ((opCode) & 0xc7) == 0xc7)
+
+// A subroutine reached through one particular call path
+struct CallNode
+{
+	// Entry address, the root stands for the code that runs outside any tracked call
+	uint16_t function;
+	// Cycles spent in this subroutine itself on this path
+	uint64_t cycles;
+
+	int parent;
+	int firstChild;
+	int nextSibling;
+} typedef CallNode;
+
+struct CallFrame
+{
+	int node;
+	// SP right after the return address was pushed, the frame ends once SP moves above it
+	uint16_t stackPointer;
+} typedef CallFrame;
+
+// Shadow call stack of the profiling core, see cpu->callProfile.
+// Calls are recognized by CALL, Ccc and RST that pushed, and by interrupts. A frame is left as soon as SP rises
+// above its return address, whether through RET, a POP of the return address or a reload of SP,
+// so guests that manage the stack themselves can not leave stale frames behind
+struct CallProfile
+{
+	// Call tree, node 0 is the root
+	CallNode* nodes;
+	int nodeCount;
+	int nodeCapacity;
+
+	CallFrame frames[CALL_PROFILE_MAX_DEPTH];
+	int depth;
+	// Node the cycles run up to lastCycles have been charged to
+	int current;
+	uint64_t lastCycles;
+
+	// Calls deeper than CALL_PROFILE_MAX_DEPTH, and calls dropped because the tree could not grow
+	uint64_t lostCalls;
+} typedef CallProfile;
+
+// Returns NULL when the tree can not be allocated. cycles is the current cycle counter of the CPU
+CallProfile* init_call_profile(uint64_t cycles);
+void free_call_profile(CallProfile* profile);
+
+// The CPU entered the subroutine at function and SP points at the pushed return address
+void call_profile_enter(CallProfile* profile, uint16_t function, uint16_t stackPointer, uint64_t cycles);
+void call_profile_leave(CallProfile* profile, uint16_t stackPointer, uint64_t cycles);
+
+// Charges the cycles run since the last call or return to the current subroutine
+void call_profile_flush(CallProfile* profile, uint64_t cycles);
+
+// One line per call path, "root;0x0040;0x0123 cycles", the folded format flamegraph tools read.
+// Returns FALSE when the stream reports an error
+BOOL write_folded_stacks(const CallProfile* profile, FILE* stream);
+
+// TRUE when SP has risen above the return address of the innermost frame. SP wraps around,
+// anything up to half the address space above the frame counts as above
+static inline BOOL call_profile_frame_left(const CallProfile* profile, uint16_t stackPointer)
+{
+	return profile->depth > 0
+		&& (uint16_t) (stackPointer - profile->frames[profile->depth - 1].stackPointer - 1) < 0x8000;
+}
\ No newline at end of file
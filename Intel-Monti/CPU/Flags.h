@@ -0,0 +1,14 @@
+#pragma once
+
+// Bit positions of the flags in the Processor Status Word (the PUSH PSW layout, identical to x86 LAHF)
+#define FLAG_CARRY 0x01
+// Bit 1 always reads as 1
+#define FLAG_RESERVED 0x02
+#define FLAG_PARITY 0x04
+#define FLAG_AUXILIARY_CARRY 0x10
+#define FLAG_ZERO 0x40
+#define FLAG_SIGN 0x80
+
+// Sign, zero and parity flags of every result byte in the PSW layout.
+// Replaces counting bits on every arithmetic and logic instruction
+extern const unsigned char zero_sign_parity_flags[256];
\ No newline at end of file
@@ -0,0 +1,909 @@
+#if defined(_WIN32)
+// Included before Bool.h, which redefines BOOL for the emulator code
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
+#include "Jit.h"
+#include "Flags.h"
+
+// Host register allocation inside a translated block:
+//   r8b..r14b  guest A, B, C, D, E, H, L (pinned for the whole block)
+//   ecx        guest flags in the PSW layout
+//   rdi        JitContext*
+//   rsi        guest memory
+//   rbx        RAM*, for the direct access page tables
+//   eax, edx, ebp  scratch
+#define HOST_RAX 0
+#define HOST_RCX 1
+#define HOST_RDX 2
+#define HOST_RBX 3
+#define HOST_RBP 5
+#define HOST_RSI 6
+#define HOST_RDI 7
+#define HOST_R8 8
+
+#define GUEST_M 6
+#define GUEST_A 7
+
+// Host register of every guest register in the 8080 encoding order B C D E H L (M) A
+static const int hostRegisters[8] = { 9, 10, 11, 12, 13, 14, -1, 8 };
+
+// x86 opcodes of "op r/m8, r8" in the 8080 ALU order ADD ADC SUB SBB ANA XRA ORA CMP
+static const unsigned char hostAluOpcodes[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+
+#define ALU_ADD 0
+#define ALU_ADC 1
+#define ALU_SUB 2
+#define ALU_SBB 3
+#define ALU_ANA 4
+#define ALU_XRA 5
+#define ALU_ORA 6
+#define ALU_CMP 7
+
+struct JitEmitter
+{
+    unsigned char* code;
+    size_t size;
+
+    // T-states of the block up to and including the instruction being translated
+    uint32_t cycles;
+
+    // Guest address and T-states of the block in front of the instruction being translated,
+    // where a memory access without a direct mapping hands over to the interpreter
+    uint16_t instructionAddress;
+    uint32_t cyclesBefore;
+} typedef JitEmitter;
+
+#define EMIT(emitter, ...) \
+    do \
+    { \
+        const unsigned char bytes[] = { __VA_ARGS__ }; \
+        emit_bytes(emitter, bytes, sizeof(bytes)); \
+    } while (0)
+
+static void emit_bytes(JitEmitter* emitter, const unsigned char* bytes, size_t count)
+{
+    memcpy(emitter->code + emitter->size, bytes, count);
+    emitter->size += count;
+}
+
+static void emit_byte(JitEmitter* emitter, unsigned char value)
+{
+    emitter->code[emitter->size++] = value;
+}
+
+static void emit_word(JitEmitter* emitter, uint16_t value)
+{
+    emit_byte(emitter, (unsigned char) value);
+    emit_byte(emitter, (unsigned char) (value >> 8));
+}
+
+static void emit_dword(JitEmitter* emitter, uint32_t value)
+{
+    emit_word(emitter, (uint16_t) value);
+    emit_word(emitter, (uint16_t) (value >> 16));
+}
+
+// Emits a jcc rel32 with an empty displacement and returns the position to patch
+static size_t emit_jump_placeholder(JitEmitter* emitter, unsigned char conditionOpcode)
+{
+    EMIT(emitter, 0x0f, conditionOpcode);
+    emit_dword(emitter, 0);
+
+    return emitter->size;
+}
+
+static void patch_jump(JitEmitter* emitter, size_t jumpEnd, size_t target)
+{
+    uint32_t displacement = (uint32_t) ((int32_t) target - (int32_t) jumpEnd);
+
+    emitter->code[jumpEnd - 4] = (unsigned char) displacement;
+    emitter->code[jumpEnd - 3] = (unsigned char) (displacement >> 8);
+    emitter->code[jumpEnd - 2] = (unsigned char) (displacement >> 16);
+    emitter->code[jumpEnd - 1] = (unsigned char) (displacement >> 24);
+}
+
+#define JCC_JZ 0x84
+#define JCC_JNZ 0x85
+
+// Instruction encoders. A REX prefix is always emitted for byte registers,
+// so the encodings 4..7 mean spl/bpl/sil/dil and never ah..bh
+
+static unsigned char rex(int reg, int rm)
+{
+    return (unsigned char) (0x40 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+// op r/m8, r8 (register to register)
+static void emit_reg8_reg8(JitEmitter* emitter, unsigned char opcode, int destination, int source)
+{
+    EMIT(emitter, rex(source, destination), opcode, (unsigned char) (0xc0 | ((source & 7) << 3) | (destination & 7)));
+}
+
+static void emit_mov_reg8_imm8(JitEmitter* emitter, int destination, unsigned char value)
+{
+    EMIT(emitter, rex(0, destination), (unsigned char) (0xb0 + (destination & 7)), value);
+}
+
+// Group opcodes with the operation in the reg field of ModRM (inc, dec, not, rol, ror, rcl, rcr)
+static void emit_unary_reg8(JitEmitter* emitter, unsigned char opcode, int operation, int reg)
+{
+    EMIT(emitter, rex(0, reg), opcode, (unsigned char) (0xc0 | (operation << 3) | (reg & 7)));
+}
+
+// mov r8, [rdi + offset] / mov [rdi + offset], r8
+static void emit_context_byte(JitEmitter* emitter, unsigned char opcode, int reg, size_t offset)
+{
+    EMIT(emitter, rex(reg, 0), opcode, (unsigned char) (0x47 | ((reg & 7) << 3)), (unsigned char) offset);
+}
+
+// mov r8, [rsi + rdx] / mov [rsi + rdx], r8
+static void emit_memory_byte(JitEmitter* emitter, unsigned char opcode, int reg)
+{
+    EMIT(emitter, rex(reg, 0), opcode, (unsigned char) (0x04 | ((reg & 7) << 3)), 0x16);
+}
+
+// mov r8, [rsi + address] / mov [rsi + address], r8
+static void emit_absolute_byte(JitEmitter* emitter, unsigned char opcode, int reg, uint16_t address)
+{
+    EMIT(emitter, rex(reg, 0), opcode, (unsigned char) (0x86 | ((reg & 7) << 3)));
+    emit_dword(emitter, address);
+}
+
+// destination32 = (high << 8) | low, clobbers eax
+static void emit_load_pair(JitEmitter* emitter, int destination, int high, int low)
+{
+    EMIT(emitter, rex(destination, high), 0x0f, 0xb6, (unsigned char) (0xc0 | ((destination & 7) << 3) | (high & 7)));
+    EMIT(emitter, 0xc1, (unsigned char) (0xe0 | destination), 0x08);
+    EMIT(emitter, rex(HOST_RAX, low), 0x0f, 0xb6, (unsigned char) (0xc0 | (low & 7)));
+    EMIT(emitter, 0x09, (unsigned char) (0xc0 | destination));
+}
+
+// high:low = dx, clobbers edx
+static void emit_store_pair(JitEmitter* emitter, int high, int low)
+{
+    emit_reg8_reg8(emitter, 0x88, low, HOST_RDX);
+    EMIT(emitter, 0xc1, 0xea, 0x08);
+    emit_reg8_reg8(emitter, 0x88, high, HOST_RDX);
+}
+
+static void emit_load_hl(JitEmitter* emitter)
+{
+    emit_load_pair(emitter, HOST_RDX, hostRegisters[4], hostRegisters[5]);
+}
+
+// Host flags after an ALU instruction already are in the 8080 layout: lahf; movzx ecx, ah
+static void emit_capture_flags(JitEmitter* emitter)
+{
+    EMIT(emitter, 0x9f, 0x0f, 0xb6, 0xcc);
+}
+
+// Same as above but keeps the guest carry (INR / DCR): lahf; and ecx, 1; movzx edx, ah; and edx, ~1; or ecx, edx
+static void emit_capture_flags_keep_carry(JitEmitter* emitter)
+{
+    EMIT(emitter, 0x9f, 0x83, 0xe1, 0x01, 0x0f, 0xb6, 0xd4, 0x83, 0xe2, 0xfe, 0x09, 0xd1);
+}
+
+// Copies the host carry into the guest carry: setc al; movzx eax, al; and ecx, ~1; or ecx, eax
+static void emit_capture_carry(JitEmitter* emitter)
+{
+    EMIT(emitter, 0x0f, 0x92, 0xc0, 0x0f, 0xb6, 0xc0, 0x83, 0xe1, 0xfe, 0x09, 0xc1);
+}
+
+// Loads the guest carry into the host carry: bt ecx, 0
+static void emit_load_carry(JitEmitter* emitter)
+{
+    EMIT(emitter, 0x0f, 0xba, 0xe1, 0x00);
+}
+
+static void emit_prologue(JitEmitter* emitter)
+{
+    // push rbx, rbp, r12, r13, r14, r15, rdi, rsi
+    EMIT(emitter, 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, 0x57, 0x56);
+
+#if defined(_WIN32)
+    // mov rdi, rcx; mov rsi, rdx; mov rbx, r8
+    EMIT(emitter, 0x48, 0x89, 0xcf, 0x48, 0x89, 0xd6, 0x4c, 0x89, 0xc3);
+#else
+    // mov rbx, rdx
+    EMIT(emitter, 0x48, 0x89, 0xd3);
+#endif
+
+    for (int guest = 0; guest < 8; guest++)
+    {
+        if (guest != GUEST_M)
+        {
+            emit_context_byte(emitter, 0x8a, hostRegisters[guest], offsetof(JitContext, registers) + guest);
+        }
+    }
+
+    // movzx ecx, byte [rdi + flags]
+    EMIT(emitter, 0x0f, 0xb6, 0x4f, (unsigned char) offsetof(JitContext, flags));
+}
+
+// Adds the T-states retired so far to the context
+static void emit_retire(JitEmitter* emitter, uint32_t cycles)
+{
+    // add dword [rdi + cycles], imm32
+    EMIT(emitter, 0x81, 0x47, (unsigned char) offsetof(JitContext, cycles));
+    emit_dword(emitter, cycles);
+}
+
+// Writes the guest state back, sets the guest PC and returns the exit code
+static void emit_leave(JitEmitter* emitter, uint16_t programCounter, int exitCode)
+{
+    for (int guest = 0; guest < 8; guest++)
+    {
+        if (guest != GUEST_M)
+        {
+            emit_context_byte(emitter, 0x88, hostRegisters[guest], offsetof(JitContext, registers) + guest);
+        }
+    }
+
+    // mov [rdi + flags], cl
+    EMIT(emitter, 0x88, 0x4f, (unsigned char) offsetof(JitContext, flags));
+
+    // mov word [rdi + programCounter], imm16
+    EMIT(emitter, 0x66, 0xc7, 0x47, (unsigned char) offsetof(JitContext, programCounter));
+    emit_word(emitter, programCounter);
+
+    // mov eax, imm32
+    emit_byte(emitter, 0xb8);
+    emit_dword(emitter, (uint32_t) exitCode);
+
+    // pop rsi, rdi, r15, r14, r13, r12, rbp, rbx; ret
+    EMIT(emitter, 0x5e, 0x5f, 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b, 0xc3);
+}
+
+static void emit_exit(JitEmitter* emitter, uint16_t programCounter, int exitCode)
+{
+    emit_retire(emitter, emitter->cycles);
+    emit_leave(emitter, programCounter, exitCode);
+}
+
+// Target of a failed page check: leaves the block in front of the current instruction
+static void emit_slow_access_exit(JitEmitter* emitter, size_t skip)
+{
+    emit_retire(emitter, emitter->cyclesBefore);
+    emit_leave(emitter, emitter->instructionAddress, JIT_EXIT_SLOW_ACCESS);
+
+    patch_jump(emitter, skip, emitter->size);
+}
+
+// Before an access to [rsi + rdx]: hands the instruction to the interpreter when the page has no direct mapping
+static void emit_memory_check(JitEmitter* emitter, BOOL write)
+{
+    size_t pages = write ? offsetof(RAM, writePages) : offsetof(RAM, readPages);
+
+    // mov eax, edx; shr eax, 8; cmp qword [rbx + rax * 8 + pages], 0
+    EMIT(emitter, 0x89, 0xd0, 0xc1, 0xe8, 0x08, 0x48, 0x83, 0xbc, 0xc3);
+    emit_dword(emitter, (uint32_t) pages);
+    emit_byte(emitter, 0x00);
+
+    emit_slow_access_exit(emitter, emit_jump_placeholder(emitter, JCC_JNZ));
+}
+
+// Same check for an access to a constant address
+static void emit_absolute_memory_check(JitEmitter* emitter, BOOL write, uint16_t address)
+{
+    size_t pages = write ? offsetof(RAM, writePages) : offsetof(RAM, readPages);
+
+    // cmp qword [rbx + pages + page * 8], 0
+    EMIT(emitter, 0x48, 0x83, 0xbb);
+    emit_dword(emitter, (uint32_t) (pages + (address / RAM_PAGE_SIZE) * sizeof(unsigned char*)));
+    emit_byte(emitter, 0x00);
+
+    emit_slow_access_exit(emitter, emit_jump_placeholder(emitter, JCC_JNZ));
+}
+// A jump to the start of the block loops natively until the back edge budget runs out
+static void emit_branch(JitEmitter* emitter, uint16_t target, uint16_t blockStart, size_t bodyOffset)
+{
+    if (target == blockStart)
+    {
+        // The pass is retired before the jump back, so the exit behind the loop has nothing left to count
+        emit_retire(emitter, emitter->cycles);
+
+        // dec dword [rdi + backEdgeBudget]; jnz body
+        EMIT(emitter, 0xff, 0x4f, (unsigned char) offsetof(JitContext, backEdgeBudget));
+        size_t loop = emit_jump_placeholder(emitter, JCC_JNZ);
+        patch_jump(emitter, loop, bodyOffset);
+
+        emit_leave(emitter, target, JIT_EXIT_NORMAL);
+        return;
+    }
+
+    emit_exit(emitter, target, JIT_EXIT_NORMAL);
+}
+
+// A (r8b) = A op source
+static void emit_alu(JitEmitter* emitter, int operation, int source)
+{
+    int accumulator = hostRegisters[GUEST_A];
+
+    if (operation == ALU_ANA)
+    {
+        // The 8080 sets AC to the OR of bit 3 of both operands: dl = ((A | source) & 8) << 1
+        emit_reg8_reg8(emitter, 0x88, HOST_RDX, accumulator);
+        emit_reg8_reg8(emitter, 0x08, HOST_RDX, source);
+        EMIT(emitter, 0x83, 0xe2, 0x08, 0xd1, 0xe2);
+    }
+
+    if (operation == ALU_ADC || operation == ALU_SBB)
+    {
+        emit_load_carry(emitter);
+    }
+
+    emit_reg8_reg8(emitter, hostAluOpcodes[operation], accumulator, source);
+    emit_capture_flags(emitter);
+
+    switch (operation)
+    {
+        // x86 reports a borrow out of bit 3, the 8080 the carry of the complement addition
+        case ALU_SUB:
+        case ALU_SBB:
+        case ALU_CMP:
+            EMIT(emitter, 0x83, 0xf1, FLAG_AUXILIARY_CARRY);
+            break;
+        case ALU_ANA:
+            EMIT(emitter, 0x83, 0xe1, (unsigned char) ~FLAG_AUXILIARY_CARRY, 0x09, 0xd1);
+            break;
+        case ALU_XRA:
+        case ALU_ORA:
+            EMIT(emitter, 0x83, 0xe1, (unsigned char) ~FLAG_AUXILIARY_CARRY);
+            break;
+    }
+}
+
+// Register pair index (B, D, H) to its high and low guest registers
+static int pair_high(int pair)
+{
+    return hostRegisters[pair * 2];
+}
+
+static int pair_low(int pair)
+{
+    return hostRegisters[pair * 2 + 1];
+}
+
+#define PAIR_SP 3
+
+// Result of translating one guest instruction
+#define TRANSLATE_UNSUPPORTED 0
+#define TRANSLATE_CONTINUE 1
+#define TRANSLATE_END_BLOCK 2
+
+static int translate_instruction(JitEmitter* emitter, unsigned char opCode, uint16_t operand, uint16_t nextAddress, uint16_t blockStart, size_t bodyOffset)
+{
+    // MOV r, r / MOV r, M / MOV M, r
+    if (opCode >= 0x40 && opCode <= 0x7f && opCode != 0x76)
+    {
+        int destination = (opCode >> 3) & 7;
+        int source = opCode & 7;
+
+        if (destination == GUEST_M)
+        {
+            emit_load_hl(emitter);
+            emit_memory_check(emitter, TRUE);
+            emit_memory_byte(emitter, 0x88, hostRegisters[source]);
+        }
+        else if (source == GUEST_M)
+        {
+            emit_load_hl(emitter);
+            emit_memory_check(emitter, FALSE);
+            emit_memory_byte(emitter, 0x8a, hostRegisters[destination]);
+        }
+        else if (destination != source)
+        {
+            emit_reg8_reg8(emitter, 0x88, hostRegisters[destination], hostRegisters[source]);
+        }
+
+        return TRANSLATE_CONTINUE;
+    }
+
+    // ADD / ADC / SUB / SBB / ANA / XRA / ORA / CMP with a register or M
+    if (opCode >= 0x80 && opCode <= 0xbf)
+    {
+        int source = opCode & 7;
+
+        if (source == GUEST_M)
+        {
+            emit_load_hl(emitter);
+            emit_memory_check(emitter, FALSE);
+            emit_memory_byte(emitter, 0x8a, HOST_RAX);
+        }
+
+        emit_alu(emitter, (opCode >> 3) & 7, source == GUEST_M ? HOST_RAX : hostRegisters[source]);
+        return TRANSLATE_CONTINUE;
+    }
+
+    // ADI / ACI / SUI / SBI / ANI / XRI / ORI / CPI
+    if ((opCode & 0xc7) == 0xc6)
+    {
+        emit_mov_reg8_imm8(emitter, HOST_RAX, (unsigned char) operand);
+        emit_alu(emitter, (opCode >> 3) & 7, HOST_RAX);
+
+        return TRANSLATE_CONTINUE;
+    }
+
+    // INR r / DCR r
+    if ((opCode & 0xc6) == 0x04 && ((opCode >> 3) & 7) != GUEST_M)
+    {
+        int reg = hostRegisters[(opCode >> 3) & 7];
+        BOOL decrement = opCode & 1;
+
+        emit_unary_reg8(emitter, 0xfe, decrement, reg);
+        emit_capture_flags_keep_carry(emitter);
+
+        if (decrement)
+        {
+            EMIT(emitter, 0x83, 0xf1, FLAG_AUXILIARY_CARRY);
+        }
+
+        return TRANSLATE_CONTINUE;
+    }
+
+    // MVI r, D8 / MVI M, D8
+    if ((opCode & 0xc7) == 0x06)
+    {
+        int destination = (opCode >> 3) & 7;
+
+        if (destination == GUEST_M)
+        {
+            // mov byte [rsi + rdx], imm8
+            emit_load_hl(emitter);
+            emit_memory_check(emitter, TRUE);
+            EMIT(emitter, 0xc6, 0x04, 0x16, (unsigned char) operand);
+        }
+        else
+        {
+            emit_mov_reg8_imm8(emitter, hostRegisters[destination], (unsigned char) operand);
+        }
+
+        return TRANSLATE_CONTINUE;
+    }
+
+    // LXI rp / INX rp / DAD rp / DCX rp
+    if (opCode < 0x40 && ((opCode & 0x0f) == 0x01 || (opCode & 0x0f) == 0x03 || (opCode & 0x0f) == 0x09 || (opCode & 0x0f) == 0x0b))
+    {
+        int pair = opCode >> 4;
+        unsigned char stackPointerOffset = (unsigned char) offsetof(JitContext, stackPointer);
+
+        switch (opCode & 0x0f)
+        {
+            // LXI
+            case 0x01:
+                if (pair == PAIR_SP)
+                {
+                    EMIT(emitter, 0x66, 0xc7, 0x47, stackPointerOffset);
+                    emit_word(emitter, operand);
+                }
+                else
+                {
+                    emit_mov_reg8_imm8(emitter, pair_high(pair), (unsigned char) (operand >> 8));
+                    emit_mov_reg8_imm8(emitter, pair_low(pair), (unsigned char) operand);
+                }
+                break;
+            // INX / DCX, inc edx or dec edx on the combined pair
+            case 0x03:
+            case 0x0b:
+                if (pair == PAIR_SP)
+                {
+                    EMIT(emitter, 0x66, 0xff, (opCode & 0x08) ? 0x4f : 0x47, stackPointerOffset);
+                }
+                else
+                {
+                    emit_load_pair(emitter, HOST_RDX, pair_high(pair), pair_low(pair));
+                    EMIT(emitter, 0xff, (opCode & 0x08) ? 0xca : 0xc2);
+                    emit_store_pair(emitter, pair_high(pair), pair_low(pair));
+                }
+                break;
+            // DAD, edx = HL + rp with the carry out of bit 16
+            case 0x09:
+                if (pair == PAIR_SP)
+                {
+                    // movzx ebp, word [rdi + stackPointer]
+                    EMIT(emitter, 0x0f, 0xb7, 0x6f, stackPointerOffset);
+                }
+                else
+                {
+                    emit_load_pair(emitter, HOST_RBP, pair_high(pair), pair_low(pair));
+                }
+
+                emit_load_hl(emitter);
+                // add edx, ebp; bt edx, 16
+                EMIT(emitter, 0x01, 0xea, 0x0f, 0xba, 0xe2, 0x10);
+                emit_capture_carry(emitter);
+                emit_store_pair(emitter, hostRegisters[4], hostRegisters[5]);
+                break;
+        }
+
+        return TRANSLATE_CONTINUE;
+    }
+
+    switch (opCode)
+    {
+        // NOP and its undocumented twins
+        case 0x00:
+        case 0x08:
+        case 0x10:
+        case 0x18:
+        case 0x20:
+        case 0x28:
+        case 0x30:
+        case 0x38:
+            return TRANSLATE_CONTINUE;
+        // STAX B / STAX D
+        case 0x02:
+        case 0x12:
+            emit_load_pair(emitter, HOST_RDX, pair_high(opCode >> 4), pair_low(opCode >> 4));
+            emit_memory_check(emitter, TRUE);
+            emit_memory_byte(emitter, 0x88, hostRegisters[GUEST_A]);
+            return TRANSLATE_CONTINUE;
+        // LDAX B / LDAX D
+        case 0x0a:
+        case 0x1a:
+            emit_load_pair(emitter, HOST_RDX, pair_high(opCode >> 4), pair_low(opCode >> 4));
+            emit_memory_check(emitter, FALSE);
+            emit_memory_byte(emitter, 0x8a, hostRegisters[GUEST_A]);
+            return TRANSLATE_CONTINUE;
+        // STA adr
+        case 0x32:
+            emit_absolute_memory_check(emitter, TRUE, operand);
+            emit_absolute_byte(emitter, 0x88, hostRegisters[GUEST_A], operand);
+            return TRANSLATE_CONTINUE;
+        // LDA adr
+        case 0x3a:
+            emit_absolute_memory_check(emitter, FALSE, operand);
+            emit_absolute_byte(emitter, 0x8a, hostRegisters[GUEST_A], operand);
+            return TRANSLATE_CONTINUE;
+        // RLC / RRC / RAL / RAR map to rol / ror / rcl / rcr by one
+        case 0x07:
+        case 0x0f:
+        case 0x17:
+        case 0x1f:
+        {
+            int operation = (opCode >> 3) & 3;
+
+            if (operation >= 2)
+            {
+                emit_load_carry(emitter);
+            }
+
+            emit_unary_reg8(emitter, 0xd0, operation, hostRegisters[GUEST_A]);
+            emit_capture_carry(emitter);
+            return TRANSLATE_CONTINUE;
+        }
+        // CMA
+        case 0x2f:
+            emit_unary_reg8(emitter, 0xf6, 2, hostRegisters[GUEST_A]);
+            return TRANSLATE_CONTINUE;
+        // STC, or ecx, 1
+        case 0x37:
+            EMIT(emitter, 0x83, 0xc9, FLAG_CARRY);
+            return TRANSLATE_CONTINUE;
+        // CMC, xor ecx, 1
+        case 0x3f:
+            EMIT(emitter, 0x83, 0xf1, FLAG_CARRY);
+            return TRANSLATE_CONTINUE;
+        // JMP adr
+        case 0xc3:
+        case 0xcb:
+            emit_branch(emitter, operand, blockStart, bodyOffset);
+            return TRANSLATE_END_BLOCK;
+    }
+
+    // Jcc adr
+    if ((opCode & 0xc7) == 0xc2)
+    {
+        static const unsigned char conditionMasks[4] = { FLAG_ZERO, FLAG_CARRY, FLAG_PARITY, FLAG_SIGN };
+
+        int condition = (opCode >> 3) & 7;
+        BOOL takenWhenSet = condition & 1;
+
+        // test cl, mask
+        EMIT(emitter, 0xf6, 0xc1, conditionMasks[condition >> 1]);
+        size_t notTaken = emit_jump_placeholder(emitter, takenWhenSet ? JCC_JZ : JCC_JNZ);
+
+        emit_branch(emitter, operand, blockStart, bodyOffset);
+
+        patch_jump(emitter, notTaken, emitter->size);
+        emit_exit(emitter, nextAddress, JIT_EXIT_NORMAL);
+
+        return TRANSLATE_END_BLOCK;
+    }
+
+    return TRANSLATE_UNSUPPORTED;
+}
+
+static unsigned int page_of(uint16_t address)
+{
+    return address / RAM_PAGE_SIZE;
+}
+
+static void register_block_pages(Jit* jit, JitBlock* block, int delta)
+{
+    unsigned int startPage = page_of(block->startAddress);
+    unsigned int endPage = page_of((uint16_t) (block->endAddress - 1));
+
+    void (*track)(RAM*, unsigned int) = delta > 0 ? ram_add_code_page : ram_remove_code_page;
+
+    track(jit->ram, startPage);
+    if (endPage != startPage)
+    {
+        track(jit->ram, endPage);
+    }
+}
+
+// Drops all translations and reuses the arena from the beginning
+static void flush_jit(Jit* jit)
+{
+    for (int page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        while (jit->pageBlocks[page] != NULL)
+        {
+            JitBlock* block = jit->pageBlocks[page];
+            jit->pageBlocks[page] = block->pageNext;
+
+            register_block_pages(jit, block, -1);
+            jit->blocks[block->startAddress] = NULL;
+            free(block);
+        }
+    }
+
+    jit->arenaUsed = 0;
+}
+
+static JitBlock* translate_block(Jit* jit, uint16_t startAddress)
+{
+    if (JIT_ARENA_SIZE - jit->arenaUsed < JIT_MAX_BLOCK_BYTES)
+    {
+        flush_jit(jit);
+    }
+
+    JitEmitter emitter;
+    emitter.code = jit->arena + jit->arenaUsed;
+    emitter.size = 0;
+    emitter.cycles = 0;
+
+    emit_prologue(&emitter);
+    size_t bodyOffset = emitter.size;
+
+    uint16_t address = startAddress;
+    int instructionCount = 0;
+    uint32_t cycles = 0;
+    int result = TRANSLATE_CONTINUE;
+
+    while (instructionCount < JIT_MAX_BLOCK_INSTRUCTIONS && result == TRANSLATE_CONTINUE)
+    {
+        // Code in MMIO or unmapped pages is only ever interpreted
+        if (!ram_is_direct_read(jit->ram, address) || !ram_is_direct_read(jit->ram, (uint16_t) (address + 2)))
+        {
+            break;
+        }
+
+        unsigned char opCode = (unsigned char) read_memory_ram(jit->ram, address);
+        unsigned char low = (unsigned char) read_memory_ram(jit->ram, (uint16_t) (address + 1));
+        unsigned char high = (unsigned char) read_memory_ram(jit->ram, (uint16_t) (address + 2));
+
+        uint16_t nextAddress = (uint16_t) (address + instruction_lengths[opCode]);
+
+        emitter.instructionAddress = address;
+        emitter.cyclesBefore = cycles;
+        emitter.cycles = cycles + instruction_cycles[opCode];
+
+        result = translate_instruction(&emitter, opCode, (uint16_t) (low | (high << 8)), nextAddress, startAddress, bodyOffset);
+        if (result == TRANSLATE_UNSUPPORTED)
+        {
+            break;
+        }
+
+        instructionCount++;
+        cycles = emitter.cycles;
+        address = nextAddress;
+    }
+
+    if (instructionCount == 0)
+    {
+        return NULL;
+    }
+
+    // The block stopped in front of an unsupported instruction or at the length limit, the interpreter continues there
+    if (result != TRANSLATE_END_BLOCK)
+    {
+        emitter.cycles = cycles;
+        emit_exit(&emitter, address, JIT_EXIT_NORMAL);
+    }
+
+    JitBlock* block = (JitBlock*) malloc(sizeof(JitBlock));
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    block->startAddress = startAddress;
+    block->endAddress = address;
+    block->cycles = cycles;
+    block->code = (JitCode) (void*) emitter.code;
+
+    jit->arenaUsed += (emitter.size + 15) & ~(size_t) 15;
+
+    block->pageNext = jit->pageBlocks[page_of(startAddress)];
+    jit->pageBlocks[page_of(startAddress)] = block;
+    register_block_pages(jit, block, 1);
+
+    jit->blocks[startAddress] = block;
+
+    return block;
+}
+
+static void on_code_write(void* context, unsigned short offset)
+{
+    invalidate_jit((Jit*) context, offset);
+}
+
+static BOOL block_covers(JitBlock* block, uint16_t address)
+{
+    return (uint16_t) (address - block->startAddress) < (uint16_t) (block->endAddress - block->startAddress);
+}
+
+static void invalidate_page(Jit* jit, unsigned int page, uint16_t address)
+{
+    JitBlock** link = &jit->pageBlocks[page];
+
+    while (*link != NULL)
+    {
+        JitBlock* block = *link;
+
+        if (!block_covers(block, address))
+        {
+            link = &block->pageNext;
+            continue;
+        }
+
+        *link = block->pageNext;
+
+        register_block_pages(jit, block, -1);
+        jit->blocks[block->startAddress] = NULL;
+        jit->hotness[block->startAddress] = 0;
+
+        // The machine code stays in the arena until the next flush
+        free(block);
+    }
+}
+
+void invalidate_jit(Jit* jit, uint16_t address)
+{
+    // A block touching this page starts either in it or in the previous one
+    unsigned int page = page_of(address);
+
+    invalidate_page(jit, page, address);
+    invalidate_page(jit, (page + RAM_PAGE_COUNT - 1) % RAM_PAGE_COUNT, address);
+}
+
+static unsigned char* allocate_executable_memory(size_t size)
+{
+#if defined(_WIN32)
+    return (unsigned char*) VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : (unsigned char*) memory;
+#endif
+}
+
+static void free_executable_memory(unsigned char* memory, size_t size)
+{
+#if defined(_WIN32)
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, size);
+#endif
+}
+
+Jit* init_jit(RAM* ram)
+{
+    if (!JIT_SUPPORTED)
+    {
+        return NULL;
+    }
+
+    Jit* jit = (Jit*) calloc(1, sizeof(Jit));
+    if (jit == NULL)
+    {
+        return NULL;
+    }
+
+    jit->arena = allocate_executable_memory(JIT_ARENA_SIZE);
+    if (jit->arena == NULL)
+    {
+        free(jit);
+        return NULL;
+    }
+
+    jit->ram = ram;
+
+    ram->codeWriteHandler = on_code_write;
+    ram->codeWriteContext = jit;
+
+    return jit;
+}
+
+void free_jit(Jit* jit)
+{
+    flush_jit(jit);
+
+    jit->ram->codeWriteHandler = NULL;
+    jit->ram->codeWriteContext = NULL;
+
+    free_executable_memory(jit->arena, JIT_ARENA_SIZE);
+    free(jit);
+}
+
+BOOL run_jit_block(Jit* jit, CPU* cpu, uint64_t cycleBudget)
+{
+    uint16_t address = cpu->programCounter.data;
+    JitBlock* block = jit->blocks[address];
+
+    if (block == NULL)
+    {
+        if (jit->hotness[address] == JIT_NEVER_TRANSLATE || ++jit->hotness[address] < JIT_HOT_THRESHOLD)
+        {
+            return FALSE;
+        }
+
+        block = translate_block(jit, address);
+        if (block == NULL)
+        {
+            jit->hotness[address] = JIT_NEVER_TRANSLATE;
+            return FALSE;
+        }
+    }
+
+    // Every pass, even one leaving early, fits into what is left of the budget
+    if (block->cycles > cycleBudget)
+    {
+        return FALSE;
+    }
+
+    uint64_t passes = JIT_BACK_EDGE_BUDGET;
+    if (cycleBudget / block->cycles < passes)
+    {
+        passes = cycleBudget / block->cycles;
+    }
+
+    JitContext* context = &jit->context;
+
+    context->registers[0] = cpu->B;
+    context->registers[1] = cpu->C;
+    context->registers[2] = cpu->D;
+    context->registers[3] = cpu->E;
+    context->registers[4] = cpu->H;
+    context->registers[5] = cpu->L;
+    context->registers[7] = cpu->A;
+    context->flags = pack_flags(cpu);
+    context->stackPointer = cpu->stackPointer.data;
+    context->backEdgeBudget = (uint32_t) passes;
+    context->cycles = 0;
+
+    int exitCode = block->code(context, (char*) jit->ram->memory, jit->ram);
+
+    cpu->B = context->registers[0];
+    cpu->C = context->registers[1];
+    cpu->D = context->registers[2];
+    cpu->E = context->registers[3];
+    cpu->H = context->registers[4];
+    cpu->L = context->registers[5];
+    cpu->A = context->registers[7];
+    unpack_flags(cpu, context->flags);
+    cpu->stackPointer.data = context->stackPointer;
+    cpu->programCounter.data = context->programCounter;
+    cpu->cycles += context->cycles;
+
+    // The access without a direct mapping has not happened yet, the interpreter runs that instruction
+    return exitCode == JIT_EXIT_NORMAL;
+}
\ No newline at end of file
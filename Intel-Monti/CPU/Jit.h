@@ -0,0 +1,89 @@
+#pragma once
+
+#include "cpu.h"
+
+// The recompiler emits x86-64 machine code, other hosts always run the interpreter
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// Executions of a guest address in the interpreter before a block starting there is translated
+#define JIT_HOT_THRESHOLD 32
+// Marks addresses whose first instruction can not be translated
+#define JIT_NEVER_TRANSLATE 255
+
+#define JIT_MAX_BLOCK_INSTRUCTIONS 64
+// Worst case size of one translated block, the arena is flushed when less than this is left
+#define JIT_MAX_BLOCK_BYTES (16 * 1024)
+#define JIT_ARENA_SIZE (4 * 1024 * 1024)
+
+// A block jumping back to its own start loops natively this many times before returning to the caller
+#define JIT_BACK_EDGE_BUDGET 4096
+
+// Exit codes of translated code
+#define JIT_EXIT_NORMAL 0
+// The instruction at the exit PC accesses a page without a direct mapping (MMIO, ROM, unmapped or translated code).
+// Nothing of it has happened yet, the interpreter runs it through the slow path
+#define JIT_EXIT_SLOW_ACCESS 1
+
+// Guest state exchanged with translated code.
+// Inside a block the registers live in host registers, this is only read on entry and written on exit
+struct JitContext
+{
+	// Indexed by the 8080 register encoding: B C D E H L (M) A
+	uint8_t registers[8];
+	// Processor Status Word layout, identical to the x86 LAHF layout
+	uint8_t flags;
+	uint16_t programCounter;
+	uint16_t stackPointer;
+	uint32_t backEdgeBudget;
+
+	// T-states retired by the call, counted at every exit and back edge
+	uint32_t cycles;
+} typedef JitContext;
+
+typedef int (*JitCode)(JitContext* context, char* memory, RAM* ram);
+
+struct JitBlock
+{
+	uint16_t startAddress;
+	// Address right after the last translated instruction
+	uint16_t endAddress;
+
+	// T-states of one full pass, the upper bound of a pass that leaves early
+	uint32_t cycles;
+
+	JitCode code;
+
+	// Next block starting in the same RAM page
+	struct JitBlock* pageNext;
+} typedef JitBlock;
+
+struct Jit
+{
+	RAM* ram;
+
+	// Executable memory, translated blocks are appended and only reclaimed all at once
+	unsigned char* arena;
+	size_t arenaUsed;
+
+	JitBlock* blocks[RAM_MEMORY_SIZE];
+	JitBlock* pageBlocks[RAM_PAGE_COUNT];
+	unsigned char hotness[RAM_MEMORY_SIZE];
+
+	JitContext context;
+} typedef Jit;
+
+// Returns NULL when the host can not run translated code (unsupported architecture or no executable memory)
+Jit* init_jit(RAM* ram);
+void free_jit(Jit* jit);
+
+// Runs translated code at the current PC, translating it once it is hot, and adds its T-states to the CPU.
+// Never runs past cycleBudget T-states.
+// Returns FALSE when the caller has to interpret the instruction at PC instead
+BOOL run_jit_block(Jit* jit, CPU* cpu, uint64_t cycleBudget);
+
+// Drops every translated block that covers the address
+void invalidate_jit(Jit* jit, uint16_t address);
\ No newline at end of file
@@ -0,0 +1,993 @@
+#include <string.h>
+
+#include "Lockstep.h"
+#include "Flags.h"
+
+// The vector kernels need AVX2, which is checked at run time. Every kernel also has a portable loop
+#if defined(__x86_64__) || defined(_M_X64)
+#define LOCKSTEP_HAS_AVX2 1
+#include <immintrin.h>
+#else
+#define LOCKSTEP_HAS_AVX2 0
+#endif
+
+#if LOCKSTEP_HAS_AVX2 && defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_FUNCTION
+#elif LOCKSTEP_HAS_AVX2
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+#define GUEST_M 6
+#define GUEST_A 7
+
+// ALU operations in the 8080 encoding order
+#define ALU_ADD 0
+#define ALU_ADC 1
+#define ALU_SUB 2
+#define ALU_SBB 3
+#define ALU_ANA 4
+#define ALU_XRA 5
+#define ALU_ORA 6
+#define ALU_CMP 7
+
+static void* allocate_lanes(size_t size)
+{
+#if defined(_MSC_VER)
+    return _aligned_malloc(size, 64);
+#else
+    void* memory = NULL;
+    return posix_memalign(&memory, 64, size) == 0 ? memory : NULL;
+#endif
+}
+
+static void free_lanes(void* memory)
+{
+#if defined(_MSC_VER)
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+static BOOL detect_avx2()
+{
+#if LOCKSTEP_HAS_AVX2 && defined(_MSC_VER)
+    int registers[4];
+
+    __cpuid(registers, 1);
+    // OSXSAVE and AVX, then the OS has to save the YMM state
+    if ((registers[2] & (1 << 27)) == 0 || (registers[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+    {
+        return FALSE;
+    }
+
+    __cpuidex(registers, 7, 0);
+    return (registers[1] & (1 << 5)) != 0;
+#elif LOCKSTEP_HAS_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return FALSE;
+#endif
+}
+
+LockstepEngine* init_lockstep(int laneCount)
+{
+    if (laneCount <= 0)
+    {
+        return NULL;
+    }
+
+    LockstepEngine* engine = (LockstepEngine*) calloc(1, sizeof(LockstepEngine));
+    if (engine == NULL)
+    {
+        return NULL;
+    }
+
+    int padded = (laneCount + LOCKSTEP_VECTOR_LANES - 1) / LOCKSTEP_VECTOR_LANES * LOCKSTEP_VECTOR_LANES;
+
+    engine->laneCount = laneCount;
+    engine->paddedLaneCount = padded;
+    engine->useAvx2 = detect_avx2();
+
+    engine->lanes = (CPU*) allocate_lanes(sizeof(CPU) * laneCount);
+    engine->rams = (RAM**) calloc((size_t) laneCount, sizeof(RAM*));
+    engine->flags = (uint8_t*) allocate_lanes((size_t) padded);
+    engine->stackPointers = (uint16_t*) allocate_lanes(sizeof(uint16_t) * padded);
+    engine->startCycles = (uint64_t*) allocate_lanes(sizeof(uint64_t) * padded);
+    engine->activeMask = (uint8_t*) allocate_lanes((size_t) padded);
+    engine->activeLanes = (int*) allocate_lanes(sizeof(int) * padded);
+
+    BOOL allocated = engine->lanes != NULL && engine->rams != NULL && engine->flags != NULL && engine->stackPointers != NULL
+        && engine->startCycles != NULL && engine->activeMask != NULL && engine->activeLanes != NULL;
+
+    for (int reg = 0; reg < 8 && allocated; reg++)
+    {
+        if (reg != GUEST_M)
+        {
+            engine->registers[reg] = (uint8_t*) allocate_lanes((size_t) padded);
+            allocated = engine->registers[reg] != NULL;
+        }
+    }
+
+    for (int lane = 0; lane < laneCount && allocated; lane++)
+    {
+        engine->lanes[lane] = init_cpu();
+        engine->rams[lane] = init_ram();
+        allocated = engine->rams[lane] != NULL;
+    }
+
+    if (!allocated)
+    {
+        free_lockstep(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+void free_lockstep(LockstepEngine* engine)
+{
+    for (int lane = 0; lane < engine->laneCount && engine->rams != NULL && engine->lanes != NULL; lane++)
+    {
+        if (engine->rams[lane] != NULL)
+        {
+            free_cpu(&engine->lanes[lane]);
+            free_ram(engine->rams[lane]);
+        }
+    }
+
+    for (int reg = 0; reg < 8; reg++)
+    {
+        free_lanes(engine->registers[reg]);
+    }
+
+    free_lanes(engine->lanes);
+    free(engine->rams);
+    free_lanes(engine->flags);
+    free_lanes(engine->stackPointers);
+    free_lanes(engine->startCycles);
+    free_lanes(engine->activeMask);
+    free_lanes(engine->activeLanes);
+    free(engine);
+}
+
+BOOL lockstep_load(LockstepEngine* engine, unsigned short offset, const void* data, size_t size)
+{
+    for (int lane = 0; lane < engine->laneCount; lane++)
+    {
+        if (!ram_load(engine->rams[lane], offset, data, size))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+// The first guest write into a shared page, the lanes may hold different bytes there from now on
+static void on_shared_page_write(void* context, unsigned short offset)
+{
+    LockstepEngine* engine = (LockstepEngine*) context;
+    unsigned int page = offset / RAM_PAGE_SIZE;
+
+    if (!engine->sharedPages[page])
+    {
+        return;
+    }
+
+    engine->sharedPages[page] = FALSE;
+
+    for (int lane = 0; lane < engine->laneCount; lane++)
+    {
+        ram_remove_code_page(engine->rams[lane], page);
+    }
+}
+
+// Shared pages leave the direct write path of every lane, so a write reaches on_shared_page_write.
+// Translations of an earlier scalar run own the code write handler and are dropped first
+static void watch_shared_page(LockstepEngine* engine, unsigned int page)
+{
+    if (engine->sharedPages[page])
+    {
+        return;
+    }
+
+    engine->sharedPages[page] = TRUE;
+
+    for (int lane = 0; lane < engine->laneCount; lane++)
+    {
+        RAM* ram = engine->rams[lane];
+
+        if (ram->codeWriteHandler != on_shared_page_write)
+        {
+            free_cpu(&engine->lanes[lane]);
+
+            ram->codeWriteHandler = on_shared_page_write;
+            ram->codeWriteContext = engine;
+        }
+
+        ram_add_code_page(ram, page);
+    }
+}
+
+// Called before the scalar core takes over the lanes. Its writes are not watched, so no page counts as shared anymore
+static void forget_shared_pages(LockstepEngine* engine)
+{
+    for (unsigned int page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        if (engine->sharedPages[page])
+        {
+            on_shared_page_write(engine, (unsigned short) (page * RAM_PAGE_SIZE));
+        }
+    }
+
+    for (int lane = 0; lane < engine->laneCount; lane++)
+    {
+        engine->rams[lane]->codeWriteHandler = NULL;
+        engine->rams[lane]->codeWriteContext = NULL;
+    }
+}
+
+BOOL lockstep_load_shared(LockstepEngine* engine, unsigned short offset, const void* data, size_t size)
+{
+    if (size == 0 || !lockstep_load(engine, offset, data, size))
+    {
+        return FALSE;
+    }
+
+    unsigned int firstPage = offset / RAM_PAGE_SIZE;
+    unsigned int pageCount = (unsigned int) ((offset % RAM_PAGE_SIZE + size + RAM_PAGE_SIZE - 1) / RAM_PAGE_SIZE);
+    if (pageCount > RAM_PAGE_COUNT)
+    {
+        pageCount = RAM_PAGE_COUNT;
+    }
+
+    for (unsigned int i = 0; i < pageCount; i++)
+    {
+        watch_shared_page(engine, (firstPage + i) % RAM_PAGE_COUNT);
+    }
+
+    return TRUE;
+}
+
+// Moving a lane between its CPU and the structure of arrays
+
+static void store_lane(LockstepEngine* engine, int lane, uint16_t programCounter)
+{
+    CPU* cpu = &engine->lanes[lane];
+
+    cpu->B = engine->registers[0][lane];
+    cpu->C = engine->registers[1][lane];
+    cpu->D = engine->registers[2][lane];
+    cpu->E = engine->registers[3][lane];
+    cpu->H = engine->registers[4][lane];
+    cpu->L = engine->registers[5][lane];
+    cpu->A = engine->registers[GUEST_A][lane];
+    unpack_flags(cpu, engine->flags[lane]);
+
+    cpu->stackPointer.data = engine->stackPointers[lane];
+    cpu->programCounter.data = programCounter;
+    cpu->cycles = engine->startCycles[lane] + engine->cycles;
+}
+
+static void load_lane(LockstepEngine* engine, int lane)
+{
+    CPU* cpu = &engine->lanes[lane];
+
+    engine->registers[0][lane] = cpu->B;
+    engine->registers[1][lane] = cpu->C;
+    engine->registers[2][lane] = cpu->D;
+    engine->registers[3][lane] = cpu->E;
+    engine->registers[4][lane] = cpu->H;
+    engine->registers[5][lane] = cpu->L;
+    engine->registers[GUEST_A][lane] = cpu->A;
+    engine->flags[lane] = pack_flags(cpu);
+
+    engine->stackPointers[lane] = cpu->stackPointer.data;
+}
+
+// Takes a lane out of lockstep, its CPU has to hold its state already
+static void peel_lane(LockstepEngine* engine, int lane)
+{
+    engine->activeMask[lane] = 0;
+    engine->peeledLanes++;
+}
+
+static void compact_active_lanes(LockstepEngine* engine)
+{
+    int count = 0;
+
+    for (int i = 0; i < engine->activeCount; i++)
+    {
+        int lane = engine->activeLanes[i];
+
+        if (engine->activeMask[lane] != 0)
+        {
+            engine->activeLanes[count++] = lane;
+        }
+    }
+
+    engine->activeCount = count;
+}
+
+// Flags of a result as cpu.c computes them: auxiliary is the byte whose bit 4 XOR the result's is the auxiliary carry
+static unsigned char lane_flags(unsigned char result, unsigned char auxiliary, unsigned char carry)
+{
+    return (unsigned char) (zero_sign_parity_flags[result] | ((auxiliary ^ result) & FLAG_AUXILIARY_CARRY) | FLAG_RESERVED | carry);
+}
+
+// Portable kernels
+
+static void alu_lanes_portable(uint8_t* accumulator, uint8_t* flags, const uint8_t* source, uint8_t immediate, int operation, int count)
+{
+    for (int lane = 0; lane < count; lane++)
+    {
+        unsigned char first = accumulator[lane];
+        unsigned char second = source != NULL ? source[lane] : immediate;
+        unsigned char carry = flags[lane] & FLAG_CARRY;
+        unsigned char result;
+
+        switch (operation)
+        {
+            case ALU_ADD:
+            case ALU_ADC:
+            {
+                uint16_t sum = first + second + (operation == ALU_ADC ? carry : 0);
+                result = (unsigned char) sum;
+                flags[lane] = lane_flags(result, first ^ second, (sum >> 8) & 1);
+                break;
+            }
+            // Adds the one's complement with the inverted borrow, the carry flag then holds the borrow
+            case ALU_SUB:
+            case ALU_SBB:
+            case ALU_CMP:
+            {
+                unsigned char complement = (unsigned char) ~second;
+                uint16_t sum = first + complement + !(operation == ALU_SBB ? carry : 0);
+                result = (unsigned char) sum;
+                flags[lane] = lane_flags(result, first ^ complement, ((sum >> 8) & 1) ^ 1);
+                break;
+            }
+            case ALU_ANA:
+                result = first & second;
+                flags[lane] = lane_flags(result, result ^ (((first | second) << 1) & 0x10), 0);
+                break;
+            case ALU_XRA:
+                result = first ^ second;
+                flags[lane] = lane_flags(result, result, 0);
+                break;
+            default:
+                result = first | second;
+                flags[lane] = lane_flags(result, result, 0);
+                break;
+        }
+
+        if (operation != ALU_CMP)
+        {
+            accumulator[lane] = result;
+        }
+    }
+}
+
+// INR when delta is 1, DCR when delta is 0xFF. The carry stays
+static void step_lanes_portable(uint8_t* values, uint8_t* flags, uint8_t delta, int count)
+{
+    for (int lane = 0; lane < count; lane++)
+    {
+        unsigned char value = values[lane];
+        unsigned char result = (unsigned char) (value + delta);
+
+        flags[lane] = lane_flags(result, value ^ delta, flags[lane] & FLAG_CARRY);
+        values[lane] = result;
+    }
+}
+
+// TRUE when an active lane has the flag in another state than isSet
+static BOOL flag_differs_portable(const uint8_t* flags, const uint8_t* activeMask, uint8_t flag, BOOL isSet, int count)
+{
+    for (int lane = 0; lane < count; lane++)
+    {
+        if (activeMask[lane] != 0 && ((flags[lane] & flag) != 0) != isSet)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+#if LOCKSTEP_HAS_AVX2
+
+// AVX2 kernels, 32 lanes per iteration. The lane arrays are padded, so there is no tail
+
+// Unsigned first < second as 0xFF / 0x00 per byte
+AVX2_FUNCTION static __m256i less_than_avx2(__m256i first, __m256i second)
+{
+    return _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(first, second), first), _mm256_set1_epi8(-1));
+}
+
+// Sign, zero, parity, auxiliary carry, the reserved bit and the carry
+AVX2_FUNCTION static __m256i result_flags_avx2(__m256i result, __m256i auxiliary, __m256i carry)
+{
+    // FLAG_PARITY for the nibbles with an even number of set bits, a byte is even when both nibbles agree
+    const __m256i evenNibbles = _mm256_setr_epi8(
+        4, 0, 0, 4, 0, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 4,
+        4, 0, 0, 4, 0, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 4);
+    const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+
+    __m256i low = _mm256_shuffle_epi8(evenNibbles, _mm256_and_si256(result, lowNibble));
+    __m256i high = _mm256_shuffle_epi8(evenNibbles, _mm256_and_si256(_mm256_srli_epi16(result, 4), lowNibble));
+    __m256i parity = _mm256_xor_si256(_mm256_xor_si256(low, high), _mm256_set1_epi8(FLAG_PARITY));
+
+    __m256i sign = _mm256_and_si256(result, _mm256_set1_epi8((char) FLAG_SIGN));
+    __m256i zero = _mm256_and_si256(_mm256_cmpeq_epi8(result, _mm256_setzero_si256()), _mm256_set1_epi8(FLAG_ZERO));
+    __m256i auxiliaryCarry = _mm256_and_si256(_mm256_xor_si256(auxiliary, result), _mm256_set1_epi8(FLAG_AUXILIARY_CARRY));
+
+    __m256i flags = _mm256_or_si256(_mm256_or_si256(sign, zero), _mm256_or_si256(parity, auxiliaryCarry));
+    return _mm256_or_si256(flags, _mm256_or_si256(carry, _mm256_set1_epi8(FLAG_RESERVED)));
+}
+
+AVX2_FUNCTION static void alu_lanes_avx2(uint8_t* accumulator, uint8_t* flags, const uint8_t* source, uint8_t immediate, int operation, int count)
+{
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i allBits = _mm256_set1_epi8(-1);
+    BOOL subtract = operation == ALU_SUB || operation == ALU_SBB || operation == ALU_CMP;
+
+    for (int lane = 0; lane < count; lane += LOCKSTEP_VECTOR_LANES)
+    {
+        __m256i first = _mm256_load_si256((const __m256i*) (accumulator + lane));
+        __m256i flagsIn = _mm256_load_si256((const __m256i*) (flags + lane));
+        __m256i second = source != NULL ? _mm256_load_si256((const __m256i*) (source + lane)) : _mm256_set1_epi8((char) immediate);
+        __m256i carryFlag = _mm256_and_si256(flagsIn, ones);
+        __m256i result;
+        __m256i auxiliary;
+        __m256i carry = _mm256_setzero_si256();
+
+        switch (operation)
+        {
+            case ALU_ANA:
+            {
+                __m256i bit3 = _mm256_and_si256(_mm256_or_si256(first, second), _mm256_set1_epi8(0x08));
+                result = _mm256_and_si256(first, second);
+                auxiliary = _mm256_xor_si256(result, _mm256_add_epi8(bit3, bit3));
+                break;
+            }
+            case ALU_XRA:
+                result = _mm256_xor_si256(first, second);
+                auxiliary = result;
+                break;
+            case ALU_ORA:
+                result = _mm256_or_si256(first, second);
+                auxiliary = result;
+                break;
+            default:
+            {
+                __m256i carryIn;
+
+                if (subtract)
+                {
+                    second = _mm256_xor_si256(second, allBits);
+                    carryIn = operation == ALU_SBB ? _mm256_xor_si256(carryFlag, ones) : ones;
+                }
+                else
+                {
+                    carryIn = operation == ALU_ADC ? carryFlag : _mm256_setzero_si256();
+                }
+
+                // Carry out of the two additions, at most one of them can wrap
+                __m256i sum = _mm256_add_epi8(first, second);
+                result = _mm256_add_epi8(sum, carryIn);
+                carry = _mm256_and_si256(_mm256_or_si256(less_than_avx2(sum, first), less_than_avx2(result, sum)), ones);
+
+                if (subtract)
+                {
+                    carry = _mm256_xor_si256(carry, ones);
+                }
+
+                auxiliary = _mm256_xor_si256(first, second);
+                break;
+            }
+        }
+
+        _mm256_store_si256((__m256i*) (flags + lane), result_flags_avx2(result, auxiliary, carry));
+
+        if (operation != ALU_CMP)
+        {
+            _mm256_store_si256((__m256i*) (accumulator + lane), result);
+        }
+    }
+}
+
+AVX2_FUNCTION static void step_lanes_avx2(uint8_t* values, uint8_t* flags, uint8_t delta, int count)
+{
+    const __m256i deltas = _mm256_set1_epi8((char) delta);
+    const __m256i ones = _mm256_set1_epi8(1);
+
+    for (int lane = 0; lane < count; lane += LOCKSTEP_VECTOR_LANES)
+    {
+        __m256i value = _mm256_load_si256((const __m256i*) (values + lane));
+        __m256i carry = _mm256_and_si256(_mm256_load_si256((const __m256i*) (flags + lane)), ones);
+        __m256i result = _mm256_add_epi8(value, deltas);
+
+        _mm256_store_si256((__m256i*) (flags + lane), result_flags_avx2(result, _mm256_xor_si256(value, deltas), carry));
+        _mm256_store_si256((__m256i*) (values + lane), result);
+    }
+}
+
+AVX2_FUNCTION static BOOL flag_differs_avx2(const uint8_t* flags, const uint8_t* activeMask, uint8_t flag, BOOL isSet, int count)
+{
+    const __m256i flagBits = _mm256_set1_epi8((char) flag);
+    // Lanes where the flag is clear compare equal to zero, XOR with the expectation leaves the disagreeing lanes
+    const __m256i expectedClear = _mm256_set1_epi8(isSet ? 0 : -1);
+
+    __m256i differs = _mm256_setzero_si256();
+
+    for (int lane = 0; lane < count; lane += LOCKSTEP_VECTOR_LANES)
+    {
+        __m256i clear = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_load_si256((const __m256i*) (flags + lane)), flagBits), _mm256_setzero_si256());
+        __m256i active = _mm256_load_si256((const __m256i*) (activeMask + lane));
+
+        differs = _mm256_or_si256(differs, _mm256_and_si256(_mm256_xor_si256(clear, expectedClear), active));
+    }
+
+    return !_mm256_testz_si256(differs, differs);
+}
+
+#endif
+
+static void alu_lanes(LockstepEngine* engine, int operation, const uint8_t* source, uint8_t immediate)
+{
+#if LOCKSTEP_HAS_AVX2
+    if (engine->useAvx2)
+    {
+        alu_lanes_avx2(engine->registers[GUEST_A], engine->flags, source, immediate, operation, engine->paddedLaneCount);
+        return;
+    }
+#endif
+
+    alu_lanes_portable(engine->registers[GUEST_A], engine->flags, source, immediate, operation, engine->paddedLaneCount);
+}
+
+static void step_lanes(LockstepEngine* engine, uint8_t* values, uint8_t delta)
+{
+#if LOCKSTEP_HAS_AVX2
+    if (engine->useAvx2)
+    {
+        step_lanes_avx2(values, engine->flags, delta, engine->paddedLaneCount);
+        return;
+    }
+#endif
+
+    step_lanes_portable(values, engine->flags, delta, engine->paddedLaneCount);
+}
+
+static BOOL flag_differs(LockstepEngine* engine, uint8_t flag, BOOL isSet)
+{
+#if LOCKSTEP_HAS_AVX2
+    if (engine->useAvx2)
+    {
+        return flag_differs_avx2(engine->flags, engine->activeMask, flag, isSet, engine->paddedLaneCount);
+    }
+#endif
+
+    return flag_differs_portable(engine->flags, engine->activeMask, flag, isSet, engine->paddedLaneCount);
+}
+
+// Register pair helpers, the pair index is the one of LXI / INX / DAD (B, D, H)
+
+static void set_pair_lanes(LockstepEngine* engine, int pair, uint16_t value)
+{
+    memset(engine->registers[pair * 2], value >> 8, (size_t) engine->paddedLaneCount);
+    memset(engine->registers[pair * 2 + 1], value & 0xFF, (size_t) engine->paddedLaneCount);
+}
+
+static void add_pair_lanes(LockstepEngine* engine, int pair, uint16_t delta)
+{
+    uint8_t* high = engine->registers[pair * 2];
+    uint8_t* low = engine->registers[pair * 2 + 1];
+
+    for (int lane = 0; lane < engine->paddedLaneCount; lane++)
+    {
+        uint16_t value = (uint16_t) (((high[lane] << 8) | low[lane]) + delta);
+
+        high[lane] = (uint8_t) (value >> 8);
+        low[lane] = (uint8_t) value;
+    }
+}
+
+// DAD, HL += rp with the carry out of bit 15. SP is passed as pair 3
+static void dad_lanes(LockstepEngine* engine, int pair)
+{
+    uint8_t* high = engine->registers[4];
+    uint8_t* low = engine->registers[5];
+
+    for (int lane = 0; lane < engine->paddedLaneCount; lane++)
+    {
+        uint32_t operand = pair == 3
+            ? engine->stackPointers[lane]
+            : (uint32_t) ((engine->registers[pair * 2][lane] << 8) | engine->registers[pair * 2 + 1][lane]);
+        uint32_t result = (uint32_t) ((high[lane] << 8) | low[lane]) + operand;
+
+        high[lane] = (uint8_t) (result >> 8);
+        low[lane] = (uint8_t) result;
+        engine->flags[lane] = (uint8_t) ((engine->flags[lane] & ~FLAG_CARRY) | ((result >> 16) & 1));
+    }
+}
+
+// RLC, RRC, RAL, RAR in the order of their opcodes
+static void rotate_lanes(LockstepEngine* engine, int rotation)
+{
+    uint8_t* accumulator = engine->registers[GUEST_A];
+
+    for (int lane = 0; lane < engine->paddedLaneCount; lane++)
+    {
+        unsigned char value = accumulator[lane];
+        unsigned char carry = engine->flags[lane] & FLAG_CARRY;
+        unsigned char carryOut = (rotation & 1) ? (value & 1) : (value >> 7);
+        unsigned char incoming = rotation >= 2 ? carry : carryOut;
+
+        accumulator[lane] = (rotation & 1)
+            ? (unsigned char) ((value >> 1) | (incoming << 7))
+            : (unsigned char) ((value << 1) | incoming);
+        engine->flags[lane] = (uint8_t) ((engine->flags[lane] & ~FLAG_CARRY) | carryOut);
+    }
+}
+
+static void xor_flags_lanes(LockstepEngine* engine, uint8_t bits, BOOL set)
+{
+    for (int lane = 0; lane < engine->paddedLaneCount; lane++)
+    {
+        engine->flags[lane] = set ? (uint8_t) (engine->flags[lane] | bits) : (uint8_t) (engine->flags[lane] ^ bits);
+    }
+}
+
+// Jcc: lanes that decide the branch like the first lane stay, the others are peeled off with their own target
+static void branch_lanes(LockstepEngine* engine, unsigned char opCode, uint16_t target, uint16_t nextAddress)
+{
+    static const uint8_t conditionFlags[4] = { FLAG_ZERO, FLAG_CARRY, FLAG_PARITY, FLAG_SIGN };
+
+    int condition = (opCode >> 3) & 7;
+    uint8_t flag = conditionFlags[condition >> 1];
+    BOOL takenWhenSet = condition & 1;
+
+    BOOL leaderSet = (engine->flags[engine->activeLanes[0]] & flag) != 0;
+    BOOL leaderTaken = leaderSet == takenWhenSet;
+
+    if (flag_differs(engine, flag, leaderSet))
+    {
+        for (int i = 1; i < engine->activeCount; i++)
+        {
+            int lane = engine->activeLanes[i];
+
+            if (((engine->flags[lane] & flag) != 0) != leaderSet)
+            {
+                store_lane(engine, lane, leaderTaken ? nextAddress : target);
+                peel_lane(engine, lane);
+            }
+        }
+    }
+
+    engine->programCounter = leaderTaken ? target : nextAddress;
+}
+
+// Runs the instruction as vector kernels over all lanes. Returns FALSE for instructions without a kernel
+static BOOL execute_vector(LockstepEngine* engine, unsigned char opCode, uint16_t operand, uint16_t nextAddress)
+{
+    int count = engine->paddedLaneCount;
+
+    // MOV r, r
+    if (opCode >= 0x40 && opCode <= 0x7f && (opCode & 7) != GUEST_M && ((opCode >> 3) & 7) != GUEST_M)
+    {
+        int destination = (opCode >> 3) & 7;
+        int source = opCode & 7;
+
+        if (destination != source)
+        {
+            memcpy(engine->registers[destination], engine->registers[source], (size_t) count);
+        }
+
+        return TRUE;
+    }
+
+    // ADD / ADC / SUB / SBB / ANA / XRA / ORA / CMP r
+    if (opCode >= 0x80 && opCode <= 0xbf && (opCode & 7) != GUEST_M)
+    {
+        alu_lanes(engine, (opCode >> 3) & 7, engine->registers[opCode & 7], 0);
+        return TRUE;
+    }
+
+    // ADI / ACI / SUI / SBI / ANI / XRI / ORI / CPI
+    if ((opCode & 0xc7) == 0xc6)
+    {
+        alu_lanes(engine, (opCode >> 3) & 7, NULL, (uint8_t) operand);
+        return TRUE;
+    }
+
+    // INR r / DCR r / MVI r
+    if (opCode < 0x40 && ((opCode >> 3) & 7) != GUEST_M && ((opCode & 7) == 4 || (opCode & 7) == 5 || (opCode & 7) == 6))
+    {
+        uint8_t* values = engine->registers[(opCode >> 3) & 7];
+
+        if ((opCode & 7) == 6)
+        {
+            memset(values, operand & 0xFF, (size_t) count);
+        }
+        else
+        {
+            step_lanes(engine, values, (opCode & 7) == 4 ? 0x01 : 0xFF);
+        }
+
+        return TRUE;
+    }
+
+    // LXI / INX / DAD / DCX
+    if (opCode < 0x40 && ((opCode & 0x0f) == 0x01 || (opCode & 0x0f) == 0x03 || (opCode & 0x0f) == 0x09 || (opCode & 0x0f) == 0x0b))
+    {
+        int pair = opCode >> 4;
+        uint16_t delta = (opCode & 0x0f) == 0x03 ? 1 : 0xFFFF;
+
+        switch (opCode & 0x0f)
+        {
+            case 0x01:
+                if (pair == 3)
+                {
+                    for (int lane = 0; lane < count; lane++)
+                    {
+                        engine->stackPointers[lane] = operand;
+                    }
+                }
+                else
+                {
+                    set_pair_lanes(engine, pair, operand);
+                }
+                break;
+            case 0x09:
+                dad_lanes(engine, pair);
+                break;
+            default:
+                if (pair == 3)
+                {
+                    for (int lane = 0; lane < count; lane++)
+                    {
+                        engine->stackPointers[lane] = (uint16_t) (engine->stackPointers[lane] + delta);
+                    }
+                }
+                else
+                {
+                    add_pair_lanes(engine, pair, delta);
+                }
+                break;
+        }
+
+        return TRUE;
+    }
+
+    // Jcc adr
+    if ((opCode & 0xc7) == 0xc2)
+    {
+        branch_lanes(engine, opCode, operand, nextAddress);
+        return TRUE;
+    }
+
+    switch (opCode)
+    {
+        // NOP and its undocumented twins
+        case 0x00:
+        case 0x08:
+        case 0x10:
+        case 0x18:
+        case 0x20:
+        case 0x28:
+        case 0x30:
+        case 0x38:
+            return TRUE;
+        // RLC / RRC / RAL / RAR
+        case 0x07:
+        case 0x0f:
+        case 0x17:
+        case 0x1f:
+            rotate_lanes(engine, (opCode >> 3) & 3);
+            return TRUE;
+        // CMA
+        case 0x2f:
+            for (int lane = 0; lane < count; lane++)
+            {
+                engine->registers[GUEST_A][lane] = (uint8_t) ~engine->registers[GUEST_A][lane];
+            }
+            return TRUE;
+        // STC / CMC
+        case 0x37:
+        case 0x3f:
+            xor_flags_lanes(engine, FLAG_CARRY, opCode == 0x37);
+            return TRUE;
+        // XCHG swaps the lane arrays of DE and HL
+        case 0xeb:
+        {
+            uint8_t* high = engine->registers[2];
+            uint8_t* low = engine->registers[3];
+
+            engine->registers[2] = engine->registers[4];
+            engine->registers[3] = engine->registers[5];
+            engine->registers[4] = high;
+            engine->registers[5] = low;
+            return TRUE;
+        }
+        // JMP adr
+        case 0xc3:
+        case 0xcb:
+            engine->programCounter = operand;
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+// Runs the instruction lane by lane with the regular handler.
+// Lanes that end at another PC, take a different number of cycles or do not halt like the first lane are peeled off
+static void execute_lanes(LockstepEngine* engine, unsigned char opCode, uint16_t operand, uint16_t nextAddress)
+{
+    InstructionHandler handler = instruction_handlers[opCode];
+
+    uint16_t leaderProgramCounter = 0;
+    uint64_t leaderCycles = 0;
+    BOOL leaderHalted = FALSE;
+
+    for (int i = 0; i < engine->activeCount; i++)
+    {
+        int lane = engine->activeLanes[i];
+        CPU* cpu = &engine->lanes[lane];
+
+        store_lane(engine, lane, nextAddress);
+        handler(cpu, engine->rams[lane], operand);
+        load_lane(engine, lane);
+
+        if (i == 0)
+        {
+            leaderProgramCounter = cpu->programCounter.data;
+            leaderCycles = cpu->cycles - engine->startCycles[lane];
+            leaderHalted = cpu->halted;
+        }
+        else if (cpu->programCounter.data != leaderProgramCounter || cpu->cycles - engine->startCycles[lane] != leaderCycles || cpu->halted != leaderHalted)
+        {
+            peel_lane(engine, lane);
+        }
+    }
+
+    engine->programCounter = leaderProgramCounter;
+    engine->cycles = leaderCycles;
+    engine->halted = leaderHalted;
+}
+
+// Reads the next instruction from the first lane.
+// Outside shared pages the other lanes may hold different code there, those are peeled off in front of it
+static unsigned char fetch_lockstep(LockstepEngine* engine, uint16_t* operand)
+{
+    uint16_t address = engine->programCounter;
+    RAM* leader = engine->rams[engine->activeLanes[0]];
+
+    unsigned char opCode = (unsigned char) read_memory_ram(leader, address);
+    unsigned char length = instruction_lengths[opCode];
+
+    *operand = 0;
+    if (length > 1)
+    {
+        *operand = (unsigned char) read_memory_ram(leader, (uint16_t) (address + 1));
+    }
+    if (length > 2)
+    {
+        *operand |= (uint16_t) ((unsigned char) read_memory_ram(leader, (uint16_t) (address + 2)) << 8);
+    }
+
+    uint16_t lastAddress = (uint16_t) (address + length - 1);
+    if (engine->sharedPages[address / RAM_PAGE_SIZE] && engine->sharedPages[lastAddress / RAM_PAGE_SIZE])
+    {
+        return opCode;
+    }
+
+    for (int i = 1; i < engine->activeCount; i++)
+    {
+        int lane = engine->activeLanes[i];
+        RAM* ram = engine->rams[lane];
+
+        BOOL same = (unsigned char) read_memory_ram(ram, address) == opCode
+            && (length < 2 || (unsigned char) read_memory_ram(ram, (uint16_t) (address + 1)) == (*operand & 0xFF))
+            && (length < 3 || (unsigned char) read_memory_ram(ram, (uint16_t) (address + 2)) == (*operand >> 8));
+
+        if (!same)
+        {
+            store_lane(engine, lane, address);
+            peel_lane(engine, lane);
+        }
+    }
+
+    return opCode;
+}
+
+// Loads every lane that starts at the PC of lane 0 into the structure of arrays
+static void start_lockstep(LockstepEngine* engine)
+{
+    engine->programCounter = engine->lanes[0].programCounter.data;
+    engine->cycles = 0;
+    engine->halted = FALSE;
+    engine->activeCount = 0;
+
+    memset(engine->activeMask, 0, (size_t) engine->paddedLaneCount);
+
+    for (int lane = 0; lane < engine->laneCount; lane++)
+    {
+        CPU* cpu = &engine->lanes[lane];
+
+        load_lane(engine, lane);
+        engine->startCycles[lane] = cpu->cycles;
+
+        if (!cpu->halted && cpu->programCounter.data == engine->programCounter)
+        {
+            engine->activeMask[lane] = 0xFF;
+            engine->activeLanes[engine->activeCount++] = lane;
+        }
+        else
+        {
+            engine->peeledLanes++;
+        }
+    }
+}
+
+void lockstep_run_until_halt(LockstepEngine* engine, CPU_Core scalarCore)
+{
+    start_lockstep(engine);
+
+    while (!engine->halted && engine->activeCount >= LOCKSTEP_MIN_ACTIVE_LANES)
+    {
+        int activeBefore = engine->activeCount;
+        int peeledBefore = engine->peeledLanes;
+        uint16_t operand;
+        unsigned char opCode = fetch_lockstep(engine, &operand);
+        uint16_t nextAddress = (uint16_t) (engine->programCounter + instruction_lengths[opCode]);
+
+        engine->cycles += instruction_cycles[opCode];
+        engine->programCounter = nextAddress;
+
+        if (!execute_vector(engine, opCode, operand, nextAddress))
+        {
+            execute_lanes(engine, opCode, operand, nextAddress);
+        }
+
+        if (engine->peeledLanes != peeledBefore)
+        {
+            compact_active_lanes(engine);
+        }
+
+        engine->lockstepInstructions += (uint64_t) activeBefore;
+    }
+
+    // The lanes still in lockstep either halted together or are too few to be worth the kernels
+    for (int i = 0; i < engine->activeCount; i++)
+    {
+        int lane = engine->activeLanes[i];
+
+        store_lane(engine, lane, engine->programCounter);
+        engine->lanes[lane].halted = engine->halted;
+
+        if (!engine->halted)
+        {
+            peel_lane(engine, lane);
+        }
+    }
+
+    engine->activeCount = 0;
+
+    for (int lane = 0; lane < engine->laneCount; lane++)
+    {
+        if (!engine->lanes[lane].halted)
+        {
+            if (engine->rams[lane]->codeWriteHandler == on_shared_page_write)
+            {
+                forget_shared_pages(engine);
+            }
+
+            engine->lanes[lane].core = scalarCore;
+            cpu_run_until_halt(&engine->lanes[lane], engine->rams[lane]);
+        }
+    }
+}
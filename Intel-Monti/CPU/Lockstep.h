@@ -0,0 +1,69 @@
+#pragma once
+
+#include "cpu.h"
+
+// Lanes per AVX2 vector of 8-bit registers, the lane arrays are padded to a multiple of it
+#define LOCKSTEP_VECTOR_LANES 32
+
+// Below this many lanes in lockstep the vector kernels stop paying off, the rest runs on the scalar core
+#define LOCKSTEP_MIN_ACTIVE_LANES 8
+
+// Runs many instances of one program side by side.
+// While all lanes share the same PC their registers are kept as a structure of arrays and every register-only
+// instruction runs as one vector kernel over all lanes. Memory, stack and I/O instructions are executed lane by lane
+// with the regular handlers. A lane whose PC leaves the shared one (a branch decided differently, a RET to another
+// address, different code bytes) is peeled off and finished by the scalar core
+struct LockstepEngine
+{
+	int laneCount;
+	int paddedLaneCount;
+
+	// Scalar state and memory of every lane.
+	// Set the inputs here before lockstep_run_until_halt, the final state is found here afterwards
+	CPU* lanes;
+	RAM** rams;
+
+	// Structure of arrays of the lanes in lockstep, indexed by the 8080 register encoding B C D E H L (M) A
+	uint8_t* registers[8];
+	// Materialized flags in the PSW layout
+	uint8_t* flags;
+	uint16_t* stackPointers;
+	// Cycle counter of each lane when lockstep execution started
+	uint64_t* startCycles;
+
+	// 0xFF for the lanes in lockstep, 0 for peeled lanes and padding
+	uint8_t* activeMask;
+	int* activeLanes;
+	int activeCount;
+
+	// Shared by all lanes in lockstep
+	uint16_t programCounter;
+	uint64_t cycles;
+	BOOL halted;
+
+	// Pages written by lockstep_load_shared that hold the same bytes in every lane,
+	// code fetched from them needs no comparison between the lanes. The first write into one clears it
+	BOOL sharedPages[RAM_PAGE_COUNT];
+
+	BOOL useAvx2;
+
+	// Lane instructions executed in lockstep and lanes handed over to the scalar core
+	uint64_t lockstepInstructions;
+	int peeledLanes;
+} typedef LockstepEngine;
+
+// Returns NULL when the lanes can not be allocated
+LockstepEngine* init_lockstep(int laneCount);
+void free_lockstep(LockstepEngine* engine);
+
+// Loads the same image into every lane
+BOOL lockstep_load(LockstepEngine* engine, unsigned short offset, const void* data, size_t size);
+
+// Loads the image into every lane, the pages it covers stay RAM.
+// Until something writes into one of them, instructions are fetched there without comparing the lanes.
+// The lanes run on the scalar core drop the pages, their writes are not watched
+BOOL lockstep_load_shared(LockstepEngine* engine, unsigned short offset, const void* data, size_t size);
+
+// Starts all lanes at the PC of lane 0 and runs them until every lane halted.
+// Peeled lanes finish on scalarCore
+void lockstep_run_until_halt(LockstepEngine* engine, CPU_Core scalarCore);
\ No newline at end of file
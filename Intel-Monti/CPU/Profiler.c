@@ -0,0 +1,226 @@
+#include <stdlib.h>
+
+#include "Profiler.h"
+#include "cpu.h"
+
+// Sorts an opcode into its group by the 8080 encoding
+static ProfileClass classify_opcode(unsigned char opCode)
+{
+    // HLT sits in the middle of the MOV block
+    if (opCode == 0x76)
+    {
+        return PROFILE_CLASS_CONTROL;
+    }
+
+    switch (opCode >> 6)
+    {
+        case 1:
+            return PROFILE_CLASS_DATA_TRANSFER;
+        case 2:
+            // ADD ADC SUB SBB, then ANA XRA ORA CMP
+            return opCode < 0xa0 ? PROFILE_CLASS_ARITHMETIC : PROFILE_CLASS_LOGICAL;
+        case 0:
+            switch (opCode & 0x07)
+            {
+                case 0:
+                    // NOP and its undocumented twins
+                    return PROFILE_CLASS_CONTROL;
+                case 1:
+                    // LXI, DAD
+                    return opCode & 0x08 ? PROFILE_CLASS_ARITHMETIC : PROFILE_CLASS_DATA_TRANSFER;
+                case 2:
+                case 6:
+                    // STAX LDAX SHLD LHLD STA LDA, MVI
+                    return PROFILE_CLASS_DATA_TRANSFER;
+                case 7:
+                    // RLC RRC RAL RAR DAA CMA STC CMC
+                    return opCode == 0x27 ? PROFILE_CLASS_ARITHMETIC : PROFILE_CLASS_LOGICAL;
+                default:
+                    // INX DCX INR DCR
+                    return PROFILE_CLASS_ARITHMETIC;
+            }
+        default:
+            switch (opCode & 0x07)
+            {
+                case 1:
+                    // POP SPHL, RET PCHL
+                    return opCode == 0xf9 || (opCode & 0x08) == 0 ? PROFILE_CLASS_CONTROL : PROFILE_CLASS_BRANCH;
+                case 3:
+                    // JMP, OUT IN XTHL DI EI, XCHG
+                    if (opCode == 0xc3 || opCode == 0xcb)
+                    {
+                        return PROFILE_CLASS_BRANCH;
+                    }
+                    return opCode == 0xeb ? PROFILE_CLASS_DATA_TRANSFER : PROFILE_CLASS_CONTROL;
+                case 5:
+                    // PUSH, CALL
+                    return opCode & 0x08 ? PROFILE_CLASS_BRANCH : PROFILE_CLASS_CONTROL;
+                case 6:
+                    // ADI ACI SUI SBI, then ANI XRI ORI CPI
+                    return opCode < 0xe0 ? PROFILE_CLASS_ARITHMETIC : PROFILE_CLASS_LOGICAL;
+                default:
+                    // Conditional returns, jumps and calls, RST
+                    return PROFILE_CLASS_BRANCH;
+            }
+    }
+}
+
+CpuProfile* init_cpu_profile()
+{
+    CpuProfile* profile = (CpuProfile*) calloc(1, sizeof(CpuProfile));
+    if (profile == NULL)
+    {
+        return NULL;
+    }
+
+    for (int opCode = 0; opCode < 256; opCode++)
+    {
+        profile->opcodeClasses[opCode] = (unsigned char) classify_opcode((unsigned char) opCode);
+    }
+
+    // The cheapest of a few empty measurements
+    profile->tickOverhead = UINT64_MAX;
+    for (int i = 0; i < 64; i++)
+    {
+        uint64_t begin = profile_ticks();
+        uint64_t ticks = profile_ticks() - begin;
+
+        if (ticks < profile->tickOverhead)
+        {
+            profile->tickOverhead = ticks;
+        }
+    }
+
+    profile->sampleCountdown = PROFILE_SAMPLE_INTERVAL;
+    profile->sampleSeed = 0x2545f491;
+
+    return profile;
+}
+
+void free_cpu_profile(CpuProfile* profile)
+{
+    free(profile);
+}
+
+const char* profile_class_name(ProfileClass profileClass)
+{
+    switch (profileClass)
+    {
+        case PROFILE_CLASS_DATA_TRANSFER:
+            return "data transfer";
+        case PROFILE_CLASS_ARITHMETIC:
+            return "arithmetic";
+        case PROFILE_CLASS_LOGICAL:
+            return "logical";
+        case PROFILE_CLASS_BRANCH:
+            return "branch";
+        case PROFILE_CLASS_CONTROL:
+            return "stack, I/O, control";
+        default:
+            return "unknown";
+    }
+}
+
+// Index of the largest count not taken yet, -1 when only zeros are left
+static long take_largest(const uint64_t* counts, BOOL* taken, long count)
+{
+    long largest = -1;
+
+    for (long i = 0; i < count; i++)
+    {
+        if (!taken[i] && counts[i] != 0 && (largest < 0 || counts[i] > counts[largest]))
+        {
+            largest = i;
+        }
+    }
+
+    if (largest >= 0)
+    {
+        taken[largest] = TRUE;
+    }
+
+    return largest;
+}
+
+static double ticks_per_instruction(const CpuProfile* profile, int profileClass)
+{
+    if (profile->classSamples[profileClass] == 0)
+    {
+        return 0.0;
+    }
+
+    double ticks = (double) profile->classTicks[profileClass] / profile->classSamples[profileClass] - (double) profile->tickOverhead;
+
+    return ticks > 0 ? ticks : 0.0;
+}
+
+static double share(uint64_t part, uint64_t total)
+{
+    return total != 0 ? 100.0 * part / total : 0.0;
+}
+
+void print_cpu_profile(const CpuProfile* profile, FILE* stream)
+{
+    uint64_t classCounts[PROFILE_CLASS_COUNT] = { 0 };
+
+    for (int opCode = 0; opCode < 256; opCode++)
+    {
+        classCounts[profile->opcodeClasses[opCode]] += profile->opcodeCounts[opCode];
+    }
+
+    fprintf(stream, "[PROFILE] %llu instructions, host ticks sampled on about 1 in %d, %llu ticks of timer overhead taken off\n",
+        (unsigned long long) profile->instructions,
+        PROFILE_SAMPLE_INTERVAL,
+        (unsigned long long) profile->tickOverhead);
+
+    for (int i = 0; i < PROFILE_CLASS_COUNT; i++)
+    {
+        fprintf(stream, "[PROFILE] class %-20s %12llu %6.2f%% %8.1f ticks/instruction\n",
+            profile_class_name((ProfileClass) i),
+            (unsigned long long) classCounts[i],
+            share(classCounts[i], profile->instructions),
+            ticks_per_instruction(profile, i));
+    }
+
+    BOOL* taken = (BOOL*) calloc(RAM_MEMORY_SIZE, sizeof(BOOL));
+    if (taken == NULL)
+    {
+        return;
+    }
+
+    for (int rank = 0; rank < PROFILE_REPORT_TOP; rank++)
+    {
+        long opCode = take_largest(profile->opcodeCounts, taken, 256);
+        if (opCode < 0)
+        {
+            break;
+        }
+
+        fprintf(stream, "[PROFILE] opcode %02lX %-8s %12llu %6.2f%%\n",
+            opCode,
+            instruction_names[opCode],
+            (unsigned long long) profile->opcodeCounts[opCode],
+            share(profile->opcodeCounts[opCode], profile->instructions));
+    }
+
+    for (long i = 0; i < 256; i++)
+    {
+        taken[i] = FALSE;
+    }
+
+    for (int rank = 0; rank < PROFILE_REPORT_TOP; rank++)
+    {
+        long address = take_largest(profile->addressHits, taken, RAM_MEMORY_SIZE);
+        if (address < 0)
+        {
+            break;
+        }
+
+        fprintf(stream, "[PROFILE] address %04lX %12llu %6.2f%%\n",
+            address,
+            (unsigned long long) profile->addressHits[address],
+            share(profile->addressHits[address], profile->instructions));
+    }
+
+    free(taken);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../Memory/RAM.h"
+
+// On average one instruction in this many has its host time measured, the rest are only counted.
+// A power of two. The gaps between samples vary, so a loop of the same length is not always sampled at the same opcode
+#define PROFILE_SAMPLE_INTERVAL 16
+
+// Entries of each ranking in the report
+#define PROFILE_REPORT_TOP 16
+
+// Instruction groups of the 8080 manual
+enum ProfileClass
+{
+	PROFILE_CLASS_DATA_TRANSFER,
+	PROFILE_CLASS_ARITHMETIC,
+	PROFILE_CLASS_LOGICAL,
+	PROFILE_CLASS_BRANCH,
+	// Stack, I/O and machine control
+	PROFILE_CLASS_CONTROL,
+
+	PROFILE_CLASS_COUNT
+} typedef ProfileClass;
+
+// Counters of the profiling core, see cpu->profile.
+// Filled by cpu_run_until_halt and cpu_run_cycles while the CPU points to it
+struct CpuProfile
+{
+	uint64_t instructions;
+	uint64_t opcodeCounts[256];
+	// Instructions executed at each guest address
+	uint64_t addressHits[RAM_MEMORY_SIZE];
+
+	// Host ticks (the TSC on x86) of the sampled instructions of each class
+	uint64_t classTicks[PROFILE_CLASS_COUNT];
+	uint64_t classSamples[PROFILE_CLASS_COUNT];
+	// Ticks between two back to back timestamps, taken off every sample in the report
+	uint64_t tickOverhead;
+
+	// ProfileClass of every opcode
+	unsigned char opcodeClasses[256];
+
+	// Instructions left until the next sample, and the xorshift state drawing the gaps
+	uint32_t sampleCountdown;
+	uint32_t sampleSeed;
+} typedef CpuProfile;
+
+// Returns NULL when the counters can not be allocated
+CpuProfile* init_cpu_profile();
+void free_cpu_profile(CpuProfile* profile);
+
+const char* profile_class_name(ProfileClass profileClass);
+
+// Instruction mix, host ticks per instruction class and the hottest opcodes and addresses
+void print_cpu_profile(const CpuProfile* profile, FILE* stream);
+
+// Cheap host timestamp, only differences are meaningful
+static inline uint64_t profile_ticks()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+#endif
+}
+
+// Counts the instruction down to the next sample, TRUE when this one is to be timed
+static inline BOOL profile_take_sample(CpuProfile* profile)
+{
+	if (--profile->sampleCountdown != 0)
+	{
+		return FALSE;
+	}
+
+	uint32_t seed = profile->sampleSeed;
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	profile->sampleSeed = seed;
+
+	// Uniform from 1 to 2 * PROFILE_SAMPLE_INTERVAL - 1
+	profile->sampleCountdown = 1 + seed % (2 * PROFILE_SAMPLE_INTERVAL - 1);
+
+	return TRUE;
+}
+
+static inline void profile_add_sample(CpuProfile* profile, unsigned char opCode, uint64_t ticks)
+{
+	ProfileClass profileClass = (ProfileClass) profile->opcodeClasses[opCode];
+
+	profile->classTicks[profileClass] += ticks;
+	profile->classSamples[profileClass]++;
+}
\ No newline at end of file
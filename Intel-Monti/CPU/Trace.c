@@ -0,0 +1,539 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "Trace.h"
+#include "../Tools/Compression.h"
+#include "../Tools/File.h"
+
+// Raw and stored size of a block, both little-endian 32-bit
+#define TRACE_BLOCK_HEADER_SIZE 8
+
+// CALL, Ccc and RST push the return address
+#define IS_CALL(opCode) \
+    (((opCode) & 0xcf) == 0xcd || ((opCode) & 0xc7) == 0xc4 || ((opCode) & 0xc7) == 0xc7)
+
+static void reset_state(TraceState* state)
+{
+    memset(state->registers, 0, sizeof(state->registers));
+    state->stackPointer = 0;
+    state->cycles = 0;
+    state->nextAddress = -1;
+}
+
+static void write_32(uint8_t* data, uint32_t value)
+{
+    data[0] = (uint8_t) value;
+    data[1] = (uint8_t) (value >> 8);
+    data[2] = (uint8_t) (value >> 16);
+    data[3] = (uint8_t) (value >> 24);
+}
+
+static uint32_t read_32(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+static void write_block(TraceWriter* writer, const uint8_t* data, size_t size)
+{
+    const uint8_t* stored = data;
+    size_t storedSize = size;
+
+    // A block that does not get smaller is stored as it is, the equal sizes tell the reader
+    if (writer->compress)
+    {
+        size_t compressedSize = lz_compress(data, size, writer->compressed, writer->compressedCapacity);
+        if (compressedSize != 0 && compressedSize < size)
+        {
+            stored = writer->compressed;
+            storedSize = compressedSize;
+        }
+    }
+
+    uint8_t header[TRACE_BLOCK_HEADER_SIZE];
+    write_32(header, (uint32_t) size);
+    write_32(header + 4, (uint32_t) storedSize);
+
+    if (fwrite(header, 1, sizeof(header), writer->file) != sizeof(header)
+        || fwrite(stored, 1, storedSize, writer->file) != storedSize)
+    {
+        writer->failed = TRUE;
+    }
+
+    writer->rawBytes += size;
+    writer->storedBytes += sizeof(header) + storedSize;
+}
+
+static int writer_thread_main(void* argument)
+{
+    TraceWriter* writer = (TraceWriter*) argument;
+
+    for (;;)
+    {
+        thread_event_wait(writer->bufferReady);
+
+        if (writer->pendingSize != 0 && !writer->failed)
+        {
+            write_block(writer, writer->pendingBuffer, writer->pendingSize);
+        }
+
+        // Read before the CPU thread may hand over the next buffer
+        BOOL stopping = writer->stopping;
+
+        thread_event_signal(writer->bufferFree);
+
+        if (stopping)
+        {
+            return 0;
+        }
+    }
+}
+
+// Passes the filled buffer to the writer thread and continues in the other one.
+// Only waits when the writer thread is still busy with the previous buffer
+static void hand_off_buffer(TraceWriter* writer, BOOL stopping)
+{
+    thread_event_wait(writer->bufferFree);
+
+    writer->pendingBuffer = writer->buffers[writer->active];
+    writer->pendingSize = writer->used;
+    writer->stopping = stopping;
+
+    thread_event_signal(writer->bufferReady);
+
+    writer->active ^= 1;
+    writer->used = 0;
+    reset_state(&writer->state);
+}
+
+void free_trace_writer(TraceWriter* writer)
+{
+    if (writer->bufferReady != NULL)
+    {
+        free_thread_event(writer->bufferReady);
+    }
+    if (writer->bufferFree != NULL)
+    {
+        free_thread_event(writer->bufferFree);
+    }
+
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+    free(writer->compressed);
+    free(writer);
+}
+
+TraceWriter* open_trace_writer(const char* path, BOOL compress)
+{
+    TraceWriter* writer = (TraceWriter*) calloc(1, sizeof(TraceWriter));
+    if (writer == NULL)
+    {
+        return NULL;
+    }
+
+    writer->compress = compress;
+    writer->compressedCapacity = lz_compress_bound(TRACE_BLOCK_SIZE);
+    writer->buffers[0] = (uint8_t*) malloc(TRACE_BLOCK_SIZE);
+    writer->buffers[1] = (uint8_t*) malloc(TRACE_BLOCK_SIZE);
+    writer->compressed = compress ? (uint8_t*) malloc(writer->compressedCapacity) : NULL;
+    writer->bufferReady = init_thread_event();
+    writer->bufferFree = init_thread_event();
+    reset_state(&writer->state);
+
+    if (writer->buffers[0] == NULL || writer->buffers[1] == NULL || (compress && writer->compressed == NULL)
+        || writer->bufferReady == NULL || writer->bufferFree == NULL)
+    {
+        free_trace_writer(writer);
+        return NULL;
+    }
+
+    writer->file = open_file(path, "wb");
+    if (writer->file == NULL)
+    {
+        free_trace_writer(writer);
+        return NULL;
+    }
+
+    uint8_t header[TRACE_HEADER_SIZE] = { 0 };
+    memcpy(header, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+    header[TRACE_MAGIC_SIZE] = TRACE_VERSION;
+    header[TRACE_MAGIC_SIZE + 1] = compress ? TRACE_FILE_COMPRESSED : 0;
+
+    writer->storedBytes = sizeof(header);
+
+    // Both buffers start out free, the writer thread has nothing yet
+    thread_event_signal(writer->bufferFree);
+
+    if (fwrite(header, 1, sizeof(header), writer->file) != sizeof(header)
+        || (writer->thread = thread_start(writer_thread_main, writer)) == NULL)
+    {
+        fclose(writer->file);
+        free_trace_writer(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+BOOL close_trace_writer(TraceWriter* writer)
+{
+    hand_off_buffer(writer, TRUE);
+    thread_join(writer->thread);
+
+    BOOL written = !writer->failed;
+
+    if (fclose(writer->file) != 0)
+    {
+        written = FALSE;
+    }
+
+    writer->file = NULL;
+
+    return written;
+}
+
+int trace_write_target(const CPU* cpu, unsigned char opCode, uint16_t operand, uint16_t* writeAddress)
+{
+    // MOV M,r (not HLT), INR M, DCR M, MVI M
+    if ((opCode >= 0x70 && opCode <= 0x77 && opCode != 0x76) || (opCode >= 0x34 && opCode <= 0x36))
+    {
+        *writeAddress = cpu->HL;
+        return 1;
+    }
+
+    switch (opCode)
+    {
+        case 0x02:
+            *writeAddress = cpu->BC;
+            return 1;
+        case 0x12:
+            *writeAddress = cpu->DE;
+            return 1;
+        case 0x32:
+            *writeAddress = operand;
+            return 1;
+        case 0x22:
+            *writeAddress = operand;
+            return 2;
+        case 0xe3:
+            // XTHL
+            *writeAddress = cpu->stackPointer.data;
+            return 2;
+    }
+
+    // PUSH, CALL, Ccc, RST
+    if ((opCode & 0xcf) == 0xc5 || IS_CALL(opCode))
+    {
+        *writeAddress = (uint16_t) (cpu->stackPointer.data - 2);
+        return 2;
+    }
+
+    return 0;
+}
+
+static uint8_t* write_varint(uint8_t* output, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *output++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    *output++ = (uint8_t) value;
+    return output;
+}
+
+static void write_record(TraceWriter* writer, CPU* cpu, const RAM* ramGateway, uint16_t address, unsigned char opCode,
+    int writeCount, uint16_t writeAddress, unsigned char recordFlags, uint16_t nextAddress)
+{
+    if (writer->used > TRACE_BLOCK_SIZE - TRACE_MAX_RECORD_SIZE)
+    {
+        hand_off_buffer(writer, FALSE);
+    }
+
+    TraceState* state = &writer->state;
+    uint8_t* record = writer->buffers[writer->active] + writer->used;
+    uint8_t* output = record + 3;
+
+    uint8_t registers[TRACE_REGISTER_COUNT] =
+    {
+        cpu->B, cpu->C, cpu->D, cpu->E, cpu->H, cpu->L, cpu->A, pack_flags(cpu)
+    };
+
+    uint8_t changed = 0;
+
+    for (int i = 0; i < TRACE_REGISTER_COUNT; i++)
+    {
+        if (registers[i] != state->registers[i])
+        {
+            changed |= (uint8_t) (1 << i);
+            state->registers[i] = registers[i];
+            *output++ = registers[i];
+        }
+    }
+
+    if (address != state->nextAddress)
+    {
+        recordFlags |= TRACE_RECORD_ADDRESS;
+        *output++ = (uint8_t) address;
+        *output++ = (uint8_t) (address >> 8);
+    }
+
+    if (cpu->stackPointer.data != state->stackPointer)
+    {
+        recordFlags |= TRACE_RECORD_STACK_POINTER;
+        state->stackPointer = cpu->stackPointer.data;
+        *output++ = (uint8_t) state->stackPointer;
+        *output++ = (uint8_t) (state->stackPointer >> 8);
+    }
+
+    if (writeCount != 0)
+    {
+        recordFlags |= (uint8_t) (writeCount << TRACE_RECORD_WRITE_SHIFT);
+        *output++ = (uint8_t) writeAddress;
+        *output++ = (uint8_t) (writeAddress >> 8);
+
+        // The bytes as they are in memory afterwards, an MMIO page is not read again
+        for (int i = 0; i < writeCount; i++)
+        {
+            *output++ = (uint8_t) ramGateway->memory[(uint16_t) (writeAddress + i)];
+        }
+    }
+
+    if (cpu->cycles - state->cycles != instruction_cycles[opCode])
+    {
+        recordFlags |= TRACE_RECORD_CYCLES;
+        output = write_varint(output, cpu->cycles - state->cycles);
+    }
+
+    state->cycles = cpu->cycles;
+    state->nextAddress = nextAddress;
+
+    record[0] = changed;
+    record[1] = recordFlags;
+    record[2] = opCode;
+
+    writer->used += (size_t) (output - record);
+    writer->records++;
+}
+
+void trace_instruction(TraceWriter* writer, CPU* cpu, const RAM* ramGateway, uint16_t address, unsigned char opCode,
+    int writeCount, uint16_t writeAddress)
+{
+    if (IS_CALL(opCode) && cpu->stackPointer.data != writeAddress)
+    {
+        writeCount = 0;
+    }
+
+    write_record(writer, cpu, ramGateway, address, opCode, writeCount, writeAddress, 0,
+        (uint16_t) (address + instruction_lengths[opCode]));
+}
+
+void trace_interrupt(TraceWriter* writer, CPU* cpu, const RAM* ramGateway, uint16_t interruptedAddress)
+{
+    uint16_t vector = cpu->programCounter.data;
+
+    write_record(writer, cpu, ramGateway, interruptedAddress, (unsigned char) (0xc7 | vector), 2, cpu->stackPointer.data,
+        TRACE_RECORD_INTERRUPT, vector);
+}
+
+TraceReader* open_trace_reader(const char* path)
+{
+    TraceReader* reader = (TraceReader*) calloc(1, sizeof(TraceReader));
+    if (reader == NULL)
+    {
+        return NULL;
+    }
+
+    reader->block = (uint8_t*) malloc(TRACE_BLOCK_SIZE);
+    reader->stored = (uint8_t*) malloc(lz_compress_bound(TRACE_BLOCK_SIZE));
+    reader->file = open_file(path, "rb");
+
+    uint8_t header[TRACE_HEADER_SIZE];
+
+    if (reader->block == NULL || reader->stored == NULL || reader->file == NULL
+        || fread(header, 1, sizeof(header), reader->file) != sizeof(header)
+        || memcmp(header, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0 || header[TRACE_MAGIC_SIZE] != TRACE_VERSION)
+    {
+        close_trace_reader(reader);
+        return NULL;
+    }
+
+    reset_state(&reader->state);
+
+    return reader;
+}
+
+void close_trace_reader(TraceReader* reader)
+{
+    if (reader->file != NULL)
+    {
+        fclose(reader->file);
+    }
+
+    free(reader->block);
+    free(reader->stored);
+    free(reader);
+}
+
+// Returns FALSE at the end of the file or on a damaged block
+static BOOL read_block(TraceReader* reader)
+{
+    uint8_t header[TRACE_BLOCK_HEADER_SIZE];
+
+    size_t headerSize = fread(header, 1, sizeof(header), reader->file);
+    if (headerSize != sizeof(header))
+    {
+        reader->damaged = headerSize != 0;
+        return FALSE;
+    }
+
+    size_t size = read_32(header);
+    size_t storedSize = read_32(header + 4);
+
+    if (size > TRACE_BLOCK_SIZE || storedSize > size)
+    {
+        reader->damaged = TRUE;
+        return FALSE;
+    }
+
+    uint8_t* target = storedSize == size ? reader->block : reader->stored;
+
+    if (fread(target, 1, storedSize, reader->file) != storedSize
+        || (storedSize != size && !lz_decompress(reader->stored, storedSize, reader->block, size)))
+    {
+        reader->damaged = TRUE;
+        return FALSE;
+    }
+
+    reader->size = size;
+    reader->position = 0;
+    reset_state(&reader->state);
+
+    return TRUE;
+}
+
+static BOOL read_varint(TraceReader* reader, uint64_t* value)
+{
+    *value = 0;
+
+    for (int shift = 0; shift < 64 && reader->position < reader->size; shift += 7)
+    {
+        uint8_t part = reader->block[reader->position++];
+        *value |= (uint64_t) (part & 0x7f) << shift;
+
+        if ((part & 0x80) == 0)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static BOOL decode_record(TraceReader* reader, TraceRecord* record)
+{
+    TraceState* state = &reader->state;
+    const uint8_t* data = reader->block;
+
+    if (reader->size - reader->position < 3)
+    {
+        return FALSE;
+    }
+
+    uint8_t changed = data[reader->position];
+    uint8_t recordFlags = data[reader->position + 1];
+    int writeCount = (recordFlags & TRACE_RECORD_WRITE_MASK) >> TRACE_RECORD_WRITE_SHIFT;
+
+    record->opCode = data[reader->position + 2];
+    record->interrupt = (recordFlags & TRACE_RECORD_INTERRUPT) != 0;
+    reader->position += 3;
+
+    // Every fixed size field the flags announce
+    size_t fixedSize = 0;
+    for (int i = 0; i < TRACE_REGISTER_COUNT; i++)
+    {
+        fixedSize += (changed >> i) & 1;
+    }
+    fixedSize += recordFlags & TRACE_RECORD_ADDRESS ? 2 : 0;
+    fixedSize += recordFlags & TRACE_RECORD_STACK_POINTER ? 2 : 0;
+    fixedSize += writeCount != 0 ? 2 + (size_t) writeCount : 0;
+
+    if (writeCount > 2 || reader->size - reader->position < fixedSize)
+    {
+        return FALSE;
+    }
+
+    for (int i = 0; i < TRACE_REGISTER_COUNT; i++)
+    {
+        if (changed & (1 << i))
+        {
+            state->registers[i] = data[reader->position++];
+        }
+    }
+
+    if (recordFlags & TRACE_RECORD_ADDRESS)
+    {
+        record->address = (uint16_t) (data[reader->position] | (data[reader->position + 1] << 8));
+        reader->position += 2;
+    }
+    else if (state->nextAddress >= 0)
+    {
+        record->address = (uint16_t) state->nextAddress;
+    }
+    else
+    {
+        // The first record of a block always carries its address
+        return FALSE;
+    }
+
+    if (recordFlags & TRACE_RECORD_STACK_POINTER)
+    {
+        state->stackPointer = (uint16_t) (data[reader->position] | (data[reader->position + 1] << 8));
+        reader->position += 2;
+    }
+
+    record->writeCount = writeCount;
+    if (writeCount != 0)
+    {
+        record->writeAddress = (uint16_t) (data[reader->position] | (data[reader->position + 1] << 8));
+        memcpy(record->writeValues, data + reader->position + 2, (size_t) writeCount);
+        reader->position += 2 + (size_t) writeCount;
+    }
+
+    uint64_t cycles = instruction_cycles[record->opCode];
+    if ((recordFlags & TRACE_RECORD_CYCLES) && !read_varint(reader, &cycles))
+    {
+        return FALSE;
+    }
+
+    state->cycles += cycles;
+    state->nextAddress = record->interrupt ? (record->opCode & 0x38) : (uint16_t) (record->address + instruction_lengths[record->opCode]);
+
+    memcpy(record->registers, state->registers, sizeof(record->registers));
+    record->stackPointer = state->stackPointer;
+    record->cycles = state->cycles;
+    record->index = reader->index++;
+
+    return TRUE;
+}
+
+BOOL trace_next(TraceReader* reader, TraceRecord* record)
+{
+    if (reader->damaged)
+    {
+        return FALSE;
+    }
+
+    if (reader->position == reader->size && !read_block(reader))
+    {
+        return FALSE;
+    }
+
+    if (!decode_record(reader, record))
+    {
+        reader->damaged = TRUE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
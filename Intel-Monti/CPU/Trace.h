@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "../Tools/Thread.h"
+
+// Encoded bytes per block. Each block starts from a blank state, so it decodes on its own
+#define TRACE_BLOCK_SIZE (1024 * 1024)
+// Upper bound of one encoded record, a block is handed off before it could overflow
+#define TRACE_MAX_RECORD_SIZE 32
+
+#define TRACE_MAGIC "MONTITRC"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_VERSION 1
+// Magic, version, flags and two reserved bytes
+#define TRACE_HEADER_SIZE 12
+// Header flag: the blocks may be compressed, see Compression.h
+#define TRACE_FILE_COMPRESSED 0x01
+
+// Record layout: a mask of the changed registers (B C D E H L A F from bit 0 up), a flag byte, the opcode,
+// the new values of the changed registers, then the fields the flags announce in this order
+// Instruction address, when it is not the one following the previous record
+#define TRACE_RECORD_ADDRESS 0x01
+// New SP
+#define TRACE_RECORD_STACK_POINTER 0x02
+// Bytes written (0 to 2): their first address and the values
+#define TRACE_RECORD_WRITE_SHIFT 2
+#define TRACE_RECORD_WRITE_MASK 0x0c
+// T-states since the previous record as a varint, when they differ from the opcode map
+#define TRACE_RECORD_CYCLES 0x10
+// An accepted interrupt instead of an instruction. The address is the interrupted one, the opcode the RST it ran
+#define TRACE_RECORD_INTERRUPT 0x20
+
+// Registers of the trace state, in the bit order of the record mask
+#define TRACE_REGISTER_COUNT 8
+
+// What the previous record left behind, the base of the deltas
+struct TraceState
+{
+	uint8_t registers[TRACE_REGISTER_COUNT];
+	uint16_t stackPointer;
+	uint64_t cycles;
+	// Address the next record starts at unless it says otherwise, -1 at the start of a block
+	int32_t nextAddress;
+} typedef TraceState;
+
+// One decoded record with the full state after it
+struct TraceRecord
+{
+	uint64_t index;
+	uint64_t cycles;
+
+	uint16_t address;
+	uint8_t opCode;
+	BOOL interrupt;
+
+	// B C D E H L A F
+	uint8_t registers[TRACE_REGISTER_COUNT];
+	uint16_t stackPointer;
+
+	int writeCount;
+	uint16_t writeAddress;
+	uint8_t writeValues[2];
+} typedef TraceRecord;
+
+// Writes per-instruction records of the profiling core, see cpu->trace.
+// The CPU thread encodes into one buffer while a writer thread compresses and writes the other
+struct TraceWriter
+{
+	FILE* file;
+	BOOL compress;
+
+	uint8_t* buffers[2];
+	int active;
+	size_t used;
+	TraceState state;
+
+	// Buffer handoff, bufferFree is signalled when the writer thread can take the next one
+	Thread* thread;
+	ThreadEvent* bufferReady;
+	ThreadEvent* bufferFree;
+	uint8_t* pendingBuffer;
+	size_t pendingSize;
+	BOOL stopping;
+
+	// Owned by the writer thread
+	uint8_t* compressed;
+	size_t compressedCapacity;
+	BOOL failed;
+
+	uint64_t records;
+	uint64_t rawBytes;
+	// Block headers included
+	uint64_t storedBytes;
+} typedef TraceWriter;
+
+// Returns NULL when the file, the buffers or the writer thread can not be created
+TraceWriter* open_trace_writer(const char* path, BOOL compress);
+
+// Writes the last block, stops the writer thread and closes the file. The statistics stay readable until free_trace_writer.
+// Returns FALSE when any write failed
+BOOL close_trace_writer(TraceWriter* writer);
+void free_trace_writer(TraceWriter* writer);
+
+// Bytes the instruction is about to write, decided from the state before it runs.
+// Calls and pushes are assumed to write, trace_instruction drops the writes of a conditional call not taken
+int trace_write_target(const CPU* cpu, unsigned char opCode, uint16_t operand, uint16_t* writeAddress);
+
+// Records the instruction at address after its handler ran
+void trace_instruction(TraceWriter* writer, CPU* cpu, const RAM* ramGateway, uint16_t address, unsigned char opCode,
+	int writeCount, uint16_t writeAddress);
+
+// Records an interrupt the core accepted, cpu is already at the vector. Called for every accepted one,
+// also when the vector is the interrupted address
+void trace_interrupt(TraceWriter* writer, CPU* cpu, const RAM* ramGateway, uint16_t interruptedAddress);
+
+struct TraceReader
+{
+	FILE* file;
+
+	uint8_t* block;
+	uint8_t* stored;
+	size_t size;
+	size_t position;
+
+	TraceState state;
+	uint64_t index;
+
+	// Set when the file ends inside a block or a block does not decode
+	BOOL damaged;
+} typedef TraceReader;
+
+// Returns NULL when the file can not be opened or is no trace
+TraceReader* open_trace_reader(const char* path);
+void close_trace_reader(TraceReader* reader);
+
+// Returns FALSE at the end of the trace, reader->damaged tells a damaged one apart
+BOOL trace_next(TraceReader* reader, TraceRecord* record);
\ No newline at end of file
@@ -1,1116 +1,1528 @@
+#include <string.h>
+
 #include "cpu.h"
+#include "BlockCache.h"
+#include "Jit.h"
+#include "Flags.h"
+#include "Profiler.h"
+#include "CallProfiler.h"
+#include "Trace.h"
+#include "../IO/InputLog.h"
+#include "../Tools/Thread.h"
 
 CPU init_cpu()
 {
     CPU cpu;
 
-    cpu.A_Register.data = 0;
-    cpu.B_Register.data = 0;
-    cpu.C_Register.data = 0;
-    cpu.D_Register.data = 0;
-    cpu.E_Register.data = 0;
-    cpu.H_Register.data = 0;
-    cpu.L_Register.data = 0;
+    cpu.BC = 0;
+    cpu.DE = 0;
+    cpu.HL = 0;
+    // Bit 1 of the flags always reads as 1
+    cpu.PSW = FLAG_RESERVED;
 
     cpu.programCounter.data = 0;
     cpu.stackPointer.data = 0;
 
+#if CPU_LAZY_FLAGS
+    cpu.lazyResult = 0;
+    cpu.lazyAuxiliary = 0;
+    cpu.flagsPending = FALSE;
+#endif
+
+    cpu.interruptsEnabled = FALSE;
+    cpu.interruptEnableCycle = UINT64_MAX;
+    cpu.interruptRequest = 0;
+    cpu.halted = FALSE;
+
+    cpu.cycles = 0;
+    cpu.core = CPU_CORE_SWITCH;
+
+    cpu.blockCache = NULL;
+    cpu.jit = NULL;
+
+    cpu.bus = &standart_io_bus;
+    cpu.profile = NULL;
+    cpu.callProfile = NULL;
+    cpu.trace = NULL;
+    cpu.inputLog = NULL;
+
     return cpu;
 }
 
-void execute_cpu(CPU cpu, RAM* ramGateway)
+// Register access helpers.
+// A pair and its two registers share storage, so a pair is read or written with a single 16-bit access
+#define REGISTER(name) cpu->name
+#define REGISTER_PAIR(high, low) cpu->high##low
+
+static inline unsigned char read_byte(RAM* ramGateway, uint16_t address)
+{
+    return (unsigned char) read_memory_ram(ramGateway, address);
+}
+
+static inline void write_byte(RAM* ramGateway, uint16_t address, unsigned char value)
+{
+    write_memory_ram(ramGateway, address, (char) value);
+}
+
+// 16-bit values are stored little-endian: low byte first
+static inline uint16_t read_word(RAM* ramGateway, uint16_t address)
+{
+    return (uint16_t) (read_byte(ramGateway, address) | (read_byte(ramGateway, (uint16_t) (address + 1)) << 8));
+}
+
+static inline void write_word(RAM* ramGateway, uint16_t address, uint16_t value)
+{
+    write_byte(ramGateway, address, (unsigned char) value);
+    write_byte(ramGateway, (uint16_t) (address + 1), (unsigned char) (value >> 8));
+}
+
+static inline void push_word(CPU* cpu, RAM* ramGateway, uint16_t value)
+{
+    cpu->stackPointer.data -= 2;
+    write_word(ramGateway, cpu->stackPointer.data, value);
+}
+
+static inline uint16_t pop_word(CPU* cpu, RAM* ramGateway)
+{
+    uint16_t value = read_word(ramGateway, cpu->stackPointer.data);
+    cpu->stackPointer.data += 2;
+
+    return value;
+}
+
+// Flag helpers.
+// Sign, zero and parity come from one table lookup, the carries from bit arithmetic, none of them branch
+
+// Zero, sign, parity and auxiliary carry of a result, together with the carry bit, as one flag byte.
+// The auxiliary carry is bit 4 of auxiliary ^ result, for additions auxiliary is the XOR of both operands
+static inline unsigned char result_flags(unsigned char result, unsigned char auxiliary, unsigned char carry)
+{
+    return (unsigned char) (zero_sign_parity_flags[result] | ((auxiliary ^ result) & FLAG_AUXILIARY_CARRY) | FLAG_RESERVED | carry);
+}
+
+// In lazy mode only the result and the auxiliary byte are recorded, materialize_flags computes the flags when they are read.
+// The carry is always stored right away
+static inline void set_result_flags(CPU* cpu, unsigned char result, unsigned char auxiliary, unsigned char carry)
 {
-    while (1)
+#if CPU_LAZY_FLAGS
+    cpu->lazyResult = result;
+    cpu->lazyAuxiliary = auxiliary;
+    cpu->flagsPending = TRUE;
+    cpu->flags = (unsigned char) ((cpu->flags & ~FLAG_CARRY) | carry);
+#else
+    cpu->flags = result_flags(result, auxiliary, carry);
+#endif
+}
+
+// Brings zero, sign, parity and auxiliary carry in the flag byte up to date
+static inline void materialize_flags(CPU* cpu)
+{
+#if CPU_LAZY_FLAGS
+    if (cpu->flagsPending)
     {
-        unsigned char opCode = read_memory_ram(ramGateway, cpu.programCounter.data);
-        
-        switch (opCode)
-        {
-            // NOP
-            case 0x00:
-                break;
-            // LXI B, D16
-            case 0x01:
-                cpu.programCounter.data++;
-                cpu.B_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-                
-                cpu.programCounter.data++;
-                cpu.C_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-                break;
-            // STAX B
-            // After executing the STAX B instruction.
-            // The content of register A is written to the memory at an address formed by the contents of registers B and C.
-            case 0x02:
-            {
-                uint16_t targetAddress = (uint16_t) (cpu.B_Register.data << 8) | cpu.C_Register.data;
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.A_Register.data);
-                break;
-            }
-            // INX B
-            // Incrementing the value of the BC register pair.
-            case 0x03:
-            {
-                uint16_t BC = (uint16_t) (cpu.B_Register.data << 8) | cpu.C_Register.data;
+        cpu->flags = result_flags(cpu->lazyResult, cpu->lazyAuxiliary, cpu->flags & FLAG_CARRY);
+        cpu->flagsPending = FALSE;
+    }
+#else
+    (void) cpu;
+#endif
+}
 
-                BC++;
-                cpu.B_Register.data = (BC >> 8) & 0xFF;
-                cpu.C_Register.data = BC & 0xFF;
+static inline unsigned char read_carry(CPU* cpu)
+{
+    return cpu->flags & FLAG_CARRY;
+}
 
-                break;
-            }
-            // INR B
-            case 0x04:
-                cpu.B_Register.data++;
-                
-                cpu.flagRegister.zeroFlag = (cpu.B_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.B_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.B_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.B_Register.data);
-
-                break;
-            // DCR B
-            case 0x05:
-                cpu.B_Register.data--;
-
-                cpu.flagRegister.zeroFlag = (cpu.B_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.B_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.B_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.B_Register.data);
-
-                break;
-            // MVI B, D8
-            case 0x06:
-                cpu.programCounter.data++;
-                cpu.B_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-
-                break;
-            // RLC
-            // Thus, the RLC instruction performs a circular shift of bits to the left and stores the most significant bit in the carry flag 
-            case 0x07:
-            {
-                cpu.flagRegister.carryFlag = (cpu.A_Register.data >> 7) & 1;
-                cpu.A_Register.data = cpu.A_Register.data << 1;
+static inline void write_carry(CPU* cpu, unsigned char carry)
+{
+    cpu->flags = (unsigned char) ((cpu->flags & ~FLAG_CARRY) | carry);
+}
 
-                break;
-            }
-            // DAD B
-            // DAD B instruction adds the contents of registers HL and BC, and the result is stored in register HL.
-            // The carry flag (CY) is set if there is a carry from the most significant bit (high-order tetrad) during the addition operation
-            // HL = HL + BC
-            case 0x09:
-            {
-                uint16_t HL = (uint16_t) cpu.H_Register.data << 8 | cpu.L_Register.data;
-                uint16_t BC = (uint16_t) cpu.B_Register.data << 8 | cpu.C_Register.data;
+// Processor Status Word layout: S Z 0 AC 0 P 1 CY
+unsigned char pack_flags(CPU* cpu)
+{
+    materialize_flags(cpu);
 
-                short result = HL + BC;
-                cpu.flagRegister.carryFlag = (result >> 16) & 0x01;
+    return cpu->flags;
+}
 
-                cpu.H_Register.data = (unsigned char) (result >> 8);
-                cpu.L_Register.data = (unsigned char) result;
+// Bits 3 and 5 always read as 0, bit 1 as 1
+void unpack_flags(CPU* cpu, unsigned char flags)
+{
+    cpu->flags = (unsigned char) ((flags & (FLAG_SIGN | FLAG_ZERO | FLAG_AUXILIARY_CARRY | FLAG_PARITY | FLAG_CARRY)) | FLAG_RESERVED);
+#if CPU_LAZY_FLAGS
+    cpu->flagsPending = FALSE;
+#endif
+}
 
-                break;
-            }
-            // LDAX B
-            // After the execution of this command, 
-            // the value stored in the memory location whose address is formed by the contents of registers B and C will be loaded into the accumulator register A.
-            case 0x0a:
-            {
-                uint16_t targetAddress = (cpu.B_Register.data << 8) | cpu.C_Register.data;
-                cpu.A_Register.data = read_memory_ram(ramGateway, targetAddress - 1);
-            
-                break;
-            }
-            // DCX B
-            // Decrement Double Register
-            case 0x0b:
-            {
-                uint16_t BC = (cpu.B_Register.data << 8) | cpu.C_Register.data;
-                BC--;
+// Arithmetic and logic unit.
+// Every operation takes the accumulator and the second operand, stores the result in A and updates the flags
 
-                cpu.B_Register.data = (BC >> 8) & 0xFF;
-                cpu.C_Register.data = BC & 0xFF;
+static inline unsigned char add_bytes(CPU* cpu, unsigned char first, unsigned char second, unsigned char carry)
+{
+    uint16_t result = first + second + carry;
 
-                break;
-            }
-            // INR C
-            case 0x0c:
-                cpu.C_Register.data++;
-
-                cpu.flagRegister.zeroFlag = (cpu.C_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.C_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.C_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.C_Register.data);
-
-                break;
-            // DCR C
-            case 0x0d:
-                cpu.C_Register.data--;
-
-                cpu.flagRegister.zeroFlag = (cpu.C_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.C_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.C_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.C_Register.data);
-
-                break;
-            // MVC C, D8
-            case 0x0e:
-                cpu.programCounter.data++;
-                cpu.C_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-
-                break;
-            // RRC
-            case 0x0f:
-                cpu.flagRegister.carryFlag = (cpu.A_Register.data >> 7) & 1;
-                cpu.A_Register.data = cpu.A_Register.data >> 1;
-
-                break;
-            // LXI D, D16
-            case 0x11:
-                cpu.programCounter.data++;
-                cpu.D_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-
-                cpu.programCounter.data++;
-                cpu.E_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-
-                break;
-            // STAX D
-            case 0x12:
-            {
-                uint16_t targetAddress = (uint16_t) (cpu.D_Register.data << 8) | cpu.E_Register.data;
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.A_Register.data);
-                break;
-            }
-            // INX D
-            case 0x13:
-            {
-                uint16_t DE = (uint16_t) (cpu.D_Register.data << 8) | cpu.E_Register.data;
-                DE++;
+    // Bit 4 of the operands and the result differs exactly when a carry came out of bit 3
+    set_result_flags(cpu, (unsigned char) result, first ^ second, (result >> 8) & 1);
 
-                cpu.D_Register.data = (DE >> 8) & 0xFF;
-                cpu.E_Register.data = DE & 0xFF;
+    return (unsigned char) result;
+}
 
-                break;
-            }
-            // INR D
-            case 0x14:
-            {
-                cpu.D_Register.data++;
+// The 8080 subtracts by adding the one's complement of the operand with the inverted borrow.
+// The carry flag then holds the borrow, the auxiliary carry is the carry out of bit 3 of that addition
+static inline unsigned char subtract_bytes(CPU* cpu, unsigned char first, unsigned char second, unsigned char borrow)
+{
+    unsigned char result = add_bytes(cpu, first, (unsigned char) ~second, !borrow);
+    cpu->flags ^= FLAG_CARRY;
 
-                cpu.flagRegister.zeroFlag = (cpu.D_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.D_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.D_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.D_Register.data);
+    return result;
+}
 
-                break;
-            }
-            // DCR D
-            case 0x15:
-            {
-                cpu.D_Register.data--;
+static inline void alu_add(CPU* cpu, unsigned char value)
+{
+    REGISTER(A) = add_bytes(cpu, REGISTER(A), value, 0);
+}
 
-                cpu.flagRegister.zeroFlag = (cpu.D_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.D_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.D_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.D_Register.data);
+static inline void alu_adc(CPU* cpu, unsigned char value)
+{
+    REGISTER(A) = add_bytes(cpu, REGISTER(A), value, read_carry(cpu));
+}
 
-                break;
-            }
-            // 0x16 MVI D, D8
-            // Move Immediate to Register D
-            case 0x16:
-                cpu.programCounter.data++;
-                cpu.D_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-
-                break;
-            // 0x17 RAL
-            // Rotate Accumulator Left through Carry
-            case 0x17:
-            {
-                unsigned char prevarry = cpu.flagRegister.carryFlag;
+static inline void alu_sub(CPU* cpu, unsigned char value)
+{
+    REGISTER(A) = subtract_bytes(cpu, REGISTER(A), value, 0);
+}
 
-                cpu.flagRegister.carryFlag = (cpu.A_Register.data >> 7) & 1;
-                cpu.A_Register.data = (cpu.A_Register.data << 1) | prevarry;
+static inline void alu_sbb(CPU* cpu, unsigned char value)
+{
+    REGISTER(A) = subtract_bytes(cpu, REGISTER(A), value, read_carry(cpu));
+}
 
-                break;
-            }
-            // 0x19 DAD D
-            // Double Add Register DE to HL
-            case 0x19:
-            {
-                uint16_t HL = (uint16_t) cpu.H_Register.data << 8 | cpu.L_Register.data;
-                uint16_t DE = (uint16_t) cpu.D_Register.data << 8 | cpu.E_Register.data;
+// ANA sets the auxiliary carry to the OR of bit 3 of both operands
+static inline void alu_ana(CPU* cpu, unsigned char value)
+{
+    unsigned char accumulator = REGISTER(A);
+    unsigned char result = accumulator & value;
 
-                uint16_t result = HL + DE;
-                cpu.flagRegister.carryFlag = (result >> 16) & 0x01;
+    // Moves bit 3 of the OR to bit 4 and cancels the result bit so that set_result_flags extracts it
+    set_result_flags(cpu, result, result ^ (((accumulator | value) << 1) & 0x10), 0);
 
-                cpu.H_Register.data = (unsigned char) (result >> 8);
-                cpu.L_Register.data = (unsigned char) result;
+    REGISTER(A) = result;
+}
 
-                break;
-            }
-            // 0x1a LDAX D
-            // Load Accumulator from Memory through Register DE
-            case 0x1a:
-            {
-                uint16_t targetAddress = (uint16_t) (cpu.D_Register.data << 8) | cpu.E_Register.data;
-                cpu.A_Register.data = read_memory_ram(ramGateway, targetAddress - 1);
+static inline void alu_xra(CPU* cpu, unsigned char value)
+{
+    unsigned char result = REGISTER(A) ^ value;
 
-                break;
-            }
-            // 0x1b DCX D
-            // Decrement Double Register DE
-            case 0x1b:
-            {
-                uint16_t DE = (cpu.D_Register.data << 8) | cpu.E_Register.data;
-                DE--;
+    set_result_flags(cpu, result, result, 0);
 
-                cpu.D_Register.data = (DE >> 8) & 0xFF;
-                cpu.E_Register.data = DE & 0xFF;
+    REGISTER(A) = result;
+}
 
-                break;
-            }
-            // INR E
-            case 0x1c:
-                cpu.E_Register.data++;
+static inline void alu_ora(CPU* cpu, unsigned char value)
+{
+    unsigned char result = REGISTER(A) | value;
 
-                cpu.flagRegister.zeroFlag = (cpu.E_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.E_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.E_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.E_Register.data);
+    set_result_flags(cpu, result, result, 0);
 
-                break;
+    REGISTER(A) = result;
+}
 
-            // DCR E
-            case 0x1d:
-                cpu.E_Register.data--;
+// CMP is a SUB that only keeps the flags
+static inline void alu_cmp(CPU* cpu, unsigned char value)
+{
+    subtract_bytes(cpu, REGISTER(A), value, 0);
+}
 
-                cpu.flagRegister.zeroFlag = (cpu.E_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.E_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.E_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.E_Register.data);
+// INR and DCR leave the carry flag untouched
+static inline unsigned char increment_byte(CPU* cpu, unsigned char value)
+{
+    unsigned char result = value + 1;
 
-                break;
+    set_result_flags(cpu, result, value ^ 0x01, read_carry(cpu));
 
-            // MVI E, D8
-            // Move immediate data (D8) to register E
-            case 0x1e:
-                cpu.programCounter.data++;
-                cpu.E_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
+    return result;
+}
 
-                break;
+static inline unsigned char decrement_byte(CPU* cpu, unsigned char value)
+{
+    unsigned char result = value - 1;
 
-            // RAR
-            // Rotate A right through carry
-            case 0x1f:
-            {
-                unsigned char prevarry = cpu.flagRegister.carryFlag;
+    // Decrementing adds 0xFF
+    set_result_flags(cpu, result, value ^ 0xFF, read_carry(cpu));
 
-                cpu.flagRegister.carryFlag = cpu.A_Register.data & 1;
-                cpu.A_Register.data >>= 1;
-                cpu.A_Register.data |= (prevarry << 7);
+    return result;
+}
 
-                break;
-            }
-            // LXI H, D16
-            // Load register pair HL with immediate data (D16)
-            case 0x21:
-                cpu.programCounter.data++;
-                cpu.L_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-
-                cpu.programCounter.data++;
-                cpu.H_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-
-                break;
-            // SHLD adr
-            // Store H and L registers direct to memory address specified by D16
-            case 0x22:
-            {
-                cpu.programCounter.data++;
-                short high = read_memory_ram(ramGateway, cpu.programCounter.data);
+// Instruction handlers
 
-                cpu.programCounter.data++;
-                short low = read_memory_ram(ramGateway, cpu.programCounter.data);
+#define INSTRUCTION(name) static void name(CPU* cpu, RAM* ramGateway, uint16_t operand)
 
-                uint16_t targetAddress = (high << 8) | low;
+// NOP
+INSTRUCTION(op_nop)
+{
+}
 
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.H_Register.data);
-                write_memory_ram(ramGateway, targetAddress, cpu.L_Register.data);
+// HLT
+// Halt mode, the processor stops until an interrupt arrives
+INSTRUCTION(op_hlt)
+{
+    cpu->halted = TRUE;
+}
 
-                break;
-            }
-            // INX H
-            case 0x23:
-            {
-                uint16_t HL = (uint16_t) cpu.H_Register.data << 8 | cpu.L_Register.data;
-                HL++;
+// INR r, DCR r, MVI r, D8
+#define DEFINE_REGISTER_INSTRUCTIONS(suffix, name) \
+    INSTRUCTION(op_inr_##suffix) { REGISTER(name) = increment_byte(cpu, REGISTER(name)); } \
+    INSTRUCTION(op_dcr_##suffix) { REGISTER(name) = decrement_byte(cpu, REGISTER(name)); } \
+    INSTRUCTION(op_mvi_##suffix) { REGISTER(name) = (unsigned char) operand; }
+
+DEFINE_REGISTER_INSTRUCTIONS(b, B)
+DEFINE_REGISTER_INSTRUCTIONS(c, C)
+DEFINE_REGISTER_INSTRUCTIONS(d, D)
+DEFINE_REGISTER_INSTRUCTIONS(e, E)
+DEFINE_REGISTER_INSTRUCTIONS(h, H)
+DEFINE_REGISTER_INSTRUCTIONS(l, L)
+DEFINE_REGISTER_INSTRUCTIONS(a, A)
+
+// INR M
+// Increment the content of the memory cell whose address is specified by registers HL by 1
+INSTRUCTION(op_inr_m)
+{
+    uint16_t targetAddress = REGISTER_PAIR(H, L);
+    write_byte(ramGateway, targetAddress, increment_byte(cpu, read_byte(ramGateway, targetAddress)));
+}
 
-                cpu.H_Register.data = (HL >> 8) & 0xFF;
-                cpu.L_Register.data = HL & 0xFF;
-            }
-            // INR H
-            case 0x24:
-            {
-                cpu.H_Register.data++;
+// DCR M
+INSTRUCTION(op_dcr_m)
+{
+    uint16_t targetAddress = REGISTER_PAIR(H, L);
+    write_byte(ramGateway, targetAddress, decrement_byte(cpu, read_byte(ramGateway, targetAddress)));
+}
 
-                // Update flags
-                cpu.flagRegister.zeroFlag = (cpu.H_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.H_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.H_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.H_Register.data);
+// MVI M, D8
+INSTRUCTION(op_mvi_m)
+{
+    write_byte(ramGateway, REGISTER_PAIR(H, L), (unsigned char) operand);
+}
 
-                break;
-            }
-            // DCR H
-            case 0x25:
-            {
-                cpu.H_Register.data--;
+// LXI rp, D16; INX rp; DCX rp; DAD rp; PUSH rp; POP rp
+// The high register of the pair is the first one (B of BC)
+#define DEFINE_REGISTER_PAIR_INSTRUCTIONS(suffix, high, low) \
+    INSTRUCTION(op_lxi_##suffix) { REGISTER_PAIR(high, low) = operand; } \
+    INSTRUCTION(op_inx_##suffix) { REGISTER_PAIR(high, low) = (uint16_t) (REGISTER_PAIR(high, low) + 1); } \
+    INSTRUCTION(op_dcx_##suffix) { REGISTER_PAIR(high, low) = (uint16_t) (REGISTER_PAIR(high, low) - 1); } \
+    INSTRUCTION(op_dad_##suffix) \
+    { \
+        uint32_t result = (uint32_t) REGISTER_PAIR(H, L) + REGISTER_PAIR(high, low); \
+        write_carry(cpu, (result >> 16) & 1); \
+        REGISTER_PAIR(H, L) = (uint16_t) result; \
+    } \
+    INSTRUCTION(op_push_##suffix) { push_word(cpu, ramGateway, REGISTER_PAIR(high, low)); } \
+    INSTRUCTION(op_pop_##suffix) { REGISTER_PAIR(high, low) = pop_word(cpu, ramGateway); }
+
+DEFINE_REGISTER_PAIR_INSTRUCTIONS(b, B, C)
+DEFINE_REGISTER_PAIR_INSTRUCTIONS(d, D, E)
+DEFINE_REGISTER_PAIR_INSTRUCTIONS(h, H, L)
+
+// LXI SP, D16
+INSTRUCTION(op_lxi_sp)
+{
+    cpu->stackPointer.data = operand;
+}
 
-                cpu.flagRegister.zeroFlag = (cpu.H_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.H_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.H_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.H_Register.data);
+// INX SP
+INSTRUCTION(op_inx_sp)
+{
+    cpu->stackPointer.data++;
+}
 
-                break;
-            }
-            // MVI H, D8
-            case 0x26:
-                cpu.programCounter.data++;
-                cpu.H_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-
-                break;
-            // DAA
-            // Decimal Adjust Accumulator
-            case 0x27:
-            {
-                char lowerNibble = cpu.A_Register.data & 0x0F;
-                char higherNibble = (cpu.A_Register.data >> 4) & 0x0F;
+// DCX SP
+INSTRUCTION(op_dcx_sp)
+{
+    cpu->stackPointer.data--;
+}
 
-                if (lowerNibble > 9 || cpu.flagRegister.auxiliaryCarry)
-                {
-                    cpu.A_Register.data += 6;
-                    cpu.flagRegister.auxiliaryCarry = (lowerNibble + 6) & 0x10;
-                }
+// DAD SP
+INSTRUCTION(op_dad_sp)
+{
+    uint32_t result = (uint32_t) REGISTER_PAIR(H, L) + cpu->stackPointer.data;
+    write_carry(cpu, (result >> 16) & 1);
 
-                if (higherNibble > 9 || cpu.flagRegister.carryFlag)
-                {
-                    uint16_t sum = cpu.A_Register.data + 0x60;
-                    cpu.A_Register.data = sum & 0xFF;
+    REGISTER_PAIR(H, L) = (uint16_t) result;
+}
 
-                    cpu.flagRegister.carryFlag = sum & 0x100;
-                }
+// PUSH PSW
+// The accumulator is the high byte, the flags are the low byte, which is also the layout of the PSW pair
+INSTRUCTION(op_push_psw)
+{
+    materialize_flags(cpu);
+    push_word(cpu, ramGateway, cpu->PSW);
+}
 
-                cpu.flagRegister.zeroFlag = (cpu.A_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.A_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.A_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.A_Register.data);
+// POP PSW
+INSTRUCTION(op_pop_psw)
+{
+    uint16_t value = pop_word(cpu, ramGateway);
 
-                break;
-            }
-            // DAD H
-            // Wrong - in the documenation http://www.emulator101.com/reference/8080-by-opcode.html
-            // HL = HL + HI
-            // I REGISTER??? WHAT THE FUCK?
-            // Maybe this command try to HL = HL + HL?
-            // I don't know!
-            case 0x29:
-            {
-                uint16_t HL = (uint16_t) cpu.H_Register.data << 8 | cpu.L_Register.data;
+    unpack_flags(cpu, (unsigned char) value);
+    REGISTER(A) = (unsigned char) (value >> 8);
+}
 
-                uint16_t result = (uint16_t) HL + HL;
-                cpu.flagRegister.carryFlag = (result >> 16) & 0x01;
+// STAX B
+// The content of register A is written to the memory at an address formed by the contents of registers B and C.
+INSTRUCTION(op_stax_b)
+{
+    write_byte(ramGateway, REGISTER_PAIR(B, C), REGISTER(A));
+}
 
-                cpu.H_Register.data = (result >> 8) & 0xFF;
-                cpu.L_Register.data = result & 0xFF;
+// STAX D
+INSTRUCTION(op_stax_d)
+{
+    write_byte(ramGateway, REGISTER_PAIR(D, E), REGISTER(A));
+}
 
-                break;
-            }
-            // LHLD adr
-            case 0x2a:
-            {
-                cpu.programCounter.data++;
-                short low = read_memory_ram(ramGateway, cpu.programCounter.data);
+// LDAX B
+// The value stored in the memory location whose address is formed by the contents of registers B and C is loaded into A.
+INSTRUCTION(op_ldax_b)
+{
+    REGISTER(A) = read_byte(ramGateway, REGISTER_PAIR(B, C));
+}
 
-                cpu.programCounter.data++;
-                short high = read_memory_ram(ramGateway, cpu.programCounter.data);
+// LDAX D
+INSTRUCTION(op_ldax_d)
+{
+    REGISTER(A) = read_byte(ramGateway, REGISTER_PAIR(D, E));
+}
 
-                uint16_t targetAddress = (high << 8) | low;
+// SHLD adr
+// Store L and H registers direct to the memory address specified by D16
+INSTRUCTION(op_shld)
+{
+    write_word(ramGateway, operand, REGISTER_PAIR(H, L));
+}
 
-                cpu.L_Register.data = read_memory_ram(ramGateway, targetAddress - 1);
-                cpu.H_Register.data = read_memory_ram(ramGateway, targetAddress);
+// LHLD adr
+INSTRUCTION(op_lhld)
+{
+    REGISTER_PAIR(H, L) = read_word(ramGateway, operand);
+}
 
-                break;
-            }
-            // DCX H
-            case 0x2b:
-            {
-                uint16_t HL = (cpu.H_Register.data << 8) | cpu.L_Register.data;
-                HL--;
+// STA adr
+INSTRUCTION(op_sta)
+{
+    write_byte(ramGateway, operand, REGISTER(A));
+}
 
-                cpu.H_Register.data = (HL >> 8) & 0xFF;
-                cpu.L_Register.data = HL & 0xFF;
+// LDA adr
+INSTRUCTION(op_lda)
+{
+    REGISTER(A) = read_byte(ramGateway, operand);
+}
 
-                break;
-            }
-            // INR L
-            case 0x2c:
-                cpu.L_Register.data++;
-
-                cpu.flagRegister.zeroFlag = (cpu.L_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.L_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.L_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.L_Register.data);
-
-                break;
-            // DCR L
-            case 0x2d:
-                cpu.L_Register.data--;
-
-                cpu.flagRegister.zeroFlag = (cpu.L_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.L_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.L_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.L_Register.data);
-
-                break;
-            // MVI L, D8
-            case 0x2e:
-                cpu.programCounter.data++;
-                cpu.L_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-
-                break;
-            // CMA
-            case 0x2f:
-                cpu.A_Register.data = ~cpu.A_Register.data;
-
-                break;
-            // LXI SP, D16
-            // Load 16-bit immediate data into Stack Pointer (SP)
-            case 0x31:
-            {
-                cpu.programCounter.data++;
-                short low = read_memory_ram(ramGateway, cpu.programCounter.data);
+// RLC
+// Circular shift of bits to the left, the most significant bit goes to bit 0 and to the carry flag
+INSTRUCTION(op_rlc)
+{
+    unsigned char accumulator = REGISTER(A);
 
-                cpu.programCounter.data++;
-                short high = read_memory_ram(ramGateway, cpu.programCounter.data);
+    write_carry(cpu, (accumulator >> 7) & 1);
+    REGISTER(A) = (unsigned char) ((accumulator << 1) | read_carry(cpu));
+}
 
-                uint16_t targetAddress = (high << 8) | low;
+// RRC
+INSTRUCTION(op_rrc)
+{
+    unsigned char accumulator = REGISTER(A);
 
-                short valueLow = read_memory_ram(ramGateway, targetAddress - 1);
-                short valueHigh = read_memory_ram(ramGateway, targetAddress);
+    write_carry(cpu, accumulator & 1);
+    REGISTER(A) = (unsigned char) ((accumulator >> 1) | (read_carry(cpu) << 7));
+}
 
-                cpu.programCounter.data = (valueHigh << 8) | valueLow;
+// RAL
+// Rotate Accumulator Left through Carry
+INSTRUCTION(op_ral)
+{
+    unsigned char accumulator = REGISTER(A);
+    unsigned char previousCarry = read_carry(cpu);
 
-                break;
-            }
-            // STA adr
-            case 0x32:
-            {
-                cpu.programCounter.data++;
-                short low = read_memory_ram(ramGateway, cpu.programCounter.data);
+    write_carry(cpu, (accumulator >> 7) & 1);
+    REGISTER(A) = (unsigned char) ((accumulator << 1) | previousCarry);
+}
 
-                cpu.programCounter.data++;
-                short high = read_memory_ram(ramGateway, cpu.programCounter.data);
+// RAR
+// Rotate A right through carry
+INSTRUCTION(op_rar)
+{
+    unsigned char accumulator = REGISTER(A);
+    unsigned char previousCarry = read_carry(cpu);
 
-                uint16_t targetAddress = (high << 8) | low;
+    write_carry(cpu, accumulator & 1);
+    REGISTER(A) = (unsigned char) ((accumulator >> 1) | (previousCarry << 7));
+}
 
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.A_Register.data);
+// DAA
+// Decimal Adjust Accumulator
+INSTRUCTION(op_daa)
+{
+    materialize_flags(cpu);
 
-                break;
-            }
-            // INX SP
-            case 0x33:
-                cpu.programCounter.data++;
-
-                break;
-            // INR M
-            // Increment the content of the memory cell whose address is specified by registers HL by 1
-            case 0x34:
-            {
-                uint16_t targetAddress = (uint16_t)cpu.H_Register.data << 8 | cpu.L_Register.data;
+    unsigned char accumulator = REGISTER(A);
+    unsigned char lowerNibble = accumulator & 0x0F;
+    unsigned char higherNibble = accumulator >> 4;
 
-                char value = read_memory_ram(ramGateway, targetAddress - 1);
-                value++;
-                write_memory_ram(ramGateway, targetAddress - 1, value);
+    unsigned char correction = 0;
+    unsigned char carry = read_carry(cpu);
 
-                cpu.flagRegister.zeroFlag = (value == 0);
-                cpu.flagRegister.signFlag = (value < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(value);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(value);
+    if (lowerNibble > 9 || (cpu->flags & FLAG_AUXILIARY_CARRY))
+    {
+        correction += 0x06;
+    }
 
-                break;
-            }
-            // DCR M
-            // Decrement Memory
-            // Decrement the content of the memory cell whose address is specified
-            case 0x35:
-            {
-                uint16_t targetAddress = (uint16_t)cpu.H_Register.data << 8 | cpu.L_Register.data;
+    if (higherNibble > 9 || carry || (higherNibble >= 9 && lowerNibble > 9))
+    {
+        correction += 0x60;
+        carry = 1;
+    }
 
-                char value = read_memory_ram(ramGateway, targetAddress - 1);
-                value--;
-                write_memory_ram(ramGateway, targetAddress, value);
+    alu_add(cpu, correction);
+    write_carry(cpu, carry);
+}
 
-                cpu.flagRegister.zeroFlag = (value == 0);
-                cpu.flagRegister.signFlag = (value < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(value);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(value);
+// CMA
+INSTRUCTION(op_cma)
+{
+    REGISTER(A) = (unsigned char) ~REGISTER(A);
+}
 
-                break;
-            }
-            // MVI M, D8
-            case 0x36:
-            {
-                uint16_t targetAddress = (uint16_t)cpu.H_Register.data << 8 | cpu.L_Register.data;
-                cpu.programCounter.data++;
+// STC
+// Set the carry flag (CY) to 1
+INSTRUCTION(op_stc)
+{
+    write_carry(cpu, 1);
+}
 
-                char value = read_memory_ram(ramGateway, cpu.programCounter.data);
+// CMC
+// Complement Carry Flag
+INSTRUCTION(op_cmc)
+{
+    cpu->flags ^= FLAG_CARRY;
+}
 
-                write_memory_ram(ramGateway, targetAddress - 1, value);
+// MOV r, r; MOV r, M
+#define DEFINE_MOV_INSTRUCTIONS(suffix, destination) \
+    INSTRUCTION(op_mov_##suffix##_b) { REGISTER(destination) = REGISTER(B); } \
+    INSTRUCTION(op_mov_##suffix##_c) { REGISTER(destination) = REGISTER(C); } \
+    INSTRUCTION(op_mov_##suffix##_d) { REGISTER(destination) = REGISTER(D); } \
+    INSTRUCTION(op_mov_##suffix##_e) { REGISTER(destination) = REGISTER(E); } \
+    INSTRUCTION(op_mov_##suffix##_h) { REGISTER(destination) = REGISTER(H); } \
+    INSTRUCTION(op_mov_##suffix##_l) { REGISTER(destination) = REGISTER(L); } \
+    INSTRUCTION(op_mov_##suffix##_m) { REGISTER(destination) = read_byte(ramGateway, REGISTER_PAIR(H, L)); } \
+    INSTRUCTION(op_mov_##suffix##_a) { REGISTER(destination) = REGISTER(A); }
+
+DEFINE_MOV_INSTRUCTIONS(b, B)
+DEFINE_MOV_INSTRUCTIONS(c, C)
+DEFINE_MOV_INSTRUCTIONS(d, D)
+DEFINE_MOV_INSTRUCTIONS(e, E)
+DEFINE_MOV_INSTRUCTIONS(h, H)
+DEFINE_MOV_INSTRUCTIONS(l, L)
+DEFINE_MOV_INSTRUCTIONS(a, A)
+
+// MOV M, r
+#define DEFINE_MOV_TO_MEMORY_INSTRUCTION(suffix, source) \
+    INSTRUCTION(op_mov_m_##suffix) { write_byte(ramGateway, REGISTER_PAIR(H, L), REGISTER(source)); }
+
+DEFINE_MOV_TO_MEMORY_INSTRUCTION(b, B)
+DEFINE_MOV_TO_MEMORY_INSTRUCTION(c, C)
+DEFINE_MOV_TO_MEMORY_INSTRUCTION(d, D)
+DEFINE_MOV_TO_MEMORY_INSTRUCTION(e, E)
+DEFINE_MOV_TO_MEMORY_INSTRUCTION(h, H)
+DEFINE_MOV_TO_MEMORY_INSTRUCTION(l, L)
+DEFINE_MOV_TO_MEMORY_INSTRUCTION(a, A)
+
+// ADD / ADC / SUB / SBB / ANA / XRA / ORA / CMP with a register, memory (HL) or immediate operand
+#define DEFINE_ALU_INSTRUCTIONS(operation, immediate) \
+    INSTRUCTION(op_##operation##_b) { alu_##operation(cpu, REGISTER(B)); } \
+    INSTRUCTION(op_##operation##_c) { alu_##operation(cpu, REGISTER(C)); } \
+    INSTRUCTION(op_##operation##_d) { alu_##operation(cpu, REGISTER(D)); } \
+    INSTRUCTION(op_##operation##_e) { alu_##operation(cpu, REGISTER(E)); } \
+    INSTRUCTION(op_##operation##_h) { alu_##operation(cpu, REGISTER(H)); } \
+    INSTRUCTION(op_##operation##_l) { alu_##operation(cpu, REGISTER(L)); } \
+    INSTRUCTION(op_##operation##_m) { alu_##operation(cpu, read_byte(ramGateway, REGISTER_PAIR(H, L))); } \
+    INSTRUCTION(op_##operation##_a) { alu_##operation(cpu, REGISTER(A)); } \
+    INSTRUCTION(op_##immediate) { alu_##operation(cpu, (unsigned char) operand); }
+
+DEFINE_ALU_INSTRUCTIONS(add, adi)
+DEFINE_ALU_INSTRUCTIONS(adc, aci)
+DEFINE_ALU_INSTRUCTIONS(sub, sui)
+DEFINE_ALU_INSTRUCTIONS(sbb, sbi)
+DEFINE_ALU_INSTRUCTIONS(ana, ani)
+DEFINE_ALU_INSTRUCTIONS(xra, xri)
+DEFINE_ALU_INSTRUCTIONS(ora, ori)
+DEFINE_ALU_INSTRUCTIONS(cmp, cpi)
+
+// JMP adr
+INSTRUCTION(op_jmp)
+{
+    cpu->programCounter.data = operand;
+}
 
-                break;
-            }
-            // STC
-            // Set the carry flag (CY) to 1
-            case 0x37:
-                cpu.flagRegister.carryFlag = 1;
-
-                break;
-            // DAD SP
-            case 0x39:
-            {
-                uint16_t HL = (uint16_t) cpu.H_Register.data << 8 | cpu.L_Register.data;
-                uint16_t stackPoitner = cpu.stackPointer.data;
+// CALL adr
+// The return address (PC is already past the instruction) goes to the stack
+INSTRUCTION(op_call)
+{
+    push_word(cpu, ramGateway, cpu->programCounter.data);
+    cpu->programCounter.data = operand;
+}
 
-                uint16_t result = HL + stackPoitner;
-                cpu.flagRegister.carryFlag = (result >> 16) & 0x01;
+// RET
+INSTRUCTION(op_ret)
+{
+    cpu->programCounter.data = pop_word(cpu, ramGateway);
+}
 
-                cpu.H_Register.data = (unsigned char) (result >> 8);
-                cpu.L_Register.data = (unsigned char) result;
+// Jcc adr, Ccc adr, Rcc
+// The opcode map holds the cost of a call or return that is not taken, taking it costs CONDITIONAL_TAKEN_CYCLES more
+#define CONDITIONAL_TAKEN_CYCLES 6
+
+#define DEFINE_CONDITIONAL_INSTRUCTIONS(suffix, condition) \
+    INSTRUCTION(op_j##suffix) { materialize_flags(cpu); if (condition) { op_jmp(cpu, ramGateway, operand); } } \
+    INSTRUCTION(op_c##suffix) \
+    { \
+        materialize_flags(cpu); \
+        if (condition) { cpu->cycles += CONDITIONAL_TAKEN_CYCLES; op_call(cpu, ramGateway, operand); } \
+    } \
+    INSTRUCTION(op_r##suffix) \
+    { \
+        materialize_flags(cpu); \
+        if (condition) { cpu->cycles += CONDITIONAL_TAKEN_CYCLES; op_ret(cpu, ramGateway, operand); } \
+    }
 
-                break;
-            }
-            // DCX SP
-            case 0x3b:
-                cpu.stackPointer.data--;
-
-                break;
-            // INR A
-            // Increment Register A
-            case 0x3c:
-                cpu.A_Register.data++;
-
-                cpu.flagRegister.zeroFlag = (cpu.A_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.A_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.A_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.A_Register.data);
-
-                break;
-            // DCR A
-            // Decrement Register A
-            case 0x3d:
-                cpu.A_Register.data++;
-
-                cpu.flagRegister.zeroFlag = (cpu.A_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.A_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.A_Register.data);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.A_Register.data);
-
-                break;
-            // MVI A, D8
-            // Move Immediate to Register A
-            case 0x3e:
-                cpu.programCounter.data++;
-                cpu.A_Register.data = read_memory_ram(ramGateway, cpu.programCounter.data);
-
-                break;
-            // CMC
-            // Complement Carry Flag
-            case 0x3f:
-                cpu.flagRegister.carryFlag = !cpu.flagRegister.carryFlag;
-
-                break;
-            // MOV B, B
-            case 0x40:
-                break;
-            // MOV B, C
-            case 0x41:
-                cpu.B_Register.data = cpu.C_Register.data;
-
-                break;
-            // MOV B, D
-            case 0x42:
-                cpu.B_Register.data = cpu.D_Register.data;
-
-                break;
-            // MOV B, E
-            case 0x43:
-                cpu.B_Register.data = cpu.E_Register.data;
-
-                break;
-            // MOV B, H
-            case 0x44:
-                cpu.B_Register.data = cpu.H_Register.data;
-
-                break;
-            // MOV B, M
-            // Move data from memory location addressed by HL to register B
-            case 0x46:
-            {
-                uint16_t targetAddress = (uint16_t) cpu.H_Register.data << 8 | cpu.L_Register.data;
-                cpu.B_Register.data = read_memory_ram(ramGateway, targetAddress - 1);
+DEFINE_CONDITIONAL_INSTRUCTIONS(nz, !(cpu->flags & FLAG_ZERO))
+DEFINE_CONDITIONAL_INSTRUCTIONS(z, (cpu->flags & FLAG_ZERO))
+DEFINE_CONDITIONAL_INSTRUCTIONS(nc, !read_carry(cpu))
+DEFINE_CONDITIONAL_INSTRUCTIONS(c, read_carry(cpu))
+DEFINE_CONDITIONAL_INSTRUCTIONS(po, !(cpu->flags & FLAG_PARITY))
+DEFINE_CONDITIONAL_INSTRUCTIONS(pe, (cpu->flags & FLAG_PARITY))
+DEFINE_CONDITIONAL_INSTRUCTIONS(p, !(cpu->flags & FLAG_SIGN))
+DEFINE_CONDITIONAL_INSTRUCTIONS(m, (cpu->flags & FLAG_SIGN))
+
+// RST n
+// A one byte CALL to the address n * 8
+#define DEFINE_RESTART_INSTRUCTION(number) \
+    INSTRUCTION(op_rst_##number) { op_call(cpu, ramGateway, (number) * 8); }
+
+DEFINE_RESTART_INSTRUCTION(0)
+DEFINE_RESTART_INSTRUCTION(1)
+DEFINE_RESTART_INSTRUCTION(2)
+DEFINE_RESTART_INSTRUCTION(3)
+DEFINE_RESTART_INSTRUCTION(4)
+DEFINE_RESTART_INSTRUCTION(5)
+DEFINE_RESTART_INSTRUCTION(6)
+DEFINE_RESTART_INSTRUCTION(7)
+
+// PCHL
+INSTRUCTION(op_pchl)
+{
+    cpu->programCounter.data = REGISTER_PAIR(H, L);
+}
 
-                break;
-            }
-            // MOV B, A
-            // Move data from register A to register B
-            case 0x47:
-                cpu.B_Register.data = cpu.A_Register.data;
-                break;
-            // MOV C, B
-            // Move data from register B to register C
-            case 0x48:
-                cpu.C_Register.data = cpu.B_Register.data;
-                break;
-            // MOV C, C
-            // Move data from register C to register C (no operation)
-            case 0x49:
-                // No operation
-                break;
-            // MOV C, D
-            // Move data from register D to register C
-            case 0x4a:
-                cpu.C_Register.data = cpu.D_Register.data;
-                break;
-            // MOV C, E
-            // Move data from register E to register C
-            case 0x4b:
-                cpu.C_Register.data = cpu.E_Register.data;
-                break;
-            // MOV C, H
-            // Move data from register H to register C
-            case 0x4c:
-                cpu.C_Register.data = cpu.H_Register.data;
-                break;
-            // MOV C, L
-            // Move data from register L to register C
-            case 0x4d:
-                cpu.C_Register.data = cpu.L_Register.data;
-                break;
-            // MOV C, M
-            // Move data from memory location specified by HL to register C
-            case 0x4e:
-            {
-                uint16_t targetAddress = (uint16_t) cpu.H_Register.data << 8 | cpu.L_Register.data;
+// SPHL
+INSTRUCTION(op_sphl)
+{
+    cpu->stackPointer.data = REGISTER_PAIR(H, L);
+}
 
-                cpu.C_Register.data = read_memory_ram(ramGateway, targetAddress - 1);
-                break;
-            }
-            // MOV C, A
-            // Move data from register A to register C
-            case 0x4f:
-                cpu.C_Register.data = cpu.A_Register.data;
-                break;
-            // MOV D, B
-            // Move data from register B to register D
-            case 0x50:
-                cpu.D_Register.data = cpu.B_Register.data;
-                break;
-            // MOV D, C
-            // Move data from register C to register D
-            case 0x51:
-                cpu.D_Register.data = cpu.C_Register.data;
-                break;
-            // MOV D, D
-            // Move data from register D to register D (no operation)
-            case 0x52:
-                // No operation
-                break;
-            // MOV D, E
-            // Move data from register E to register D
-            case 0x53:
-                cpu.D_Register.data = cpu.E_Register.data;
-                break;
-            // MOV D, H
-            // Move data from register H to register D
-            case 0x54:
-                cpu.D_Register.data = cpu.H_Register.data;
-                break;
-            // MOV D, L
-            // Move data from register L to register D
-            case 0x55:
-                cpu.D_Register.data = cpu.L_Register.data;
-                break;
-            // MOV D, M
-            // Move data from memory location specified by HL to register D
-            case 0x56:
-            {
-                uint16_t targetAddress = (uint16_t)cpu.H_Register.data << 8 | cpu.L_Register.data;
+// XCHG
+// Exchange the HL and DE register pairs
+INSTRUCTION(op_xchg)
+{
+    uint16_t pair = REGISTER_PAIR(D, E);
 
-                cpu.D_Register.data = read_memory_ram(ramGateway, targetAddress - 1);
-                break;
-            }
-            // MOV D, A
-            // Move data from register A to register D
-            case 0x57:
-                cpu.D_Register.data = cpu.A_Register.data;
-                break;
-            // MOV E, B
-            // Move data from register B to register E
-            case 0x58:
-                cpu.E_Register.data = cpu.B_Register.data;
-                break;
-            // MOV E, C
-            // Move data from register C to register E
-            case 0x59:
-                cpu.E_Register.data = cpu.C_Register.data;
-                break;
-            // MOV E, D
-            // Move data from register D to register E
-            case 0x5a:
-                cpu.E_Register.data = cpu.D_Register.data;
-                break;
-            // MOV E, E
-            // Move data from register E to register E (no operation)
-            case 0x5b:
-                // No operation
-                break;
-            // MOV E, H
-            // Move data from register H to register E
-            case 0x5c:
-                cpu.E_Register.data = cpu.H_Register.data;
-                break;
-            // MOV E, L
-            // Move data from register L to register E
-            case 0x5d:
-                cpu.E_Register.data = cpu.L_Register.data;
-                break;
-            // MOV E, M
-            // Move data from memory location specified by HL to register E
-            case 0x5e:
-            {
-                uint16_t targetAddress = (uint16_t)cpu.H_Register.data << 8 | cpu.L_Register.data;
+    REGISTER_PAIR(D, E) = REGISTER_PAIR(H, L);
+    REGISTER_PAIR(H, L) = pair;
+}
 
-                cpu.E_Register.data = read_memory_ram(ramGateway, targetAddress - 1);
-                break;
-            }
-            // MOV E, A
-            // Move data from register A to register E
-            case 0x5f:
-                cpu.E_Register.data = cpu.A_Register.data;
-                break;
-            // MOV H, B
-            // Move data from register B to register H
-            case 0x60:
-                cpu.H_Register.data = cpu.B_Register.data;
-                break;
-            // MOV H, C
-            // Move data from register C to register H
-            case 0x61:
-                cpu.H_Register.data = cpu.C_Register.data;
-                break;
-            // MOV H, D
-            // Move data from register D to register H
-            case 0x62:
-                cpu.H_Register.data = cpu.D_Register.data;
-                break;
-            // MOV H, E
-            // Move data from register E to register H
-            case 0x63:
-                cpu.H_Register.data = cpu.E_Register.data;
-                break;
-            // MOV H, H
-            // Move data from register H to register H (no operation)
-            case 0x64:
-                // No operation
-                break;
-            // MOV H, L
-            // Move data from register L to register H
-            case 0x65:
-                cpu.H_Register.data = cpu.L_Register.data;
-                break;
-            // MOV H, M
-            // Move data from memory location specified by HL to register H
-            case 0x66:
-            {
-                uint16_t targetAddress = (uint16_t) cpu.H_Register.data << 8 | cpu.L_Register.data;
+// XTHL
+// Exchange HL with the word on top of the stack
+INSTRUCTION(op_xthl)
+{
+    uint16_t value = read_word(ramGateway, cpu->stackPointer.data);
 
-                cpu.H_Register.data = read_memory_ram(ramGateway, targetAddress - 1);
-                break;
-            }
-            // MOV H, A
-            // Move data from register A to register H
-            case 0x67:
-                cpu.H_Register.data = cpu.A_Register.data;
-                break;
-            // MOV L, B
-            // Move data from register B to register L
-            case 0x68:
-                cpu.L_Register.data = cpu.B_Register.data;
-                break;
-            // MOV L, C
-            // Move data from register C to register L
-            case 0x69:
-                cpu.L_Register.data = cpu.C_Register.data;
-                break;
-            // MOV L, D
-            // Move data from register D to register L
-            case 0x6a:
-                cpu.L_Register.data = cpu.D_Register.data;
-                break;
-            // MOV L, E
-            // Move data from register E to register L
-            case 0x6b:
-                cpu.L_Register.data = cpu.E_Register.data;
-                break;
-            // MOV L, H
-            // Move data from register H to register L
-            case 0x6c:
-                cpu.L_Register.data = cpu.H_Register.data;
-                break;
-            // MOV L, L
-            // Move data from register L to register L (no operation)
-            case 0x6d:
-                // No operation
-                break;
-            // MOV L, M
-            case 0x6e:
-            {
-                uint16_t targetAddress = (uint16_t) (cpu.H_Register.data << 8) | cpu.L_Register.data;
-                cpu.L_Register.data = read_memory_ram(ramGateway, targetAddress - 1);
+    write_word(ramGateway, cpu->stackPointer.data, REGISTER_PAIR(H, L));
+    REGISTER_PAIR(H, L) = value;
+}
 
-                break;
-            }
-            // MOV L, A
-            case 0x6f:
-            {
-                cpu.L_Register.data = cpu.A_Register.data;
+// OUT D8
+INSTRUCTION(op_out)
+{
+    io_bus_write(cpu->bus, (unsigned char) operand, REGISTER(A));
+}
 
-                break;
-            }
-            // MOV M, B
-            case 0x70:
-            {
-                uint16_t targetAddress = (uint16_t) (cpu.H_Register.data << 8) | cpu.L_Register.data;
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.B_Register.data);
+// IN D8
+INSTRUCTION(op_in)
+{
+    REGISTER(A) = io_bus_read(cpu->bus, (unsigned char) operand);
+}
 
-                break;
-            }
-            // MOV M, C
-            case 0x71:
-            {
-                uint16_t targetAddress = (uint16_t)(cpu.H_Register.data << 8) | cpu.L_Register.data;
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.C_Register.data);
+// EI
+// Interrupts are accepted again after the next instruction, so EI followed by RET leaves a handler before the next one starts
+INSTRUCTION(op_ei)
+{
+    cpu->interruptsEnabled = TRUE;
+    cpu->interruptEnableCycle = cpu->cycles;
+}
 
-                break;
-            }
-            // MOV M, D
-            case 0x72:
-            {
-                uint16_t targetAddress = (uint16_t)(cpu.H_Register.data << 8) | cpu.L_Register.data;
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.D_Register.data);
+// DI
+INSTRUCTION(op_di)
+{
+    cpu->interruptsEnabled = FALSE;
+}
 
-                break;
-            }
-            // MOV M, E
-            case 0x73:
+// Opcode map: X(opcode, handler, length in bytes, T-states).
+// Undocumented opcodes behave like their documented twins (NOP, JMP, RET, CALL)
+#define INSTRUCTION_TABLE(X) \
+    X(0x00, op_nop, 1, 4) \
+    X(0x01, op_lxi_b, 3, 10) \
+    X(0x02, op_stax_b, 1, 7) \
+    X(0x03, op_inx_b, 1, 5) \
+    X(0x04, op_inr_b, 1, 5) \
+    X(0x05, op_dcr_b, 1, 5) \
+    X(0x06, op_mvi_b, 2, 7) \
+    X(0x07, op_rlc, 1, 4) \
+    X(0x08, op_nop, 1, 4) \
+    X(0x09, op_dad_b, 1, 10) \
+    X(0x0a, op_ldax_b, 1, 7) \
+    X(0x0b, op_dcx_b, 1, 5) \
+    X(0x0c, op_inr_c, 1, 5) \
+    X(0x0d, op_dcr_c, 1, 5) \
+    X(0x0e, op_mvi_c, 2, 7) \
+    X(0x0f, op_rrc, 1, 4) \
+    X(0x10, op_nop, 1, 4) \
+    X(0x11, op_lxi_d, 3, 10) \
+    X(0x12, op_stax_d, 1, 7) \
+    X(0x13, op_inx_d, 1, 5) \
+    X(0x14, op_inr_d, 1, 5) \
+    X(0x15, op_dcr_d, 1, 5) \
+    X(0x16, op_mvi_d, 2, 7) \
+    X(0x17, op_ral, 1, 4) \
+    X(0x18, op_nop, 1, 4) \
+    X(0x19, op_dad_d, 1, 10) \
+    X(0x1a, op_ldax_d, 1, 7) \
+    X(0x1b, op_dcx_d, 1, 5) \
+    X(0x1c, op_inr_e, 1, 5) \
+    X(0x1d, op_dcr_e, 1, 5) \
+    X(0x1e, op_mvi_e, 2, 7) \
+    X(0x1f, op_rar, 1, 4) \
+    X(0x20, op_nop, 1, 4) \
+    X(0x21, op_lxi_h, 3, 10) \
+    X(0x22, op_shld, 3, 16) \
+    X(0x23, op_inx_h, 1, 5) \
+    X(0x24, op_inr_h, 1, 5) \
+    X(0x25, op_dcr_h, 1, 5) \
+    X(0x26, op_mvi_h, 2, 7) \
+    X(0x27, op_daa, 1, 4) \
+    X(0x28, op_nop, 1, 4) \
+    X(0x29, op_dad_h, 1, 10) \
+    X(0x2a, op_lhld, 3, 16) \
+    X(0x2b, op_dcx_h, 1, 5) \
+    X(0x2c, op_inr_l, 1, 5) \
+    X(0x2d, op_dcr_l, 1, 5) \
+    X(0x2e, op_mvi_l, 2, 7) \
+    X(0x2f, op_cma, 1, 4) \
+    X(0x30, op_nop, 1, 4) \
+    X(0x31, op_lxi_sp, 3, 10) \
+    X(0x32, op_sta, 3, 13) \
+    X(0x33, op_inx_sp, 1, 5) \
+    X(0x34, op_inr_m, 1, 10) \
+    X(0x35, op_dcr_m, 1, 10) \
+    X(0x36, op_mvi_m, 2, 10) \
+    X(0x37, op_stc, 1, 4) \
+    X(0x38, op_nop, 1, 4) \
+    X(0x39, op_dad_sp, 1, 10) \
+    X(0x3a, op_lda, 3, 13) \
+    X(0x3b, op_dcx_sp, 1, 5) \
+    X(0x3c, op_inr_a, 1, 5) \
+    X(0x3d, op_dcr_a, 1, 5) \
+    X(0x3e, op_mvi_a, 2, 7) \
+    X(0x3f, op_cmc, 1, 4) \
+    X(0x40, op_mov_b_b, 1, 5) \
+    X(0x41, op_mov_b_c, 1, 5) \
+    X(0x42, op_mov_b_d, 1, 5) \
+    X(0x43, op_mov_b_e, 1, 5) \
+    X(0x44, op_mov_b_h, 1, 5) \
+    X(0x45, op_mov_b_l, 1, 5) \
+    X(0x46, op_mov_b_m, 1, 7) \
+    X(0x47, op_mov_b_a, 1, 5) \
+    X(0x48, op_mov_c_b, 1, 5) \
+    X(0x49, op_mov_c_c, 1, 5) \
+    X(0x4a, op_mov_c_d, 1, 5) \
+    X(0x4b, op_mov_c_e, 1, 5) \
+    X(0x4c, op_mov_c_h, 1, 5) \
+    X(0x4d, op_mov_c_l, 1, 5) \
+    X(0x4e, op_mov_c_m, 1, 7) \
+    X(0x4f, op_mov_c_a, 1, 5) \
+    X(0x50, op_mov_d_b, 1, 5) \
+    X(0x51, op_mov_d_c, 1, 5) \
+    X(0x52, op_mov_d_d, 1, 5) \
+    X(0x53, op_mov_d_e, 1, 5) \
+    X(0x54, op_mov_d_h, 1, 5) \
+    X(0x55, op_mov_d_l, 1, 5) \
+    X(0x56, op_mov_d_m, 1, 7) \
+    X(0x57, op_mov_d_a, 1, 5) \
+    X(0x58, op_mov_e_b, 1, 5) \
+    X(0x59, op_mov_e_c, 1, 5) \
+    X(0x5a, op_mov_e_d, 1, 5) \
+    X(0x5b, op_mov_e_e, 1, 5) \
+    X(0x5c, op_mov_e_h, 1, 5) \
+    X(0x5d, op_mov_e_l, 1, 5) \
+    X(0x5e, op_mov_e_m, 1, 7) \
+    X(0x5f, op_mov_e_a, 1, 5) \
+    X(0x60, op_mov_h_b, 1, 5) \
+    X(0x61, op_mov_h_c, 1, 5) \
+    X(0x62, op_mov_h_d, 1, 5) \
+    X(0x63, op_mov_h_e, 1, 5) \
+    X(0x64, op_mov_h_h, 1, 5) \
+    X(0x65, op_mov_h_l, 1, 5) \
+    X(0x66, op_mov_h_m, 1, 7) \
+    X(0x67, op_mov_h_a, 1, 5) \
+    X(0x68, op_mov_l_b, 1, 5) \
+    X(0x69, op_mov_l_c, 1, 5) \
+    X(0x6a, op_mov_l_d, 1, 5) \
+    X(0x6b, op_mov_l_e, 1, 5) \
+    X(0x6c, op_mov_l_h, 1, 5) \
+    X(0x6d, op_mov_l_l, 1, 5) \
+    X(0x6e, op_mov_l_m, 1, 7) \
+    X(0x6f, op_mov_l_a, 1, 5) \
+    X(0x70, op_mov_m_b, 1, 7) \
+    X(0x71, op_mov_m_c, 1, 7) \
+    X(0x72, op_mov_m_d, 1, 7) \
+    X(0x73, op_mov_m_e, 1, 7) \
+    X(0x74, op_mov_m_h, 1, 7) \
+    X(0x75, op_mov_m_l, 1, 7) \
+    X(0x76, op_hlt, 1, 7) \
+    X(0x77, op_mov_m_a, 1, 7) \
+    X(0x78, op_mov_a_b, 1, 5) \
+    X(0x79, op_mov_a_c, 1, 5) \
+    X(0x7a, op_mov_a_d, 1, 5) \
+    X(0x7b, op_mov_a_e, 1, 5) \
+    X(0x7c, op_mov_a_h, 1, 5) \
+    X(0x7d, op_mov_a_l, 1, 5) \
+    X(0x7e, op_mov_a_m, 1, 7) \
+    X(0x7f, op_mov_a_a, 1, 5) \
+    X(0x80, op_add_b, 1, 4) \
+    X(0x81, op_add_c, 1, 4) \
+    X(0x82, op_add_d, 1, 4) \
+    X(0x83, op_add_e, 1, 4) \
+    X(0x84, op_add_h, 1, 4) \
+    X(0x85, op_add_l, 1, 4) \
+    X(0x86, op_add_m, 1, 7) \
+    X(0x87, op_add_a, 1, 4) \
+    X(0x88, op_adc_b, 1, 4) \
+    X(0x89, op_adc_c, 1, 4) \
+    X(0x8a, op_adc_d, 1, 4) \
+    X(0x8b, op_adc_e, 1, 4) \
+    X(0x8c, op_adc_h, 1, 4) \
+    X(0x8d, op_adc_l, 1, 4) \
+    X(0x8e, op_adc_m, 1, 7) \
+    X(0x8f, op_adc_a, 1, 4) \
+    X(0x90, op_sub_b, 1, 4) \
+    X(0x91, op_sub_c, 1, 4) \
+    X(0x92, op_sub_d, 1, 4) \
+    X(0x93, op_sub_e, 1, 4) \
+    X(0x94, op_sub_h, 1, 4) \
+    X(0x95, op_sub_l, 1, 4) \
+    X(0x96, op_sub_m, 1, 7) \
+    X(0x97, op_sub_a, 1, 4) \
+    X(0x98, op_sbb_b, 1, 4) \
+    X(0x99, op_sbb_c, 1, 4) \
+    X(0x9a, op_sbb_d, 1, 4) \
+    X(0x9b, op_sbb_e, 1, 4) \
+    X(0x9c, op_sbb_h, 1, 4) \
+    X(0x9d, op_sbb_l, 1, 4) \
+    X(0x9e, op_sbb_m, 1, 7) \
+    X(0x9f, op_sbb_a, 1, 4) \
+    X(0xa0, op_ana_b, 1, 4) \
+    X(0xa1, op_ana_c, 1, 4) \
+    X(0xa2, op_ana_d, 1, 4) \
+    X(0xa3, op_ana_e, 1, 4) \
+    X(0xa4, op_ana_h, 1, 4) \
+    X(0xa5, op_ana_l, 1, 4) \
+    X(0xa6, op_ana_m, 1, 7) \
+    X(0xa7, op_ana_a, 1, 4) \
+    X(0xa8, op_xra_b, 1, 4) \
+    X(0xa9, op_xra_c, 1, 4) \
+    X(0xaa, op_xra_d, 1, 4) \
+    X(0xab, op_xra_e, 1, 4) \
+    X(0xac, op_xra_h, 1, 4) \
+    X(0xad, op_xra_l, 1, 4) \
+    X(0xae, op_xra_m, 1, 7) \
+    X(0xaf, op_xra_a, 1, 4) \
+    X(0xb0, op_ora_b, 1, 4) \
+    X(0xb1, op_ora_c, 1, 4) \
+    X(0xb2, op_ora_d, 1, 4) \
+    X(0xb3, op_ora_e, 1, 4) \
+    X(0xb4, op_ora_h, 1, 4) \
+    X(0xb5, op_ora_l, 1, 4) \
+    X(0xb6, op_ora_m, 1, 7) \
+    X(0xb7, op_ora_a, 1, 4) \
+    X(0xb8, op_cmp_b, 1, 4) \
+    X(0xb9, op_cmp_c, 1, 4) \
+    X(0xba, op_cmp_d, 1, 4) \
+    X(0xbb, op_cmp_e, 1, 4) \
+    X(0xbc, op_cmp_h, 1, 4) \
+    X(0xbd, op_cmp_l, 1, 4) \
+    X(0xbe, op_cmp_m, 1, 7) \
+    X(0xbf, op_cmp_a, 1, 4) \
+    X(0xc0, op_rnz, 1, 5) \
+    X(0xc1, op_pop_b, 1, 10) \
+    X(0xc2, op_jnz, 3, 10) \
+    X(0xc3, op_jmp, 3, 10) \
+    X(0xc4, op_cnz, 3, 11) \
+    X(0xc5, op_push_b, 1, 11) \
+    X(0xc6, op_adi, 2, 7) \
+    X(0xc7, op_rst_0, 1, 11) \
+    X(0xc8, op_rz, 1, 5) \
+    X(0xc9, op_ret, 1, 10) \
+    X(0xca, op_jz, 3, 10) \
+    X(0xcb, op_jmp, 3, 10) \
+    X(0xcc, op_cz, 3, 11) \
+    X(0xcd, op_call, 3, 17) \
+    X(0xce, op_aci, 2, 7) \
+    X(0xcf, op_rst_1, 1, 11) \
+    X(0xd0, op_rnc, 1, 5) \
+    X(0xd1, op_pop_d, 1, 10) \
+    X(0xd2, op_jnc, 3, 10) \
+    X(0xd3, op_out, 2, 10) \
+    X(0xd4, op_cnc, 3, 11) \
+    X(0xd5, op_push_d, 1, 11) \
+    X(0xd6, op_sui, 2, 7) \
+    X(0xd7, op_rst_2, 1, 11) \
+    X(0xd8, op_rc, 1, 5) \
+    X(0xd9, op_ret, 1, 10) \
+    X(0xda, op_jc, 3, 10) \
+    X(0xdb, op_in, 2, 10) \
+    X(0xdc, op_cc, 3, 11) \
+    X(0xdd, op_call, 3, 17) \
+    X(0xde, op_sbi, 2, 7) \
+    X(0xdf, op_rst_3, 1, 11) \
+    X(0xe0, op_rpo, 1, 5) \
+    X(0xe1, op_pop_h, 1, 10) \
+    X(0xe2, op_jpo, 3, 10) \
+    X(0xe3, op_xthl, 1, 18) \
+    X(0xe4, op_cpo, 3, 11) \
+    X(0xe5, op_push_h, 1, 11) \
+    X(0xe6, op_ani, 2, 7) \
+    X(0xe7, op_rst_4, 1, 11) \
+    X(0xe8, op_rpe, 1, 5) \
+    X(0xe9, op_pchl, 1, 5) \
+    X(0xea, op_jpe, 3, 10) \
+    X(0xeb, op_xchg, 1, 4) \
+    X(0xec, op_cpe, 3, 11) \
+    X(0xed, op_call, 3, 17) \
+    X(0xee, op_xri, 2, 7) \
+    X(0xef, op_rst_5, 1, 11) \
+    X(0xf0, op_rp, 1, 5) \
+    X(0xf1, op_pop_psw, 1, 10) \
+    X(0xf2, op_jp, 3, 10) \
+    X(0xf3, op_di, 1, 4) \
+    X(0xf4, op_cp, 3, 11) \
+    X(0xf5, op_push_psw, 1, 11) \
+    X(0xf6, op_ori, 2, 7) \
+    X(0xf7, op_rst_6, 1, 11) \
+    X(0xf8, op_rm, 1, 5) \
+    X(0xf9, op_sphl, 1, 5) \
+    X(0xfa, op_jm, 3, 10) \
+    X(0xfb, op_ei, 1, 4) \
+    X(0xfc, op_cm, 3, 11) \
+    X(0xfd, op_call, 3, 17) \
+    X(0xfe, op_cpi, 2, 7) \
+    X(0xff, op_rst_7, 1, 11)
+
+#define HANDLER_ENTRY(opCode, handler, length, cycles) handler,
+#define LENGTH_ENTRY(opCode, handler, length, cycles) length,
+#define CYCLES_ENTRY(opCode, handler, length, cycles) cycles,
+#define NAME_ENTRY(opCode, handler, length, cycles) #handler + 3,
+
+// Jumps, calls, returns, RST, PCHL and HLT leave the straight-line path.
+// Rcc, Jcc, Ccc and RST n share the 11xxx000 / 11xxx010 / 11xxx100 / 11xxx111 patterns.
+// A constant expression, the dispatch code generated for each opcode only keeps the branch it needs
+#define INSTRUCTION_ENDS_BLOCK(opCode) \
+    ((opCode) == 0x76 \
+    || (opCode) == 0xc3 || (opCode) == 0xcb \
+    || (opCode) == 0xc9 || (opCode) == 0xd9 \
+    || (opCode) == 0xcd || (opCode) == 0xdd || (opCode) == 0xed || (opCode) == 0xfd \
+    || (opCode) == 0xe9 \
+    || ((opCode) & 0xc7) == 0xc0 || ((opCode) & 0xc7) == 0xc2 || ((opCode) & 0xc7) == 0xc4 || ((opCode) & 0xc7) == 0xc7)
+
+#define ENDS_BLOCK_ENTRY(opCode, handler, length, cycles) INSTRUCTION_ENDS_BLOCK(opCode),
+
+const InstructionHandler instruction_handlers[256] = { INSTRUCTION_TABLE(HANDLER_ENTRY) };
+const unsigned char instruction_lengths[256] = { INSTRUCTION_TABLE(LENGTH_ENTRY) };
+const unsigned char instruction_cycles[256] = { INSTRUCTION_TABLE(CYCLES_ENTRY) };
+const BOOL instruction_ends_block[256] = { INSTRUCTION_TABLE(ENDS_BLOCK_ENTRY) };
+const char* const instruction_names[256] = { INSTRUCTION_TABLE(NAME_ENTRY) };
+
+// Reads only the operand bytes the instruction has, fetching past it could trigger an MMIO read
+static uint16_t fetch_operand_slow(RAM* ramGateway, uint16_t address, unsigned char length)
+{
+    uint16_t operand = 0;
+
+    if (length > 1)
+    {
+        operand = read_byte(ramGateway, (uint16_t) (address + 1));
+    }
+    if (length > 2)
+    {
+        operand |= (uint16_t) (read_byte(ramGateway, (uint16_t) (address + 2)) << 8);
+    }
+
+    return operand;
+}
+
+// Reads the opcode at PC together with the two bytes following it, moves PC past the instruction and charges its T-states.
+// Inside a directly readable page the operand is read unconditionally, handlers only use the bytes they need
+static inline unsigned char fetch_instruction(CPU* cpu, RAM* ramGateway, uint16_t* operand)
+{
+    uint16_t address = cpu->programCounter.data;
+    unsigned char opCode;
+
+    if (ramGateway->readPages[address / RAM_PAGE_SIZE] != NULL && address % RAM_PAGE_SIZE < RAM_PAGE_SIZE - 2)
+    {
+        opCode = ramGateway->memory[address];
+        *operand = (uint16_t) (ramGateway->memory[address + 1] | (ramGateway->memory[address + 2] << 8));
+    }
+    else
+    {
+        opCode = read_byte(ramGateway, address);
+        *operand = fetch_operand_slow(ramGateway, address, instruction_lengths[opCode]);
+    }
+
+    cpu->programCounter.data = (uint16_t) (address + instruction_lengths[opCode]);
+    cpu->cycles += instruction_cycles[opCode];
+
+    return opCode;
+}
+
+// Interrupt acknowledge.
+// The device supplies an RST opcode, which runs like a fetched one but leaves PC at the interrupted instruction.
+// Returns TRUE when the interrupt was taken
+static BOOL accept_interrupt(CPU* cpu, RAM* ramGateway)
+{
+    if (!cpu->interruptsEnabled || cpu->cycles == cpu->interruptEnableCycle)
+    {
+        return FALSE;
+    }
+
+    int64_t request = atomic_exchange_64(&cpu->interruptRequest, 0);
+    if (request == 0)
+    {
+        return FALSE;
+    }
+
+    unsigned char opCode = (unsigned char) request;
+
+    if (cpu->inputLog != NULL)
+    {
+        input_log_interrupt(cpu->inputLog, cpu, opCode);
+    }
+
+    cpu->interruptsEnabled = FALSE;
+    cpu->halted = FALSE;
+    cpu->cycles += instruction_cycles[opCode];
+
+    instruction_handlers[opCode](cpu, ramGateway, 0);
+    return TRUE;
+}
+
+void cpu_raise_interrupt(CPU* cpu, unsigned char vector)
+{
+    if (cpu->inputLog != NULL && cpu->inputLog->replaying)
+    {
+        return;
+    }
+
+    atomic_store_64(&cpu->interruptRequest, CPU_INTERRUPT_REQUEST | 0xC7 | ((vector & 7) << 3));
+}
+
+// Dispatch cores.
+// All of them share the handlers above, so they only differ in the way control reaches a handler.
+// A core stops after HLT or once the cycle counter reaches cycleLimit. Both, and the interrupt line, are only checked
+// after an instruction that ends a basic block, so straight-line code runs without any test and the budget may be
+// overrun by one block
+
+static inline BOOL can_continue(CPU* cpu, RAM* ramGateway, uint64_t cycleLimit)
+{
+    // A single load of the line while no device requests anything
+    if (cpu->interruptRequest != 0)
+    {
+        accept_interrupt(cpu, ramGateway);
+    }
+
+    return !cpu->halted && cpu->cycles < cycleLimit;
+}
+
+// can_continue for the profiling core, which has to know whether an interrupt was taken.
+// PC can not tell, the vector may be the address the core stood at
+static inline BOOL can_continue_profiled(CPU* cpu, RAM* ramGateway, uint64_t cycleLimit, BOOL* interrupted)
+{
+    *interrupted = cpu->interruptRequest != 0 && accept_interrupt(cpu, ramGateway);
+
+    return !cpu->halted && cpu->cycles < cycleLimit;
+}
+
+static void run_switch_core(CPU* cpu, RAM* ramGateway, uint64_t cycleLimit)
+{
+    while (can_continue(cpu, ramGateway, cycleLimit))
+    {
+        for (;;)
+        {
+            uint16_t operand;
+            unsigned char opCode = fetch_instruction(cpu, ramGateway, &operand);
+
+            #define SWITCH_CASE(code, handler, length, cycles) \
+                case code: \
+                    handler(cpu, ramGateway, operand); \
+                    if (!INSTRUCTION_ENDS_BLOCK(code)) \
+                    { \
+                        continue; \
+                    } \
+                    break;
+
+            switch (opCode)
             {
-                uint16_t targetAddress = (uint16_t) (cpu.H_Register.data << 8) | cpu.L_Register.data;
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.E_Register.data);
+                INSTRUCTION_TABLE(SWITCH_CASE)
+            }
+
+            #undef SWITCH_CASE
+
+            break;
+        }
+    }
+}
+
+static void run_table_core(CPU* cpu, RAM* ramGateway, uint64_t cycleLimit)
+{
+    while (can_continue(cpu, ramGateway, cycleLimit))
+    {
+        unsigned char opCode;
+
+        do
+        {
+            uint16_t operand;
+            opCode = fetch_instruction(cpu, ramGateway, &operand);
+
+            instruction_handlers[opCode](cpu, ramGateway, operand);
+        } while (!instruction_ends_block[opCode]);
+    }
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_HAS_THREADED_CORE 1
+#else
+#define CPU_HAS_THREADED_CORE 0
+#endif
+
+#if CPU_HAS_THREADED_CORE
+static void run_threaded_core(CPU* cpu, RAM* ramGateway, uint64_t cycleLimit)
+{
+    #define THREADED_LABEL(code, handler, length, cycles) &&label_##code,
+
+    static void* const labels[256] = { INSTRUCTION_TABLE(THREADED_LABEL) };
+
+    uint16_t operand;
+    unsigned char opCode;
+
+    // Every handler ends with its own copy of the dispatch, so the branch predictor sees one indirect jump per opcode
+    #define THREADED_DISPATCH() \
+        opCode = fetch_instruction(cpu, ramGateway, &operand); \
+        goto *labels[opCode];
+
+    #define THREADED_CHECKED_DISPATCH() \
+        if (!can_continue(cpu, ramGateway, cycleLimit)) \
+        { \
+            return; \
+        } \
+        THREADED_DISPATCH()
+
+    #define THREADED_HANDLER(code, handler, length, cycles) \
+        label_##code: \
+            handler(cpu, ramGateway, operand); \
+            if (INSTRUCTION_ENDS_BLOCK(code)) \
+            { \
+                THREADED_CHECKED_DISPATCH() \
+            } \
+            THREADED_DISPATCH()
+
+    THREADED_CHECKED_DISPATCH()
+
+    INSTRUCTION_TABLE(THREADED_HANDLER)
+
+    #undef THREADED_HANDLER
+    #undef THREADED_CHECKED_DISPATCH
+    #undef THREADED_DISPATCH
+    #undef THREADED_LABEL
+}
+#endif
+
+// Executes decoded blocks, the fetch and decode happen once per block instead of once per instruction
+static void run_cached_core(CPU* cpu, RAM* ramGateway, BlockCache* cache, uint64_t cycleLimit)
+{
+    while (can_continue(cpu, ramGateway, cycleLimit))
+    {
+        BasicBlock* block = lookup_basic_block(cache, cpu->programCounter.data);
+        if (block == NULL)
+        {
+            uint16_t operand;
+            unsigned char opCode = fetch_instruction(cpu, ramGateway, &operand);
+
+            instruction_handlers[opCode](cpu, ramGateway, operand);
+            continue;
+        }
+
+        // A guest write into the running block clears valid, the rest of it is decoded again from the current PC
+        for (int i = 0; i < block->instructionCount && block->valid; i++)
+        {
+            DecodedInstruction* instruction = &block->instructions[i];
+
+            cpu->programCounter.data = instruction->nextAddress;
+            cpu->cycles += instruction->cycles;
+            instruction->handler(cpu, ramGateway, instruction->operand);
+        }
+    }
+}
+
+// Runs translated blocks where available, cold code and untranslatable instructions go through the handlers
+static void run_jit_core(CPU* cpu, RAM* ramGateway, Jit* jit, uint64_t cycleLimit)
+{
+    while (can_continue(cpu, ramGateway, cycleLimit))
+    {
+        if (run_jit_block(jit, cpu, cycleLimit - cpu->cycles))
+        {
+            continue;
+        }
+
+        uint16_t operand;
+        unsigned char opCode = fetch_instruction(cpu, ramGateway, &operand);
+
+        instruction_handlers[opCode](cpu, ramGateway, operand);
+    }
+}
 
-                break;
+// The table core with counters around every instruction, only run while cpu->profile, cpu->callProfile or cpu->trace is set.
+// Host ticks are taken around the handler of about one instruction in PROFILE_SAMPLE_INTERVAL, the timestamps cost more than most handlers
+static void run_profiling_core(CPU* cpu, RAM* ramGateway, CpuProfile* profile, CallProfile* callProfile, TraceWriter* trace,
+    uint64_t cycleLimit)
+{
+    for (;;)
+    {
+        uint16_t interruptedAddress = cpu->programCounter.data;
+        BOOL interrupted;
+        BOOL running = can_continue_profiled(cpu, ramGateway, cycleLimit, &interrupted);
+
+        // The interrupt pushed the interrupted address like a call, recorded even when the budget ends right after it
+        if (interrupted)
+        {
+            if (trace != NULL)
+            {
+                trace_interrupt(trace, cpu, ramGateway, interruptedAddress);
             }
-            // MOV M, H
-            case 0x74:
+
+            if (callProfile != NULL)
             {
-                uint16_t targetAddress = (uint16_t) (cpu.H_Register.data << 8) | cpu.L_Register.data;
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.H_Register.data);
+                call_profile_enter(callProfile, cpu->programCounter.data, cpu->stackPointer.data, cpu->cycles);
+            }
+        }
+
+        if (!running)
+        {
+            break;
+        }
+
+        unsigned char opCode;
 
-                break;
+        do
+        {
+            uint16_t operand;
+            uint16_t address = cpu->programCounter.data;
+            uint16_t stackPointer = cpu->stackPointer.data;
+            opCode = fetch_instruction(cpu, ramGateway, &operand);
+
+            uint16_t writeAddress = 0;
+            int writeCount = trace != NULL ? trace_write_target(cpu, opCode, operand, &writeAddress) : 0;
+
+            if (profile == NULL)
+            {
+                instruction_handlers[opCode](cpu, ramGateway, operand);
             }
-            // MOV M, L
-            case 0x75:
+            else
             {
-                uint16_t targetAddress = (uint16_t) (cpu.H_Register.data << 8) | cpu.L_Register.data;
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.H_Register.data);
+                profile->instructions++;
+                profile->addressHits[address]++;
+                profile->opcodeCounts[opCode]++;
 
-                break;
+                if (!profile_take_sample(profile))
+                {
+                    instruction_handlers[opCode](cpu, ramGateway, operand);
+                }
+                else
+                {
+                    uint64_t begin = profile_ticks();
+                    instruction_handlers[opCode](cpu, ramGateway, operand);
+                    profile_add_sample(profile, opCode, profile_ticks() - begin);
+                }
             }
-            // HLT
-            // Halt mode
-            case 0x76:
-                break;
-            // MOV M, A
-            case 0x77:
-            {
-                uint16_t targetAddress = (uint16_t) (cpu.H_Register.data << 8) | cpu.L_Register.data;
-                write_memory_ram(ramGateway, targetAddress - 1, cpu.A_Register.data);
 
-                break;
+            if (trace != NULL)
+            {
+                trace_instruction(trace, cpu, ramGateway, address, opCode, writeCount, writeAddress);
             }
-            // MOV A, B
-            case 0x78:
-                cpu.A_Register.data = cpu.B_Register.data;
-                break;
-            // MOV A, C
-            // Move content of register C to A
-            case 0x79:
-                cpu.A_Register.data = cpu.C_Register.data;
-                break;
-            // MOV A, D
-            // Move content of register D to A
-            case 0x7a:
-                cpu.A_Register.data = cpu.D_Register.data;
-                break;
-            // MOV A, E
-            // Move content of register E to A
-            case 0x7b:
-                cpu.A_Register.data = cpu.E_Register.data;
-                break;
-            // MOV A, H
-            // Move content of register H to A
-            case 0x7c:
-                cpu.A_Register.data = cpu.H_Register.data;
-                break;
-            // MOV A, L
-            // Move content of register L to A
-            case 0x7d:
-                cpu.A_Register.data = cpu.L_Register.data;
-                break;
-            // MOV A, M
-            case 0x7e:
+
+            if (callProfile == NULL)
             {
-                uint16_t targetAddress = (uint16_t) (cpu.H_Register.data << 8) | cpu.L_Register.data;
-                cpu.A_Register.data = read_memory_ram(ramGateway, targetAddress - 1);
+                continue;
+            }
 
-                break;
+            // A conditional call that is not taken leaves SP alone
+            if (CALL_PROFILE_IS_CALL(opCode) && cpu->stackPointer.data == (uint16_t) (stackPointer - 2))
+            {
+                call_profile_enter(callProfile, cpu->programCounter.data, cpu->stackPointer.data, cpu->cycles);
             }
-            // MOV A, A
-            case 0x7f:
-                break;
-            // ADD B
-            case 0x80:
+            else if (call_profile_frame_left(callProfile, cpu->stackPointer.data))
             {
-                unsigned char sum = cpu.A_Register.data + cpu.B_Register.data;
-
-                cpu.flagRegister.zeroFlag = (sum == 0);
-                cpu.flagRegister.signFlag = (sum < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(sum & 0xFF);
-                cpu.flagRegister.carryFlag = (sum > 0xFF);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(sum);
+                call_profile_leave(callProfile, cpu->stackPointer.data, cpu->cycles);
+            }
+        } while (!instruction_ends_block[opCode]);
+    }
 
-                cpu.A_Register.data = sum;
+    if (callProfile != NULL)
+    {
+        call_profile_flush(callProfile, cpu->cycles);
+    }
+}
 
-                break;
-            }
-            // ADD C
-            case 0x81:
-            {
-                unsigned char sum = cpu.A_Register.data + cpu.C_Register.data;
+// Instruction-counted execution for cpu_step and cpu_run.
+// Checks the count and the interrupt line before every instruction, so it always interprets instead of running whole blocks
+static uint64_t run_instructions(CPU* cpu, RAM* ramGateway, uint64_t instructionLimit)
+{
+    uint64_t executed = 0;
 
-                cpu.flagRegister.zeroFlag = (sum == 0);
-                cpu.flagRegister.signFlag = (sum < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(sum & 0xFF);
-                cpu.flagRegister.carryFlag = (sum > 0xFF);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(sum);
+    for (;;)
+    {
+        if (cpu->interruptRequest != 0)
+        {
+            accept_interrupt(cpu, ramGateway);
+        }
 
-                cpu.A_Register.data = sum;
+        if (cpu->halted || executed >= instructionLimit)
+        {
+            break;
+        }
 
-                break;
-            }
-            // ADD D
-            case 0x82:
-            {
-                unsigned char sum = cpu.A_Register.data + cpu.D_Register.data;
+        uint16_t operand;
+        unsigned char opCode = fetch_instruction(cpu, ramGateway, &operand);
 
-                cpu.flagRegister.zeroFlag = (sum == 0);
-                cpu.flagRegister.signFlag = (sum < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(sum & 0xFF);
-                cpu.flagRegister.carryFlag = (sum > 0xFF);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(sum);
+        instruction_handlers[opCode](cpu, ramGateway, operand);
+        executed++;
+    }
 
-                cpu.A_Register.data = sum;
+    return executed;
+}
 
-                break;
-            }
-            // ADD E
-            case 0x83:
-            {
-                unsigned char sum = cpu.A_Register.data + cpu.E_Register.data;
+// Translations of the cached and jit cores live as long as the CPU.
+// Both register themselves as the code write handler of the RAM, so a CPU holds at most one of them
+static void release_translations(CPU* cpu)
+{
+    if (cpu->blockCache != NULL)
+    {
+        free_block_cache(cpu->blockCache);
+        cpu->blockCache = NULL;
+    }
 
-                cpu.flagRegister.zeroFlag = (sum == 0);
-                cpu.flagRegister.signFlag = (sum < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(sum & 0xFF);
-                cpu.flagRegister.carryFlag = (sum > 0xFF);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(sum);
+    if (cpu->jit != NULL)
+    {
+        free_jit(cpu->jit);
+        cpu->jit = NULL;
+    }
+}
 
-                cpu.A_Register.data = sum;
+static BlockCache* prepare_block_cache(CPU* cpu, RAM* ramGateway)
+{
+    if (cpu->jit != NULL || (cpu->blockCache != NULL && cpu->blockCache->ram != ramGateway))
+    {
+        release_translations(cpu);
+    }
 
-                break;
-            }
-            // ADD H
-            case 0x84:
-            {
-                char sum = cpu.A_Register.data + cpu.H_Register.data;
+    if (cpu->blockCache == NULL)
+    {
+        cpu->blockCache = init_block_cache(ramGateway);
+    }
 
-                cpu.flagRegister.zeroFlag = (sum == 0);
-                cpu.flagRegister.signFlag = (sum < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(sum & 0xFF);
-                cpu.flagRegister.carryFlag = (sum > 0xFF);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(sum);
+    return cpu->blockCache;
+}
 
-                cpu.A_Register.data = sum;
+static Jit* prepare_jit(CPU* cpu, RAM* ramGateway)
+{
+    if (cpu->blockCache != NULL || (cpu->jit != NULL && cpu->jit->ram != ramGateway))
+    {
+        release_translations(cpu);
+    }
 
-                break;
-            }
-            // ADD L
-            case 0x85:
-            {
-                char sum = cpu.A_Register.data + cpu.L_Register.data;
+    if (cpu->jit == NULL)
+    {
+        cpu->jit = init_jit(ramGateway);
+    }
 
-                cpu.flagRegister.zeroFlag = (sum == 0);
-                cpu.flagRegister.signFlag = (sum < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(sum & 0xFF);
-                cpu.flagRegister.carryFlag = (sum > 0xFF);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(sum);
+    return cpu->jit;
+}
 
-                cpu.A_Register.data = sum;
+static void run_core(CPU* cpu, RAM* ramGateway, uint64_t cycleLimit)
+{
+    if (cpu->profile != NULL || cpu->callProfile != NULL || cpu->trace != NULL)
+    {
+        run_profiling_core(cpu, ramGateway, cpu->profile, cpu->callProfile, cpu->trace, cycleLimit);
+        return;
+    }
 
-                break;
+    switch (cpu->core)
+    {
+        case CPU_CORE_SWITCH:
+            run_switch_core(cpu, ramGateway, cycleLimit);
+            return;
+        case CPU_CORE_JIT:
+        {
+            Jit* jit = prepare_jit(cpu, ramGateway);
+            if (jit != NULL)
+            {
+                run_jit_core(cpu, ramGateway, jit, cycleLimit);
+                return;
             }
-            // ADD M
-            case 0x86:
+        }
+        // Without the recompiler the jit core behaves like the cached core
+        // fall through
+        case CPU_CORE_CACHED:
+        {
+            BlockCache* cache = prepare_block_cache(cpu, ramGateway);
+            if (cache != NULL)
             {
-                uint16_t targetAddress = (uint16_t)(cpu.H_Register.data << 8) | cpu.L_Register.data;
+                run_cached_core(cpu, ramGateway, cache, cycleLimit);
+                return;
+            }
 
-                char value = read_memory_ram(ramGateway, targetAddress - 1);
+            run_table_core(cpu, ramGateway, cycleLimit);
+            return;
+        }
+        case CPU_CORE_THREADED:
+#if CPU_HAS_THREADED_CORE
+            run_threaded_core(cpu, ramGateway, cycleLimit);
+            return;
+#endif
+        // Without computed goto the threaded core is the table core
+        // fall through
+        case CPU_CORE_TABLE:
+        default:
+            run_table_core(cpu, ramGateway, cycleLimit);
+            return;
+    }
+}
 
-                cpu.A_Register.data = cpu.A_Register.data + value;
+static CPU_ExitReason finish_run(CPU* cpu, CPU_ExitReason limitReason)
+{
+    // Callers read the flag byte directly
+    materialize_flags(cpu);
 
-                cpu.flagRegister.zeroFlag = (cpu.A_Register.data == 0);
-                cpu.flagRegister.signFlag = (cpu.A_Register.data < 0);
-                cpu.flagRegister.partyFlag = is_bits_even(cpu.A_Register.data & 0xFF);
-                cpu.flagRegister.carryFlag = (cpu.A_Register.data > 0xFF);
-                cpu.flagRegister.auxiliaryCarry = is_auxiliary_carry_set(cpu.A_Register.data);
+    if (cpu->halted)
+    {
+        io_bus_sync(cpu->bus);
+    }
 
-                break;
-            }
-            // ADD A
-            case 0x87:
-                break;
-            // OUT D8
-            case 0xd3:
-            {
-                cpu.programCounter.data++;
-                char port = read_memory_ram(ramGateway, cpu.programCounter.data);
+    return cpu->halted ? CPU_EXIT_HALTED : limitReason;
+}
 
-                if (port == STANDART_OUTPUT_PORT)
-                {
-                    standart_output(cpu.A_Register.data);
-                }
+const char* cpu_core_name(CPU_Core core)
+{
+    switch (core)
+    {
+        case CPU_CORE_SWITCH:
+            return "switch";
+        case CPU_CORE_TABLE:
+            return "table";
+        case CPU_CORE_THREADED:
+            return "threaded";
+        case CPU_CORE_CACHED:
+            return "cached";
+        case CPU_CORE_JIT:
+            return "jit";
+        default:
+            return "unknown";
+    }
+}
 
-                break;
-            }
+BOOL parse_cpu_core(const char* name, CPU_Core* core)
+{
+    for (int i = 0; i < CPU_CORE_COUNT; i++)
+    {
+        if (strcmp(name, cpu_core_name((CPU_Core) i)) == 0)
+        {
+            *core = (CPU_Core) i;
+            return TRUE;
         }
+    }
 
-        cpu.programCounter.data++;
+    return FALSE;
+}
+
+const char* cpu_exit_reason_name(CPU_ExitReason reason)
+{
+    switch (reason)
+    {
+        case CPU_EXIT_HALTED:
+            return "halted";
+        case CPU_EXIT_INSTRUCTION_LIMIT:
+            return "instruction limit";
+        case CPU_EXIT_CYCLE_BUDGET:
+            return "cycle budget";
+        default:
+            return "unknown";
     }
 }
+
+CPU_ExitReason cpu_step(CPU* cpu, RAM* ramGateway)
+{
+    run_instructions(cpu, ramGateway, 1);
+
+    return finish_run(cpu, CPU_EXIT_INSTRUCTION_LIMIT);
+}
+
+CPU_ExitReason cpu_run(CPU* cpu, RAM* ramGateway, uint64_t instructionCount)
+{
+    run_instructions(cpu, ramGateway, instructionCount);
+
+    return finish_run(cpu, CPU_EXIT_INSTRUCTION_LIMIT);
+}
+
+CPU_ExitReason cpu_run_until_halt(CPU* cpu, RAM* ramGateway)
+{
+    run_core(cpu, ramGateway, UINT64_MAX);
+
+    return finish_run(cpu, CPU_EXIT_CYCLE_BUDGET);
+}
+
+CPU_ExitReason cpu_run_cycles(CPU* cpu, RAM* ramGateway, uint64_t cycleBudget)
+{
+    uint64_t cycleLimit = cpu->cycles + cycleBudget;
+
+    // Saturates instead of wrapping around for huge budgets
+    if (cycleLimit < cpu->cycles)
+    {
+        cycleLimit = UINT64_MAX;
+    }
+
+    run_core(cpu, ramGateway, cycleLimit);
+
+    return finish_run(cpu, CPU_EXIT_CYCLE_BUDGET);
+}
+
+void free_cpu(CPU* cpu)
+{
+    release_translations(cpu);
+}
@@ -1,33 +1,182 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "../Memory/Register.h"
 #include "../Memory/RAM.h"
 #include "../Tools/BitOperation.h"
-#include "../IO/StandartOutput.h"
+#include "../IO/IoBus.h"
 
-struct CPU
+// Lazy flag evaluation. Flag-setting instructions only record their result,
+// zero, sign, parity and auxiliary carry are computed when a conditional instruction, DAA or pack_flags reads them
+#ifndef CPU_LAZY_FLAGS
+#define CPU_LAZY_FLAGS 0
+#endif
+
+// The register pairs alias their 8-bit halves, the low register has to come first in memory
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The packed register file requires a little-endian host"
+#endif
+
+// The registers, the flags, the interrupt enable state, the cycle counter, the bus and the core fill the first cache line.
+// The per-run pointers follow in the second, the interrupt line other threads write has the third to itself
+#define CPU_CACHE_LINE_SIZE 64
+
+#if defined(_MSC_VER)
+#define CPU_CACHE_LINE_ALIGNED __declspec(align(64))
+#else
+#define CPU_CACHE_LINE_ALIGNED __attribute__((aligned(64)))
+#endif
+
+// Instruction dispatch strategy of the interpreter loop
+enum CPU_Core
+{
+	// A single switch over the opcode byte. The default, the fastest of the interpreting cores in --benchmark
+	CPU_CORE_SWITCH,
+	// An indirect call through the 256-entry handler table
+	CPU_CORE_TABLE,
+	// Computed goto with the dispatch replicated after every handler.
+	// Falls back to the table core on compilers without the "labels as values" extension
+	CPU_CORE_THREADED,
+	// Runs pre-decoded basic blocks from the block cache, see BlockCache.h
+	CPU_CORE_CACHED,
+	// Translates hot blocks to x86-64 machine code and interprets the rest, see Jit.h.
+	// Falls back to the cached core where the recompiler is not available
+	CPU_CORE_JIT,
+
+	CPU_CORE_COUNT
+} typedef CPU_Core;
+
+// Marks a raised interrupt line, the low byte holds the RST opcode
+#define CPU_INTERRUPT_REQUEST 0x100
+
+// Why a cpu_step / cpu_run call returned
+enum CPU_ExitReason
 {
-	// General-Purpose Registers
-	Register8Bit A_Register;
-	Register8Bit B_Register;
-	Register8Bit C_Register;
-	Register8Bit D_Register;
-	Register8Bit E_Register;
+	// The processor executed HLT
+	CPU_EXIT_HALTED,
+	// The requested number of instructions has been executed
+	CPU_EXIT_INSTRUCTION_LIMIT,
+	// The cycle budget is used up
+	CPU_EXIT_CYCLE_BUDGET
+} typedef CPU_ExitReason;
 
-	// General-Purpose Registers and Latched Address Register (HL)
-	Register8Bit H_Register;
-	Register8Bit L_Register;
+struct CPU_CACHE_LINE_ALIGNED CPU
+{
+	// General-Purpose Register pairs.
+	// Each pair shares its storage with its two registers, so LXI, INX, DAD and the memory accesses through a pair
+	// read or write it at once. HL is also the Latched Address Register of the M operand
+	union { uint16_t BC; struct { uint8_t C; uint8_t B; }; };
+	union { uint16_t DE; struct { uint8_t E; uint8_t D; }; };
+	union { uint16_t HL; struct { uint8_t L; uint8_t H; }; };
+
+	// Processor Status Word: the accumulator and the flag byte (S Z 0 AC 0 P 1 CY, see Flags.h), as PUSH PSW stores them
+	union { uint16_t PSW; struct { uint8_t flags; uint8_t A; }; };
 
 	// Pointer and Index Registers
 	Register16Bit stackPointer;
 	Register16Bit programCounter;
 
-	// Flag register
-	FlagRegister flagRegister;
+#if CPU_LAZY_FLAGS
+	// Last flag-setting result, see set_result_flags. While flagsPending is set only the carry in flags is current
+	unsigned char lazyResult;
+	unsigned char lazyAuxiliary;
+	BOOL flagsPending;
+#endif
+
+	// Interrupt enable flip-flop (EI / DI)
+	BOOL interruptsEnabled;
+
+	// Set by HLT, the interpreter loop stops at the next instruction boundary
+	BOOL halted;
+
+	// T-states executed since init_cpu
+	uint64_t cycles;
+
+	// Cycle counter right after the last EI. While it still matches, the instruction following EI has not run
+	// and no interrupt is accepted yet
+	uint64_t interruptEnableCycle;
+
+	// Devices behind IN and OUT, synced when the CPU halts. init_cpu starts with standart_io_bus
+	const IoBus* bus;
+
+	// Dispatch strategy of the cpu_run functions
+	CPU_Core core;
+
+	// Translations of the cached and jit cores, kept between runs and released by free_cpu.
+	// Only read when a run starts, they open the second cache line
+	CPU_CACHE_LINE_ALIGNED struct BlockCache* blockCache;
+	struct Jit* jit;
+
+	// While set, cpu_run_until_halt and cpu_run_cycles run the profiling core instead of cpu->core, see Profiler.h.
+	// The profiling core is a separate loop, the other cores carry no profiling code at all
+	struct CpuProfile* profile;
+	// Shadow call stack, runs the profiling core as well, see CallProfiler.h
+	struct CallProfile* callProfile;
+	// Per-instruction trace file, runs the profiling core as well, see Trace.h
+	struct TraceWriter* trace;
+
+	// Records or replays IN and the accepted interrupts, see InputLog.h. The cores only look at it when they accept an interrupt
+	struct InputLog* inputLog;
+
+	// Interrupt line, CPU_INTERRUPT_REQUEST with the RST opcode the device puts on the data bus, 0 when idle.
+	// Written by any thread through cpu_raise_interrupt, the cores only test it at block boundaries.
+	// A request stays latched until the CPU accepts it with interrupts enabled.
+	// Alone in the last cache line, so a device thread raising it does not take the registers away from the CPU thread
+	CPU_CACHE_LINE_ALIGNED volatile int64_t interruptRequest;
 } typedef CPU;
 
+// Everything an instruction touches shares the first cache line
+_Static_assert(offsetof(CPU, core) + sizeof(CPU_Core) <= CPU_CACHE_LINE_SIZE, "The hot CPU state has to fit in the first cache line");
+_Static_assert(offsetof(CPU, cycles) + sizeof(uint64_t) <= CPU_CACHE_LINE_SIZE, "The cycle counter has to be in the first cache line");
+_Static_assert(offsetof(CPU, blockCache) == CPU_CACHE_LINE_SIZE, "The per-run state has to start the second cache line");
+_Static_assert(offsetof(CPU, interruptRequest) + CPU_CACHE_LINE_SIZE == sizeof(CPU),
+	"The interrupt line has to be alone in the last cache line");
+
+// Handler of a single opcode.
+// The PC already points past the instruction, the operand holds the (up to two) bytes that followed the opcode
+typedef void (*InstructionHandler)(CPU* cpu, RAM* ramGateway, uint16_t operand);
+
+extern const InstructionHandler instruction_handlers[256];
+
+// Instruction length in bytes, including the opcode
+extern const unsigned char instruction_lengths[256];
+
+// Duration in T-states. A taken conditional call or return takes 6 more, the handler adds them
+extern const unsigned char instruction_cycles[256];
+
+// Handler name without the op_ prefix, the lower case mnemonic with its operands joined by underscores
+extern const char* const instruction_names[256];
+
+// TRUE for the instructions that leave the straight-line path: jumps, calls, returns, RST, PCHL and HLT
+extern const BOOL instruction_ends_block[256];
+
 CPU init_cpu();
 
-void execute_cpu(CPU cpu, RAM* ramGateway);
\ No newline at end of file
+// Flag register in the Processor Status Word layout (S Z 0 AC 0 P 1 CY), as PUSH PSW stores it
+unsigned char pack_flags(CPU* cpu);
+void unpack_flags(CPU* cpu, unsigned char flags);
+
+const char* cpu_core_name(CPU_Core core);
+BOOL parse_cpu_core(const char* name, CPU_Core* core);
+
+const char* cpu_exit_reason_name(CPU_ExitReason reason);
+
+// Execution API. Every call continues from the current state and can be repeated, a halted CPU returns CPU_EXIT_HALTED at once.
+// cpu_step and cpu_run count single instructions and always interpret them
+CPU_ExitReason cpu_step(CPU* cpu, RAM* ramGateway);
+CPU_ExitReason cpu_run(CPU* cpu, RAM* ramGateway, uint64_t instructionCount);
+// The core selected in cpu->core runs these two and only checks for the end after a jump, call, return or HLT
+CPU_ExitReason cpu_run_until_halt(CPU* cpu, RAM* ramGateway);
+// Runs until at least cycleBudget T-states have passed, finishing the basic block that crosses the budget
+CPU_ExitReason cpu_run_cycles(CPU* cpu, RAM* ramGateway, uint64_t cycleBudget);
+
+// Requests the interrupt RST vector (0 to 7). Safe to call from any thread while the CPU runs.
+// The request is accepted at the next block boundary where interrupts are enabled: it clears the enable flip-flop,
+// resumes a halted CPU and calls vector * 8 like the RST instruction. A newer request replaces one not yet accepted.
+// Ignored while cpu->inputLog replays, the log raises the interrupts of the recording instead
+void cpu_raise_interrupt(CPU* cpu, unsigned char vector);
+
+// Releases the translation caches, the CPU can still run afterwards
+void free_cpu(CPU* cpu);
\ No newline at end of file
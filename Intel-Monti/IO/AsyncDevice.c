@@ -0,0 +1,321 @@
+#include <string.h>
+#include <time.h>
+
+#include "AsyncDevice.h"
+
+// Idle rounds of the device thread before it yields, and before it sleeps
+#define ASYNC_SPIN_ROUNDS 64
+#define ASYNC_YIELD_ROUNDS 256
+#define ASYNC_IDLE_SLEEP_MICROSECONDS 100
+// Rounds the CPU thread yields in a stall before it sleeps on the progress event
+#define ASYNC_STALL_SPIN_ROUNDS 64
+
+static double wall_seconds()
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+
+    return (double) now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Backs off the longer nothing happens, the first rounds stay hot for bursts
+static void wait_idle(unsigned int round)
+{
+    if (round < ASYNC_SPIN_ROUNDS)
+    {
+        return;
+    }
+
+    if (round < ASYNC_YIELD_ROUNDS)
+    {
+        thread_yield();
+        return;
+    }
+
+    thread_sleep_microseconds(ASYNC_IDLE_SLEEP_MICROSECONDS);
+}
+
+// One round of a CPU thread stall, the caller checks what it waits for in between.
+// After the spin it alternates between setting cpuWaiting and sleeping, so progress the device thread made
+// before it could see the flag is found by the next check instead of being slept through
+static void wait_for_device(AsyncDevice* device, unsigned int round)
+{
+    if (round < ASYNC_STALL_SPIN_ROUNDS)
+    {
+        thread_yield();
+    }
+    else if ((round - ASYNC_STALL_SPIN_ROUNDS) % 2 == 0)
+    {
+        atomic_store_64(&device->cpuWaiting, 1);
+    }
+    else
+    {
+        thread_event_wait(device->progress);
+    }
+}
+
+// The device thread's side, only a CPU thread that announced itself costs a signal
+static void report_progress(AsyncDevice* device)
+{
+    if (atomic_exchange_64(&device->cpuWaiting, 0) != 0)
+    {
+        thread_event_signal(device->progress);
+    }
+}
+
+// Hands every queued byte to the device, returns TRUE when there were any
+static BOOL drain_output(AsyncDevice* device)
+{
+    BOOL worked = FALSE;
+    const unsigned char* data;
+    size_t size;
+
+    while ((size = spsc_ring_peek(&device->output, &data)) != 0)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            device->device.write(device->device.context, device->port, data[i]);
+        }
+
+        spsc_ring_consume(&device->output, size);
+        worked = TRUE;
+    }
+
+    return worked;
+}
+
+static int device_thread_main(void* argument)
+{
+    AsyncDevice* device = (AsyncDevice*) argument;
+    unsigned int idleRounds = 0;
+
+    for (;;)
+    {
+        // Read before draining, so every byte queued ahead of a request is written before the sync or the read
+        int64_t syncRequested = atomic_load_acquire_64(&device->syncRequested);
+        int64_t inputRequested = atomic_load_acquire_64(&device->inputRequested);
+        BOOL stop = atomic_load_acquire_64(&device->stopRequested) != 0;
+
+        BOOL worked = drain_output(device);
+
+        if (worked)
+        {
+            report_progress(device);
+        }
+
+        if (device->hasInput && !stop)
+        {
+            // A stream is read ahead up to its limit, a slow device read only holds up this thread
+            while (spsc_ring_size(&device->input) < device->readAhead)
+            {
+                spsc_ring_push(&device->input, device->device.read(device->device.context, device->port));
+                report_progress(device);
+                worked = TRUE;
+            }
+
+            // A waiting IN gets one byte, read after every OUT queued ahead of it
+            if (inputRequested != device->inputServed)
+            {
+                if (spsc_ring_size(&device->input) == 0)
+                {
+                    spsc_ring_push(&device->input, device->device.read(device->device.context, device->port));
+                }
+
+                device->inputServed = inputRequested;
+                report_progress(device);
+                worked = TRUE;
+            }
+        }
+
+        if (syncRequested != device->syncCompleted)
+        {
+            if (device->device.sync != NULL)
+            {
+                device->device.sync(device->device.context);
+            }
+
+            atomic_store_release_64(&device->syncCompleted, syncRequested);
+            report_progress(device);
+            worked = TRUE;
+        }
+
+        if (stop)
+        {
+            break;
+        }
+
+        idleRounds = worked ? 0 : idleRounds + 1;
+        wait_idle(idleRounds);
+    }
+
+    return 0;
+}
+
+static void write_async_port(void* context, unsigned char port, unsigned char value)
+{
+    AsyncDevice* device = (AsyncDevice*) context;
+
+    if (spsc_ring_push(&device->output, value))
+    {
+        device->bytesQueued++;
+        return;
+    }
+
+    device->fullEvents++;
+
+    if (device->policy == ASYNC_OVERFLOW_DROP)
+    {
+        device->bytesDropped++;
+        return;
+    }
+
+    double begin = wall_seconds();
+
+    for (unsigned int round = 0; !spsc_ring_push(&device->output, value); round++)
+    {
+        wait_for_device(device, round);
+    }
+
+    device->stallSeconds += wall_seconds() - begin;
+    device->bytesQueued++;
+}
+
+static unsigned char read_async_port(void* context, unsigned char port)
+{
+    AsyncDevice* device = (AsyncDevice*) context;
+    unsigned char value;
+
+    if (spsc_ring_pop(&device->input, &value))
+    {
+        return value;
+    }
+
+    device->inputUnderruns++;
+
+    if (device->readAhead != 0 && device->underrunPolicy == ASYNC_UNDERRUN_UNMAPPED)
+    {
+        return IO_UNMAPPED_VALUE;
+    }
+
+    double begin = wall_seconds();
+
+    atomic_store_release_64(&device->inputRequested, device->inputRequested + 1);
+
+    for (unsigned int round = 0; !spsc_ring_pop(&device->input, &value); round++)
+    {
+        wait_for_device(device, round);
+    }
+
+    device->stallSeconds += wall_seconds() - begin;
+
+    return value;
+}
+
+static void sync_async_port(void* context)
+{
+    AsyncDevice* device = (AsyncDevice*) context;
+    int64_t request = device->syncRequested + 1;
+
+    double begin = wall_seconds();
+
+    atomic_store_release_64(&device->syncRequested, request);
+
+    for (unsigned int round = 0; atomic_load_acquire_64(&device->syncCompleted) != request; round++)
+    {
+        wait_for_device(device, round);
+    }
+
+    device->stallSeconds += wall_seconds() - begin;
+}
+
+static void free_device(AsyncDevice* device)
+{
+    free_spsc_ring(&device->output);
+    free_spsc_ring(&device->input);
+
+    if (device->progress != NULL)
+    {
+        free_thread_event(device->progress);
+    }
+
+    free(device);
+}
+
+AsyncDevice* attach_async_device(IoBus* bus, unsigned char port, AsyncOverflowPolicy policy, size_t readAhead,
+    AsyncUnderrunPolicy underrunPolicy)
+{
+    AsyncDevice* device = (AsyncDevice*) calloc(1, sizeof(AsyncDevice));
+    if (device == NULL)
+    {
+        return NULL;
+    }
+
+    device->bus = bus;
+    device->port = port;
+    device->policy = policy;
+    device->device = bus->ports[port];
+    // A port without a reading device is never read
+    device->hasInput = io_bus_port_readable(bus, port);
+    device->readAhead = readAhead < ASYNC_RING_SIZE ? readAhead : ASYNC_RING_SIZE;
+    device->underrunPolicy = underrunPolicy;
+
+    // Room for the bytes read ahead, or the single byte of a request
+    size_t inputCapacity = 1;
+    while (inputCapacity < device->readAhead)
+    {
+        inputCapacity <<= 1;
+    }
+
+    device->progress = init_thread_event();
+
+    if (device->progress == NULL
+        || !init_spsc_ring(&device->output, ASYNC_RING_SIZE) || !init_spsc_ring(&device->input, inputCapacity))
+    {
+        free_device(device);
+        return NULL;
+    }
+
+    device->thread = thread_start(device_thread_main, device);
+    if (device->thread == NULL)
+    {
+        free_device(device);
+        return NULL;
+    }
+
+    io_bus_connect(bus, port,
+        device->hasInput ? read_async_port : NULL,
+        write_async_port,
+        sync_async_port,
+        device);
+
+    return device;
+}
+
+void detach_async_device(AsyncDevice* device)
+{
+    // The thread drains the output ring once more before it leaves
+    atomic_store_release_64(&device->stopRequested, 1);
+    thread_join(device->thread);
+
+    IoPort* original = &device->device;
+    io_bus_connect(device->bus, device->port, original->read, original->write, original->sync, original->context);
+
+    free_device(device);
+}
+
+BOOL parse_async_overflow_policy(const char* name, AsyncOverflowPolicy* policy)
+{
+    if (strcmp(name, "block") == 0)
+    {
+        *policy = ASYNC_OVERFLOW_BLOCK;
+        return TRUE;
+    }
+
+    if (strcmp(name, "drop") == 0)
+    {
+        *policy = ASYNC_OVERFLOW_DROP;
+        return TRUE;
+    }
+
+    return FALSE;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "IoBus.h"
+#include "../Tools/SpscRing.h"
+
+// Bytes queued in each direction between the CPU thread and the device thread
+#define ASYNC_RING_SIZE (1024 * 1024)
+
+// What OUT does when the device thread has fallen a whole ring behind
+enum AsyncOverflowPolicy
+{
+	// Waits for room, nothing is lost. The wait shows up in stallSeconds
+	ASYNC_OVERFLOW_BLOCK,
+	// Drops the byte and counts it in bytesDropped, the guest never waits
+	ASYNC_OVERFLOW_DROP
+} typedef AsyncOverflowPolicy;
+
+// What IN does when a stream device has no byte read ahead
+enum AsyncUnderrunPolicy
+{
+	// Waits until the device thread has read the byte. The wait shows up in stallSeconds
+	ASYNC_UNDERRUN_BLOCK,
+	// Returns IO_UNMAPPED_VALUE and counts it in inputUnderruns, the guest never waits
+	ASYNC_UNDERRUN_UNMAPPED
+} typedef AsyncUnderrunPolicy;
+
+// Moves the device of one port onto its own host thread.
+// OUT queues the byte for the device thread. IN asks the device thread for a byte and waits for it, so the device
+// is read exactly as often as the guest executes IN and sees the OUTs before it. Stream devices, whose bytes
+// do not depend on when they are read, may let the thread read up to readAhead bytes in advance instead.
+// The device handlers are only ever called on the device thread
+struct AsyncDevice
+{
+	IoBus* bus;
+	unsigned char port;
+	AsyncOverflowPolicy policy;
+
+	// The handlers that were connected to the port
+	IoPort device;
+	BOOL hasInput;
+	// Bytes the thread reads before IN asks for them, 0 for a device read on demand
+	size_t readAhead;
+	AsyncUnderrunPolicy underrunPolicy;
+
+	// CPU thread to device thread and back
+	SpscRing output;
+	SpscRing input;
+
+	Thread* thread;
+	THREAD_CACHE_LINE_ALIGNED volatile int64_t stopRequested;
+	// A sync is done when syncCompleted catches up with syncRequested
+	volatile int64_t syncRequested;
+	volatile int64_t syncCompleted;
+	// Bumped by an IN that found no byte and waits for one. The thread reads a byte for it unless one is queued already
+	volatile int64_t inputRequested;
+	int64_t inputServed;
+	// A CPU thread that waited longer than a short spin sleeps here. It sets cpuWaiting first, the device thread
+	// then signals after it took output, finished a sync or pushed an input byte
+	ThreadEvent* progress;
+	volatile int64_t cpuWaiting;
+
+	// Back-pressure counters, kept by the CPU thread
+	THREAD_CACHE_LINE_ALIGNED uint64_t bytesQueued;
+	uint64_t bytesDropped;
+	// OUTs that found the ring full, and the time the CPU thread waited for room, for a sync or for an input byte
+	uint64_t fullEvents;
+	double stallSeconds;
+	// INs that found no byte read ahead. Every IN of an on-demand device counts
+	uint64_t inputUnderruns;
+} typedef AsyncDevice;
+
+// Replaces the handlers of the port with queues to a new device thread running the old ones.
+// readAhead is 0 for devices read on demand, at most ASYNC_RING_SIZE for streams. The underrun policy only applies
+// to streams, an IN on demand always waits for its byte.
+// Returns NULL when the rings or the thread can not be created, the port then stays synchronous
+AsyncDevice* attach_async_device(IoBus* bus, unsigned char port, AsyncOverflowPolicy policy, size_t readAhead,
+	AsyncUnderrunPolicy underrunPolicy);
+
+// Waits until the device thread has handled every queued byte, stops it and reconnects the original handlers
+void detach_async_device(AsyncDevice* device);
+
+// Accepts block and drop
+BOOL parse_async_overflow_policy(const char* name, AsyncOverflowPolicy* policy);
\ No newline at end of file
@@ -0,0 +1,541 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "InputLog.h"
+#include "../Tools/File.h"
+#include "../Tools/Thread.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+static BOOL port_logged(const InputLog* log, unsigned char port)
+{
+    return (log->portMask[port / 8] & (1 << (port % 8))) != 0;
+}
+
+static void diverge(InputLog* log, uint64_t cycle)
+{
+    if (log->divergences == 0)
+    {
+        log->firstDivergenceCycle = cycle;
+    }
+
+    log->divergences++;
+}
+
+// Registers, interrupt enable flip-flop and FNV-1a of the whole address space, as the end entry stores them
+static void encode_final_state(CPU* cpu, const RAM* ramGateway, uint8_t* state)
+{
+    uint16_t registers[6] =
+    {
+        cpu->BC, cpu->DE, cpu->HL,
+        (uint16_t) ((cpu->A << 8) | pack_flags(cpu)),
+        cpu->stackPointer.data, cpu->programCounter.data
+    };
+
+    for (int i = 0; i < 6; i++)
+    {
+        state[i * 2] = (uint8_t) registers[i];
+        state[i * 2 + 1] = (uint8_t) (registers[i] >> 8);
+    }
+
+    state[12] = cpu->interruptsEnabled ? 1 : 0;
+
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for (int address = 0; address < RAM_MEMORY_SIZE; address++)
+    {
+        hash = (hash ^ ramGateway->memory[address]) * FNV_PRIME;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        state[13 + i] = (uint8_t) (hash >> (i * 8));
+    }
+}
+
+// Recording
+
+static uint8_t* write_varint(uint8_t* output, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *output++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    *output++ = (uint8_t) value;
+    return output;
+}
+
+static void write_buffer(InputLog* log)
+{
+    if (log->used != 0 && fwrite(log->buffer, 1, log->used, log->file) != log->used)
+    {
+        log->failed = TRUE;
+    }
+
+    log->bytes += log->used;
+    log->used = 0;
+}
+
+// Starts an entry of the kind, the gap is taken from the cycle of the previous one
+static uint8_t* begin_entry(InputLog* log, InputLogKind kind, uint64_t cycle)
+{
+    if (log->used + INPUT_LOG_MAX_ENTRY_SIZE > INPUT_LOG_BUFFER_SIZE)
+    {
+        write_buffer(log);
+    }
+
+    uint8_t* output = write_varint(log->buffer + log->used, ((cycle - log->cycle) << 2) | kind);
+
+    log->cycle = cycle;
+    log->entries++;
+
+    return output;
+}
+
+static void end_entry(InputLog* log, const uint8_t* output)
+{
+    log->used = (size_t) (output - log->buffer);
+}
+
+static void write_repeats(InputLog* log)
+{
+    if (log->repeats == 0)
+    {
+        return;
+    }
+
+    if (log->used + INPUT_LOG_MAX_ENTRY_SIZE > INPUT_LOG_BUFFER_SIZE)
+    {
+        write_buffer(log);
+    }
+
+    end_entry(log, write_varint(log->buffer + log->used, (log->repeats << 2) | INPUT_LOG_REPEAT));
+
+    log->entries++;
+    log->repeats = 0;
+}
+
+static void record_input(InputLog* log, unsigned char port, unsigned char value)
+{
+    uint64_t cycle = log->cpu->cycles;
+    uint64_t gap = cycle - log->cycle;
+
+    log->inputs++;
+
+    // Only counted, the entry of the first one stands for all of them
+    if (log->repeatable && gap == log->lastGap && port == log->lastPort && value == log->lastValue)
+    {
+        log->repeats++;
+        log->cycle = cycle;
+        return;
+    }
+
+    write_repeats(log);
+
+    uint8_t* output = begin_entry(log, INPUT_LOG_IN, cycle);
+    *output++ = port;
+    *output++ = value;
+    end_entry(log, output);
+
+    log->repeatable = TRUE;
+    log->lastGap = gap;
+    log->lastPort = port;
+    log->lastValue = value;
+}
+
+static unsigned char read_recorded_port(void* context, unsigned char port)
+{
+    InputLogPort* wrapper = (InputLogPort*) context;
+    unsigned char value = wrapper->device.read(wrapper->device.context, port);
+
+    record_input(wrapper->log, port, value);
+
+    return value;
+}
+
+// Replay
+
+static BOOL read_byte(InputLog* log, uint8_t* value)
+{
+    if (log->used == log->size)
+    {
+        log->size = fread(log->buffer, 1, INPUT_LOG_BUFFER_SIZE, log->file);
+        log->used = 0;
+
+        if (log->size == 0)
+        {
+            return FALSE;
+        }
+    }
+
+    *value = log->buffer[log->used++];
+    return TRUE;
+}
+
+static BOOL read_varint(InputLog* log, uint64_t* value)
+{
+    *value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        uint8_t part;
+        if (!read_byte(log, &part))
+        {
+            return FALSE;
+        }
+
+        *value |= (uint64_t) (part & 0x7f) << shift;
+
+        if ((part & 0x80) == 0)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+// Decodes the entry after log->next into it. The end of the file or a damaged entry ends the log
+static void read_next_entry(InputLog* log)
+{
+    InputLogEntry* entry = &log->next;
+
+    if (log->pendingRepeats != 0)
+    {
+        log->pendingRepeats--;
+        entry->cycle += log->repeatGap;
+        return;
+    }
+
+    uint64_t word;
+    uint8_t port;
+    uint8_t value;
+
+    if (!read_varint(log, &word))
+    {
+        log->truncated = TRUE;
+        entry->kind = INPUT_LOG_END;
+        return;
+    }
+
+    InputLogKind kind = (InputLogKind) (word & 3);
+    uint64_t argument = word >> 2;
+
+    switch (kind)
+    {
+        case INPUT_LOG_IN:
+            if (read_byte(log, &port) && read_byte(log, &value))
+            {
+                entry->kind = INPUT_LOG_IN;
+                entry->cycle += argument;
+                entry->port = port;
+                entry->value = value;
+                log->repeatGap = argument;
+                return;
+            }
+            break;
+        case INPUT_LOG_INTERRUPT:
+            if (read_byte(log, &value))
+            {
+                entry->kind = INPUT_LOG_INTERRUPT;
+                entry->cycle += argument;
+                entry->opCode = value;
+                return;
+            }
+            break;
+        case INPUT_LOG_REPEAT:
+            // Repeats the IN in entry, the first one comes out right away
+            if (entry->kind == INPUT_LOG_IN && argument != 0)
+            {
+                log->pendingRepeats = argument - 1;
+                entry->cycle += log->repeatGap;
+                return;
+            }
+            break;
+        case INPUT_LOG_END:
+        {
+            int size = 0;
+            while (size < INPUT_LOG_END_STATE_SIZE && read_byte(log, &log->finalState[size]))
+            {
+                size++;
+            }
+
+            if (size == INPUT_LOG_END_STATE_SIZE)
+            {
+                entry->kind = INPUT_LOG_END;
+                entry->cycle += argument;
+                return;
+            }
+            break;
+        }
+    }
+
+    log->truncated = TRUE;
+    entry->kind = INPUT_LOG_END;
+}
+
+static unsigned char read_replayed_port(void* context, unsigned char port)
+{
+    InputLogPort* wrapper = (InputLogPort*) context;
+    InputLog* log = wrapper->log;
+
+    if (log->next.kind != INPUT_LOG_IN)
+    {
+        diverge(log, log->cpu->cycles);
+        return IO_UNMAPPED_VALUE;
+    }
+
+    if (log->next.port != port || log->next.cycle != log->cpu->cycles)
+    {
+        diverge(log, log->cpu->cycles);
+    }
+
+    unsigned char value = log->next.value;
+
+    log->inputs++;
+    read_next_entry(log);
+
+    return value;
+}
+
+// Handlers in front of the devices
+
+static void write_logged_port(void* context, unsigned char port, unsigned char value)
+{
+    InputLogPort* wrapper = (InputLogPort*) context;
+    wrapper->device.write(wrapper->device.context, port, value);
+}
+
+static void sync_logged_port(void* context)
+{
+    InputLogPort* wrapper = (InputLogPort*) context;
+    wrapper->device.sync(wrapper->device.context);
+}
+
+static void connect_logged_ports(InputLog* log, IoPortRead read)
+{
+    for (int port = 0; port < IO_PORT_COUNT; port++)
+    {
+        if (!port_logged(log, (unsigned char) port))
+        {
+            continue;
+        }
+
+        InputLogPort* wrapper = &log->ports[port];
+        wrapper->log = log;
+        wrapper->device = log->bus->ports[port];
+
+        io_bus_connect(log->bus, (unsigned char) port, read, write_logged_port,
+            wrapper->device.sync != NULL ? sync_logged_port : NULL, wrapper);
+    }
+}
+
+static void disconnect_logged_ports(InputLog* log)
+{
+    for (int port = 0; port < IO_PORT_COUNT; port++)
+    {
+        if (port_logged(log, (unsigned char) port))
+        {
+            IoPort* original = &log->ports[port].device;
+            io_bus_connect(log->bus, (unsigned char) port, original->read, original->write, original->sync, original->context);
+        }
+    }
+}
+
+InputLog* open_input_recording(const char* path, CPU* cpu, IoBus* bus)
+{
+    InputLog* log = (InputLog*) calloc(1, sizeof(InputLog));
+    if (log == NULL)
+    {
+        return NULL;
+    }
+
+    log->cpu = cpu;
+    log->bus = bus;
+    log->cycle = cpu->cycles;
+    log->buffer = (uint8_t*) malloc(INPUT_LOG_BUFFER_SIZE);
+    log->file = open_file(path, "wb");
+
+    if (log->buffer == NULL || log->file == NULL)
+    {
+        free_input_log(log);
+        return NULL;
+    }
+
+    // Unmapped ports always read IO_UNMAPPED_VALUE, there is nothing to log for them
+    for (int port = 0; port < IO_PORT_COUNT; port++)
+    {
+        if (io_bus_port_readable(bus, (unsigned char) port))
+        {
+            log->portMask[port / 8] |= (uint8_t) (1 << (port % 8));
+        }
+    }
+
+    uint8_t header[INPUT_LOG_HEADER_SIZE] = { 0 };
+    memcpy(header, INPUT_LOG_MAGIC, INPUT_LOG_MAGIC_SIZE);
+    header[INPUT_LOG_MAGIC_SIZE] = INPUT_LOG_VERSION;
+    header[INPUT_LOG_MAGIC_SIZE + 1] = (uint8_t) cpu->core;
+    header[INPUT_LOG_MAGIC_SIZE + 2] = cpu->profile != NULL || cpu->callProfile != NULL || cpu->trace != NULL
+        ? INPUT_LOG_PROFILING_CORE : 0;
+    memcpy(header + 12, log->portMask, sizeof(log->portMask));
+
+    if (fwrite(header, 1, sizeof(header), log->file) != sizeof(header))
+    {
+        free_input_log(log);
+        return NULL;
+    }
+
+    log->bytes = sizeof(header);
+
+    connect_logged_ports(log, read_recorded_port);
+
+    return log;
+}
+
+InputLog* open_input_replay(const char* path, CPU* cpu, IoBus* bus)
+{
+    InputLog* log = (InputLog*) calloc(1, sizeof(InputLog));
+    if (log == NULL)
+    {
+        return NULL;
+    }
+
+    log->replaying = TRUE;
+    log->cpu = cpu;
+    log->bus = bus;
+    log->buffer = (uint8_t*) malloc(INPUT_LOG_BUFFER_SIZE);
+    log->file = open_file(path, "rb");
+
+    uint8_t header[INPUT_LOG_HEADER_SIZE];
+
+    if (log->buffer == NULL || log->file == NULL
+        || fread(header, 1, sizeof(header), log->file) != sizeof(header)
+        || memcmp(header, INPUT_LOG_MAGIC, INPUT_LOG_MAGIC_SIZE) != 0 || header[INPUT_LOG_MAGIC_SIZE] != INPUT_LOG_VERSION
+        || header[INPUT_LOG_MAGIC_SIZE + 1] >= CPU_CORE_COUNT)
+    {
+        free_input_log(log);
+        return NULL;
+    }
+
+    // The interrupts are accepted at the block boundaries of the recording core
+    cpu->core = (CPU_Core) header[INPUT_LOG_MAGIC_SIZE + 1];
+    log->profilingCore = (header[INPUT_LOG_MAGIC_SIZE + 2] & INPUT_LOG_PROFILING_CORE) != 0;
+    memcpy(log->portMask, header + 12, sizeof(log->portMask));
+
+    log->next.cycle = cpu->cycles;
+    read_next_entry(log);
+
+    connect_logged_ports(log, read_replayed_port);
+
+    return log;
+}
+
+BOOL close_input_log(InputLog* log, const RAM* ramGateway)
+{
+    uint8_t state[INPUT_LOG_END_STATE_SIZE];
+    encode_final_state(log->cpu, ramGateway, state);
+
+    BOOL succeeded;
+
+    if (log->replaying)
+    {
+        // The run has to end where the recording did, with every logged input used up
+        if (log->next.kind != INPUT_LOG_END || log->truncated || log->next.cycle != log->cpu->cycles
+            || memcmp(state, log->finalState, sizeof(state)) != 0)
+        {
+            diverge(log, log->cpu->cycles);
+        }
+
+        succeeded = log->divergences == 0;
+    }
+    else
+    {
+        write_repeats(log);
+
+        uint8_t* output = begin_entry(log, INPUT_LOG_END, log->cpu->cycles);
+        memcpy(output, state, sizeof(state));
+        end_entry(log, output + sizeof(state));
+
+        write_buffer(log);
+        succeeded = !log->failed;
+    }
+
+    disconnect_logged_ports(log);
+
+    if (fclose(log->file) != 0 && !log->replaying)
+    {
+        succeeded = FALSE;
+    }
+
+    log->file = NULL;
+
+    return succeeded;
+}
+
+void free_input_log(InputLog* log)
+{
+    if (log->file != NULL)
+    {
+        fclose(log->file);
+    }
+
+    free(log->buffer);
+    free(log);
+}
+
+void input_log_interrupt(InputLog* log, const CPU* cpu, unsigned char opCode)
+{
+    log->interrupts++;
+
+    if (log->replaying)
+    {
+        if (!log->injected || cpu->cycles != log->injectedCycle || opCode != log->injectedOpCode)
+        {
+            diverge(log, cpu->cycles);
+        }
+
+        log->injected = FALSE;
+        return;
+    }
+
+    write_repeats(log);
+
+    uint8_t* output = begin_entry(log, INPUT_LOG_INTERRUPT, cpu->cycles);
+    *output++ = opCode;
+    end_entry(log, output);
+
+    log->repeatable = FALSE;
+}
+
+uint64_t input_log_next_cycle(const InputLog* log, uint64_t cycle)
+{
+    switch (log->next.kind)
+    {
+        case INPUT_LOG_INTERRUPT:
+            return log->next.cycle;
+        case INPUT_LOG_IN:
+            // Stopping once the IN is done reveals the entry after it. An IN overdue already has diverged
+            return log->next.cycle > cycle ? log->next.cycle : SCHEDULER_NO_EVENT;
+        default:
+            return SCHEDULER_NO_EVENT;
+    }
+}
+
+void input_log_dispatch(InputLog* log, CPU* cpu)
+{
+    if (log->next.kind != INPUT_LOG_INTERRUPT || cpu->cycles < log->next.cycle)
+    {
+        return;
+    }
+
+    // The core accepts it when it runs again, at the cycle the recording did
+    log->injected = TRUE;
+    log->injectedCycle = log->next.cycle;
+    log->injectedOpCode = log->next.opCode;
+
+    atomic_store_64(&cpu->interruptRequest, CPU_INTERRUPT_REQUEST | log->next.opCode);
+
+    read_next_entry(log);
+}
\ No newline at end of file
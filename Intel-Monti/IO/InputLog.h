@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "IoBus.h"
+#include "Scheduler.h"
+#include "../CPU/cpu.h"
+#include "../Memory/RAM.h"
+
+// Everything else about a run follows from the program, so these two are all a replay needs:
+// the values IN read from the devices and the cycles the cores accepted interrupts at
+
+#define INPUT_LOG_MAGIC "MONTIINP"
+#define INPUT_LOG_MAGIC_SIZE 8
+#define INPUT_LOG_VERSION 1
+// Magic, version, core, flags, a reserved byte, then the mask of the ports the log answers for
+#define INPUT_LOG_HEADER_SIZE (12 + IO_PORT_COUNT / 8)
+// Header flag: the profiling core ran, it accepts interrupts at other boundaries than the plain cores
+#define INPUT_LOG_PROFILING_CORE 0x01
+
+// Encoded entries are collected here and written in one piece, the guest never waits for a single IN
+#define INPUT_LOG_BUFFER_SIZE (64 * 1024)
+// Upper bound of one encoded entry, the buffer is written out before it could overflow
+#define INPUT_LOG_MAX_ENTRY_SIZE 32
+// Payload of the end entry
+#define INPUT_LOG_END_STATE_SIZE 17
+
+// Entry layout: a varint with the T-states since the previous entry shifted left by two and the kind in the low bits,
+// then the payload of the kind
+enum InputLogKind
+{
+	// Port and value
+	INPUT_LOG_IN,
+	// The RST opcode of an accepted interrupt, at the cycle the core accepted it
+	INPUT_LOG_INTERRUPT,
+	// The previous IN again, count times with the same gap, port and value. The count takes the place of the T-states.
+	// A polling loop costs a single entry
+	INPUT_LOG_REPEAT,
+	// End of the run: BC DE HL PSW SP PC, the interrupt enable flip-flop and a hash of the RAM
+	INPUT_LOG_END
+} typedef InputLogKind;
+
+// A decoded entry, repeats come out as single INs
+struct InputLogEntry
+{
+	InputLogKind kind;
+	uint64_t cycle;
+
+	unsigned char port;
+	unsigned char value;
+	unsigned char opCode;
+} typedef InputLogEntry;
+
+// Stands in for the device of one port, the context of the wrapped handlers
+struct InputLogPort
+{
+	struct InputLog* log;
+	IoPort device;
+} typedef InputLogPort;
+
+// Records the nondeterministic inputs of a run, or feeds them back so the run repeats bit for bit.
+// Attached to cpu->inputLog, the cores only look at it when they accept an interrupt.
+// A replay needs the program, the core and the devices behind OUT of the recording, the devices behind IN are not consulted
+struct InputLog
+{
+	FILE* file;
+	BOOL replaying;
+
+	CPU* cpu;
+	IoBus* bus;
+	// Replay: the recording ran the profiling core, a replay on the plain cores diverges at the first interrupt
+	BOOL profilingCore;
+	// Ports answered from the log, one bit each
+	uint8_t portMask[IO_PORT_COUNT / 8];
+	InputLogPort ports[IO_PORT_COUNT];
+
+	uint8_t* buffer;
+	size_t used;
+	size_t size;
+	// Cycle of the previous entry, the base of the gaps
+	uint64_t cycle;
+
+	// Recording: the last IN and the repeats of it not written yet
+	BOOL repeatable;
+	uint64_t lastGap;
+	unsigned char lastPort;
+	unsigned char lastValue;
+	uint64_t repeats;
+	BOOL failed;
+
+	// Replay: the entry due next, and the repeats of the last IN still to come
+	InputLogEntry next;
+	uint64_t pendingRepeats;
+	uint64_t repeatGap;
+	// The interrupt put on the line, until the core accepts it
+	BOOL injected;
+	uint64_t injectedCycle;
+	unsigned char injectedOpCode;
+
+	uint64_t inputs;
+	uint64_t interrupts;
+	uint64_t entries;
+	// Recording: bytes written, the header included
+	uint64_t bytes;
+	// Replay: mismatches between the run and the log, and the cycle of the first one
+	uint64_t divergences;
+	uint64_t firstDivergenceCycle;
+	// Replay: final state of the recording from the end entry
+	uint8_t finalState[INPUT_LOG_END_STATE_SIZE];
+	// Replay: the log ends without an end entry, the recording stopped without close_input_log or the file is damaged
+	BOOL truncated;
+} typedef InputLog;
+
+// Logs every IN of the ports with a reading device and every interrupt the CPU accepts.
+// Connect the devices first. Returns NULL when the file or the buffer can not be created
+InputLog* open_input_recording(const char* path, CPU* cpu, IoBus* bus);
+
+// Answers IN from the log and raises the logged interrupts at their cycles, interrupts raised by devices and timers are ignored.
+// Switches cpu->core to the core of the recording. Returns NULL when the file can not be opened or is no input log
+InputLog* open_input_replay(const char* path, CPU* cpu, IoBus* bus);
+
+// Recording: writes the end entry with the final state. Replay: compares the final state with it.
+// Reconnects the devices and closes the file, the statistics stay readable until free_input_log.
+// Returns FALSE when a write failed or the replay diverged
+BOOL close_input_log(InputLog* log, const RAM* ramGateway);
+void free_input_log(InputLog* log);
+
+// Called by the interrupt acknowledge of the cores with the RST opcode, before it runs
+void input_log_interrupt(InputLog* log, const CPU* cpu, unsigned char opCode);
+
+// Replay: cycle of the next logged IN or interrupt, SCHEDULER_NO_EVENT at the end of the log.
+// The run loop stops the core there, so the interrupt is accepted at the same block boundary as in the recording
+uint64_t input_log_next_cycle(const InputLog* log, uint64_t cycle);
+
+// Replay: puts the logged interrupt on the line once the cycle counter has reached it
+void input_log_dispatch(InputLog* log, CPU* cpu);
\ No newline at end of file
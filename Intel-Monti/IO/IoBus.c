@@ -0,0 +1,101 @@
+#include "IoBus.h"
+#include "StandartOutput.h"
+
+static unsigned char read_unmapped_port(void* context, unsigned char port)
+{
+    return IO_UNMAPPED_VALUE;
+}
+
+static void write_unmapped_port(void* context, unsigned char port, unsigned char value)
+{
+}
+
+static void write_standart_output(void* context, unsigned char port, unsigned char value)
+{
+    standart_output((char) value);
+}
+
+#define UNMAPPED_PORT { read_unmapped_port, write_unmapped_port, NULL, NULL }
+#define UNMAPPED_PORTS_2 UNMAPPED_PORT, UNMAPPED_PORT
+#define UNMAPPED_PORTS_4 UNMAPPED_PORTS_2, UNMAPPED_PORTS_2
+#define UNMAPPED_PORTS_16 UNMAPPED_PORTS_4, UNMAPPED_PORTS_4, UNMAPPED_PORTS_4, UNMAPPED_PORTS_4
+#define UNMAPPED_PORTS_64 UNMAPPED_PORTS_16, UNMAPPED_PORTS_16, UNMAPPED_PORTS_16, UNMAPPED_PORTS_16
+
+// Built at compile time, so a CPU can use it without any setup
+const IoBus standart_io_bus =
+{
+    {
+        // Port 0
+        UNMAPPED_PORT,
+        // STANDART_OUTPUT_PORT
+        { read_unmapped_port, write_standart_output, NULL, NULL },
+        // Ports 2 to 255
+        UNMAPPED_PORTS_2, UNMAPPED_PORTS_4, UNMAPPED_PORTS_4, UNMAPPED_PORTS_4,
+        UNMAPPED_PORTS_16, UNMAPPED_PORTS_16, UNMAPPED_PORTS_16,
+        UNMAPPED_PORTS_64, UNMAPPED_PORTS_64, UNMAPPED_PORTS_64
+    },
+    { 0 },
+    0
+};
+
+IoBus* init_io_bus()
+{
+    IoBus* bus = (IoBus*) malloc(sizeof(IoBus));
+    if (bus == NULL)
+    {
+        return NULL;
+    }
+
+    for (int port = 0; port < IO_PORT_COUNT; port++)
+    {
+        IoPort unmapped = UNMAPPED_PORT;
+        bus->ports[port] = unmapped;
+    }
+
+    bus->syncPortCount = 0;
+
+    return bus;
+}
+
+void free_io_bus(IoBus* bus)
+{
+    free(bus);
+}
+
+void io_bus_connect(IoBus* bus, unsigned char port, IoPortRead read, IoPortWrite write, IoPortSync sync, void* context)
+{
+    IoPort* handler = &bus->ports[port];
+
+    handler->read = read != NULL ? read : read_unmapped_port;
+    handler->write = write != NULL ? write : write_unmapped_port;
+    handler->sync = sync;
+    handler->context = context;
+
+    bus->syncPortCount = 0;
+    for (int index = 0; index < IO_PORT_COUNT; index++)
+    {
+        if (bus->ports[index].sync != NULL)
+        {
+            bus->syncPorts[bus->syncPortCount++] = (unsigned char) index;
+        }
+    }
+}
+
+void io_bus_disconnect(IoBus* bus, unsigned char port)
+{
+    io_bus_connect(bus, port, NULL, NULL, NULL, NULL);
+}
+
+BOOL io_bus_port_readable(const IoBus* bus, unsigned char port)
+{
+    return bus->ports[port].read != read_unmapped_port;
+}
+
+void io_bus_sync(const IoBus* bus)
+{
+    for (int i = 0; i < bus->syncPortCount; i++)
+    {
+        const IoPort* handler = &bus->ports[bus->syncPorts[i]];
+        handler->sync(handler->context);
+    }
+}
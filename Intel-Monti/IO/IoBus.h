@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "../Tools/Bool.h"
+
+// Value read from a port with nothing attached, the floating data bus
+#define IO_UNMAPPED_VALUE 0xFF
+#define IO_PORT_COUNT 256
+
+typedef unsigned char (*IoPortRead)(void* context, unsigned char port);
+typedef void (*IoPortWrite)(void* context, unsigned char port, unsigned char value);
+// Writes out whatever the device buffers, called when the CPU halts
+typedef void (*IoPortSync)(void* context);
+
+struct IoPort
+{
+	// Never NULL, ports without a device use the unmapped handlers
+	IoPortRead read;
+	IoPortWrite write;
+	// May be NULL
+	IoPortSync sync;
+	void* context;
+} typedef IoPort;
+
+// The 256 ports of IN and OUT. Every access is a single call through the table, whatever is attached
+struct IoBus
+{
+	IoPort ports[IO_PORT_COUNT];
+
+	// Ports with a sync handler, so a halt does not scan the whole table
+	unsigned char syncPorts[IO_PORT_COUNT];
+	int syncPortCount;
+} typedef IoBus;
+
+// Port 1 prints every byte with standart_output, every other port is unmapped.
+// Used by CPUs without a bus of their own
+extern const IoBus standart_io_bus;
+
+// Returns NULL when the bus can not be allocated. Every port starts unmapped
+IoBus* init_io_bus();
+void free_io_bus(IoBus* bus);
+
+// Attaches a device to the port, NULL callbacks fall back to the unmapped handlers
+void io_bus_connect(IoBus* bus, unsigned char port, IoPortRead read, IoPortWrite write, IoPortSync sync, void* context);
+void io_bus_disconnect(IoBus* bus, unsigned char port);
+
+// TRUE when a device answers IN on the port
+BOOL io_bus_port_readable(const IoBus* bus, unsigned char port);
+
+// Calls the sync handler of every port that has one
+void io_bus_sync(const IoBus* bus);
+
+static inline unsigned char io_bus_read(const IoBus* bus, unsigned char port)
+{
+	const IoPort* handler = &bus->ports[port];
+	return handler->read(handler->context, port);
+}
+
+static inline void io_bus_write(const IoBus* bus, unsigned char port, unsigned char value)
+{
+	const IoPort* handler = &bus->ports[port];
+	handler->write(handler->context, port, value);
+}
\ No newline at end of file
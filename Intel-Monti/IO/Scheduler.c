@@ -0,0 +1,165 @@
+#include "Scheduler.h"
+
+static void swap_events(ScheduledEvent* first, ScheduledEvent* second)
+{
+    ScheduledEvent event = *first;
+    *first = *second;
+    *second = event;
+}
+
+static void sift_up(Scheduler* scheduler, size_t index)
+{
+    ScheduledEvent* events = scheduler->events;
+
+    while (index > 0)
+    {
+        size_t parent = (index - 1) / 2;
+        if (events[parent].deadline <= events[index].deadline)
+        {
+            return;
+        }
+
+        swap_events(&events[parent], &events[index]);
+        index = parent;
+    }
+}
+
+static void sift_down(Scheduler* scheduler, size_t index)
+{
+    ScheduledEvent* events = scheduler->events;
+
+    for (;;)
+    {
+        size_t smallest = index;
+        size_t left = index * 2 + 1;
+        size_t right = left + 1;
+
+        if (left < scheduler->count && events[left].deadline < events[smallest].deadline)
+        {
+            smallest = left;
+        }
+        if (right < scheduler->count && events[right].deadline < events[smallest].deadline)
+        {
+            smallest = right;
+        }
+
+        if (smallest == index)
+        {
+            return;
+        }
+
+        swap_events(&events[smallest], &events[index]);
+        index = smallest;
+    }
+}
+
+// Takes the event at index out of the heap, the last one fills the gap
+static void remove_event(Scheduler* scheduler, size_t index)
+{
+    scheduler->count--;
+
+    if (index == scheduler->count)
+    {
+        return;
+    }
+
+    scheduler->events[index] = scheduler->events[scheduler->count];
+    sift_down(scheduler, index);
+    sift_up(scheduler, index);
+}
+
+Scheduler* init_scheduler()
+{
+    Scheduler* scheduler = (Scheduler*) malloc(sizeof(Scheduler));
+    if (scheduler == NULL)
+    {
+        return NULL;
+    }
+
+    scheduler->events = NULL;
+    scheduler->count = 0;
+    scheduler->capacity = 0;
+
+    return scheduler;
+}
+
+void free_scheduler(Scheduler* scheduler)
+{
+    free(scheduler->events);
+    free(scheduler);
+}
+
+BOOL scheduler_add(Scheduler* scheduler, uint64_t deadline, uint64_t period, ScheduledEventHandler handler, void* context, uint64_t argument)
+{
+    if (scheduler->count == scheduler->capacity)
+    {
+        size_t capacity = scheduler->capacity == 0 ? 16 : scheduler->capacity * 2;
+
+        ScheduledEvent* events = (ScheduledEvent*) realloc(scheduler->events, capacity * sizeof(ScheduledEvent));
+        if (events == NULL)
+        {
+            return FALSE;
+        }
+
+        scheduler->events = events;
+        scheduler->capacity = capacity;
+    }
+
+    ScheduledEvent* event = &scheduler->events[scheduler->count];
+
+    event->deadline = deadline;
+    event->period = period;
+    event->handler = handler;
+    event->context = context;
+    event->argument = argument;
+
+    sift_up(scheduler, scheduler->count++);
+
+    return TRUE;
+}
+
+void scheduler_cancel(Scheduler* scheduler, ScheduledEventHandler handler, void* context)
+{
+    size_t index = 0;
+
+    while (index < scheduler->count)
+    {
+        ScheduledEvent* event = &scheduler->events[index];
+
+        if (event->handler == handler && event->context == context)
+        {
+            // Removing reorders the heap, the scan starts over
+            remove_event(scheduler, index);
+            index = 0;
+            continue;
+        }
+
+        index++;
+    }
+}
+
+void scheduler_clear(Scheduler* scheduler)
+{
+    scheduler->count = 0;
+}
+
+void scheduler_dispatch(Scheduler* scheduler, uint64_t cycle)
+{
+    while (scheduler->count != 0 && scheduler->events[0].deadline <= cycle)
+    {
+        // Copied out first, the handler may change the heap
+        ScheduledEvent event = scheduler->events[0];
+
+        if (event.period != 0)
+        {
+            scheduler->events[0].deadline += event.period;
+            sift_down(scheduler, 0);
+        }
+        else
+        {
+            remove_event(scheduler, 0);
+        }
+
+        event.handler(event.context, event.argument, event.deadline);
+    }
+}
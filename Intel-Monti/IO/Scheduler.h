@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../Tools/Bool.h"
+
+// Deadline of an empty scheduler
+#define SCHEDULER_NO_EVENT UINT64_MAX
+
+// Called on the emulator thread once the guest cycle counter has reached the deadline.
+// May add and cancel events, including its own
+typedef void (*ScheduledEventHandler)(void* context, uint64_t argument, uint64_t deadline);
+
+struct ScheduledEvent
+{
+	// Guest cycle the event is due at
+	uint64_t deadline;
+	// Cycles to the next occurrence of a repeating event, 0 for a one-shot event
+	uint64_t period;
+
+	ScheduledEventHandler handler;
+	void* context;
+	uint64_t argument;
+} typedef ScheduledEvent;
+
+// Device events keyed on the guest cycle counter, a binary min-heap on the deadline.
+// The run loop executes straight to the earliest deadline and only then calls into the devices,
+// so the interpreter pays nothing for them in between. Only used by the emulator thread
+struct Scheduler
+{
+	ScheduledEvent* events;
+	size_t count;
+	size_t capacity;
+} typedef Scheduler;
+
+// Returns NULL when the scheduler can not be allocated
+Scheduler* init_scheduler();
+void free_scheduler(Scheduler* scheduler);
+
+// Returns FALSE when the queue can not grow
+BOOL scheduler_add(Scheduler* scheduler, uint64_t deadline, uint64_t period, ScheduledEventHandler handler, void* context, uint64_t argument);
+
+// Removes every pending event with this handler and context
+void scheduler_cancel(Scheduler* scheduler, ScheduledEventHandler handler, void* context);
+
+void scheduler_clear(Scheduler* scheduler);
+
+// Earliest deadline or SCHEDULER_NO_EVENT
+static inline uint64_t scheduler_next_deadline(const Scheduler* scheduler)
+{
+	return scheduler->count != 0 ? scheduler->events[0].deadline : SCHEDULER_NO_EVENT;
+}
+
+// Calls the handlers of every event due at cycle, earliest first. Repeating events are queued again one period later
+void scheduler_dispatch(Scheduler* scheduler, uint64_t cycle);
\ No newline at end of file
@@ -1,6 +1,209 @@
+#include <string.h>
+
 #include "StandartOutput.h"
 
+// Longest encoded byte, "-128\n" in decimal
+#define OUTPUT_MAX_ENCODED_LENGTH 5
+
 void standart_output(char content)
 {
 	printf("%d\n", content);
 }
+
+static void build_encoding(OutputDevice* device, OutputEncoding encoding)
+{
+	device->encoding = encoding;
+
+	for (int value = 0; value < 256; value++)
+	{
+		// Decimal keeps the char conversion of standart_output, so both print the same
+		int length = encoding == OUTPUT_ENCODING_HEX
+			? snprintf(device->encoded[value], sizeof(device->encoded[value]), "%02X\n", value)
+			: snprintf(device->encoded[value], sizeof(device->encoded[value]), "%d\n", (char) value);
+
+		device->encodedLength[value] = (unsigned char) length;
+	}
+}
+
+OutputDevice* init_output_device(FILE* stream, OutputEncoding encoding)
+{
+	OutputDevice* device = (OutputDevice*) malloc(sizeof(OutputDevice));
+	if (device == NULL)
+	{
+		return NULL;
+	}
+
+	device->stream = stream;
+	device->capture = NULL;
+	device->head = 0;
+	device->tail = 0;
+	device->writes = 0;
+	device->bytesWritten = 0;
+
+	// The ring never holds more than the threshold, so one block of text covers any contiguous part of it
+	device->ring = (unsigned char*) malloc(OUTPUT_RING_SIZE);
+	device->text = (char*) malloc(OUTPUT_FLUSH_THRESHOLD * OUTPUT_MAX_ENCODED_LENGTH);
+
+	if (device->ring == NULL || device->text == NULL)
+	{
+		free(device->ring);
+		free(device->text);
+		free(device);
+		return NULL;
+	}
+
+	build_encoding(device, encoding);
+
+	return device;
+}
+
+void free_output_device(OutputDevice* device)
+{
+	output_device_flush(device);
+
+	free(device->ring);
+	free(device->text);
+	free(device);
+}
+
+static void write_block(OutputDevice* device, const unsigned char* data, size_t size)
+{
+	if (device->capture != NULL)
+	{
+		for (size_t i = 0; i < size; i++)
+		{
+			output_capture_append(device->capture, data[i]);
+		}
+	}
+	else if (device->encoding == OUTPUT_ENCODING_RAW)
+	{
+		fwrite(data, 1, size, device->stream);
+	}
+	else
+	{
+		char* text = device->text;
+
+		for (size_t i = 0; i < size; i++)
+		{
+			memcpy(text, device->encoded[data[i]], OUTPUT_MAX_ENCODED_LENGTH);
+			text += device->encodedLength[data[i]];
+		}
+
+		fwrite(device->text, 1, (size_t) (text - device->text), device->stream);
+	}
+
+	device->writes++;
+	device->bytesWritten += size;
+}
+
+void output_device_flush(OutputDevice* device)
+{
+	// At most two blocks, the part up to the end of the ring and the part from its start
+	while (device->tail != device->head)
+	{
+		size_t offset = device->tail & (OUTPUT_RING_SIZE - 1);
+		size_t size = device->head - device->tail;
+
+		if (size > OUTPUT_RING_SIZE - offset)
+		{
+			size = OUTPUT_RING_SIZE - offset;
+		}
+
+		write_block(device, device->ring + offset, size);
+		device->tail += size;
+	}
+
+	if (device->capture == NULL)
+	{
+		fflush(device->stream);
+	}
+}
+
+void output_device_set_encoding(OutputDevice* device, OutputEncoding encoding)
+{
+	output_device_flush(device);
+	build_encoding(device, encoding);
+}
+
+static void write_output_port(void* context, unsigned char port, unsigned char value)
+{
+	output_device_write((OutputDevice*) context, value);
+}
+
+static void sync_output_port(void* context)
+{
+	output_device_flush((OutputDevice*) context);
+}
+
+void output_device_connect(OutputDevice* device, IoBus* bus, unsigned char port)
+{
+	io_bus_connect(bus, port, NULL, write_output_port, sync_output_port, device);
+}
+
+BOOL parse_output_encoding(const char* name, OutputEncoding* encoding)
+{
+	static const char* names[] = { "raw", "decimal", "hex" };
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (strcmp(name, names[i]) == 0)
+		{
+			*encoding = (OutputEncoding) i;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+OutputCapture init_output_capture(size_t limit)
+{
+	OutputCapture capture;
+
+	capture.data = NULL;
+	capture.size = 0;
+	capture.capacity = 0;
+	capture.limit = limit;
+	capture.dropped = 0;
+
+	return capture;
+}
+
+void output_capture_append(OutputCapture* capture, unsigned char content)
+{
+	if (capture->size == capture->capacity)
+	{
+		size_t capacity = capture->capacity == 0 ? 64 : capture->capacity * 2;
+		if (capacity > capture->limit)
+		{
+			capacity = capture->limit;
+		}
+
+		unsigned char* data = capacity > capture->size ? (unsigned char*) realloc(capture->data, capacity) : NULL;
+		if (data == NULL)
+		{
+			capture->dropped++;
+			return;
+		}
+
+		capture->data = data;
+		capture->capacity = capacity;
+	}
+
+	capture->data[capture->size++] = content;
+}
+
+void output_capture_clear(OutputCapture* capture)
+{
+	capture->size = 0;
+	capture->dropped = 0;
+}
+
+void free_output_capture(OutputCapture* capture)
+{
+	free(capture->data);
+
+	capture->data = NULL;
+	capture->size = 0;
+	capture->capacity = 0;
+}
@@ -1,7 +1,101 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#include "../Tools/Bool.h"
+#include "IoBus.h"
 
 #define STANDART_OUTPUT_PORT 1
 
-void standart_output(char content);
\ No newline at end of file
+// Bytes buffered by an output device, a power of two
+#define OUTPUT_RING_SIZE (64 * 1024)
+// The ring is flushed once it holds this many bytes
+#define OUTPUT_FLUSH_THRESHOLD (32 * 1024)
+
+// How the guest bytes are written to the host stream
+enum OutputEncoding
+{
+	// The bytes themselves
+	OUTPUT_ENCODING_RAW,
+	// One signed decimal number per line, like standart_output
+	OUTPUT_ENCODING_DECIMAL,
+	// Two upper case hex digits per line
+	OUTPUT_ENCODING_HEX
+} typedef OutputEncoding;
+
+// Collects the guest output in memory instead of printing it.
+// Bytes past the limit are only counted
+struct OutputCapture
+{
+	unsigned char* data;
+	size_t size;
+	size_t capacity;
+	size_t limit;
+
+	size_t dropped;
+} typedef OutputCapture;
+
+// Buffers the bytes of the output port and writes them to a host stream or a capture in large blocks.
+// The ring is flushed when it reaches the threshold, when the bus is synced and on output_device_flush
+struct OutputDevice
+{
+	FILE* stream;
+	OutputEncoding encoding;
+
+	// When set the bytes go here unencoded instead of to the stream
+	OutputCapture* capture;
+
+	// Bytes between tail and head are waiting, both only grow and are masked on access
+	unsigned char* ring;
+	size_t head;
+	size_t tail;
+
+	// Encoded form of every byte value
+	char encoded[256][8];
+	unsigned char encodedLength[256];
+
+	// Encoded text of one block, written with a single fwrite
+	char* text;
+
+	// Host writes issued and guest bytes written
+	uint64_t writes;
+	uint64_t bytesWritten;
+} typedef OutputDevice;
+
+void standart_output(char content);
+
+// Returns NULL when the buffers can not be allocated
+OutputDevice* init_output_device(FILE* stream, OutputEncoding encoding);
+// Flushes what is left and releases the device, the stream stays open
+void free_output_device(OutputDevice* device);
+
+// Writes every buffered byte and flushes the stream
+void output_device_flush(OutputDevice* device);
+
+// Flushes the bytes buffered so far in the old encoding first
+void output_device_set_encoding(OutputDevice* device, OutputEncoding encoding);
+
+// Buffers one byte of the output port
+static inline void output_device_write(OutputDevice* device, unsigned char content)
+{
+	device->ring[device->head++ & (OUTPUT_RING_SIZE - 1)] = content;
+
+	if (device->head - device->tail >= OUTPUT_FLUSH_THRESHOLD)
+	{
+		output_device_flush(device);
+	}
+}
+
+// Attaches the device to an output port, the bus syncs it when the CPU halts
+void output_device_connect(OutputDevice* device, IoBus* bus, unsigned char port);
+
+// Accepts raw, decimal and hex
+BOOL parse_output_encoding(const char* name, OutputEncoding* encoding);
+
+OutputCapture init_output_capture(size_t limit);
+void output_capture_append(OutputCapture* capture, unsigned char content);
+// Empties the capture and keeps its buffer
+void output_capture_clear(OutputCapture* capture);
+void free_output_capture(OutputCapture* capture);
\ No newline at end of file
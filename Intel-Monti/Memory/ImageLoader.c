@@ -0,0 +1,300 @@
+#include <ctype.h>
+#include <string.h>
+
+#include "ImageLoader.h"
+#include "../Tools/File.h"
+
+// Intel HEX record types
+#define HEX_RECORD_DATA 0x00
+#define HEX_RECORD_END_OF_FILE 0x01
+#define HEX_RECORD_EXTENDED_SEGMENT_ADDRESS 0x02
+#define HEX_RECORD_START_SEGMENT_ADDRESS 0x03
+#define HEX_RECORD_EXTENDED_LINEAR_ADDRESS 0x04
+#define HEX_RECORD_START_LINEAR_ADDRESS 0x05
+
+// Length, address, type, up to 255 data bytes and the checksum
+#define HEX_MAX_RECORD_BYTES (1 + 2 + 1 + 255 + 1)
+
+static BOOL has_extension(const char* path, const char* extension)
+{
+    size_t pathLength = strlen(path);
+    size_t extensionLength = strlen(extension);
+
+    if (pathLength < extensionLength)
+    {
+        return FALSE;
+    }
+
+    const char* suffix = path + pathLength - extensionLength;
+    for (size_t i = 0; i < extensionLength; i++)
+    {
+        if (tolower((unsigned char) suffix[i]) != extension[i])
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+ImageFormat image_format_from_path(const char* path)
+{
+    if (has_extension(path, ".hex") || has_extension(path, ".ihx"))
+    {
+        return IMAGE_FORMAT_INTEL_HEX;
+    }
+
+    if (has_extension(path, ".com"))
+    {
+        return IMAGE_FORMAT_COM;
+    }
+
+    return IMAGE_FORMAT_BINARY;
+}
+
+BOOL parse_image_format(const char* name, ImageFormat* format)
+{
+    static const char* names[] = { "auto", "binary", "hex", "com" };
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *format = (ImageFormat) i;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+const char* image_load_result_message(ImageLoadResult result)
+{
+    switch (result)
+    {
+        case IMAGE_LOAD_OK:
+            return "Loaded";
+        case IMAGE_LOAD_CAN_NOT_OPEN:
+            return "Can not open file";
+        case IMAGE_LOAD_TOO_LARGE:
+            return "Out of range memory size";
+        default:
+            return "Invalid Intel HEX file";
+    }
+}
+
+static int hex_digit(unsigned char character)
+{
+    if (character >= '0' && character <= '9')
+    {
+        return character - '0';
+    }
+
+    character = (unsigned char) tolower(character);
+    if (character >= 'a' && character <= 'f')
+    {
+        return character - 'a' + 10;
+    }
+
+    return -1;
+}
+
+// Decodes the hex digit pairs after the colon up to the end of the line, returns the byte count or -1
+static int decode_record(const unsigned char* text, size_t length, unsigned char* record)
+{
+    int count = 0;
+
+    for (size_t i = 0; i < length; i += 2)
+    {
+        int high = hex_digit(text[i]);
+        int low = i + 1 < length ? hex_digit(text[i + 1]) : -1;
+
+        if (high < 0 || low < 0 || count == HEX_MAX_RECORD_BYTES)
+        {
+            return -1;
+        }
+
+        record[count++] = (unsigned char) (high << 4 | low);
+    }
+
+    return count;
+}
+
+// Walks the records, copying the data records into the RAM unless it is NULL
+static ImageLoadResult read_intel_hex(RAM* ram, const unsigned char* data, size_t size, unsigned short* entryPoint)
+{
+    unsigned char record[HEX_MAX_RECORD_BYTES];
+    uint32_t base = 0;
+    BOOL entryKnown = FALSE;
+    size_t position = 0;
+
+    while (position < size)
+    {
+        // Blank lines and line endings between the records
+        if (isspace(data[position]))
+        {
+            position++;
+            continue;
+        }
+
+        if (data[position] != ':')
+        {
+            return IMAGE_LOAD_INVALID_HEX;
+        }
+
+        size_t end = ++position;
+        while (end < size && data[end] != '\r' && data[end] != '\n')
+        {
+            end++;
+        }
+
+        int count = decode_record(data + position, end - position, record);
+        position = end;
+
+        // At least length, address, type and checksum, and exactly as much data as the length says
+        if (count < 5 || count != record[0] + 5)
+        {
+            return IMAGE_LOAD_INVALID_HEX;
+        }
+
+        unsigned char checksum = 0;
+        for (int i = 0; i < count; i++)
+        {
+            checksum = (unsigned char) (checksum + record[i]);
+        }
+
+        if (checksum != 0)
+        {
+            return IMAGE_LOAD_INVALID_HEX;
+        }
+
+        unsigned char length = record[0];
+        uint32_t address = (uint32_t) (record[1] << 8 | record[2]);
+        const unsigned char* payload = record + 4;
+        uint32_t value = length >= 2 ? (uint32_t) (payload[0] << 8 | payload[1]) : 0;
+
+        switch (record[3])
+        {
+            case HEX_RECORD_DATA:
+                // A linear base of 0xFFFF0000 would wrap a 32-bit sum back into range
+                if ((uint64_t) base + address + length > RAM_MEMORY_SIZE)
+                {
+                    return IMAGE_LOAD_TOO_LARGE;
+                }
+
+                if (ram != NULL)
+                {
+                    ram_load(ram, (unsigned short) (base + address), payload, length);
+                }
+
+                if (!entryKnown)
+                {
+                    *entryPoint = (unsigned short) (base + address);
+                    entryKnown = TRUE;
+                }
+                break;
+            case HEX_RECORD_END_OF_FILE:
+                return IMAGE_LOAD_OK;
+            case HEX_RECORD_EXTENDED_SEGMENT_ADDRESS:
+                if (length != 2)
+                {
+                    return IMAGE_LOAD_INVALID_HEX;
+                }
+                base = value << 4;
+                break;
+            case HEX_RECORD_EXTENDED_LINEAR_ADDRESS:
+                if (length != 2)
+                {
+                    return IMAGE_LOAD_INVALID_HEX;
+                }
+                base = value << 16;
+                break;
+            case HEX_RECORD_START_SEGMENT_ADDRESS:
+            case HEX_RECORD_START_LINEAR_ADDRESS:
+            {
+                if (length != 4)
+                {
+                    return IMAGE_LOAD_INVALID_HEX;
+                }
+
+                uint32_t low = (uint32_t) (payload[2] << 8 | payload[3]);
+                uint32_t start = record[3] == HEX_RECORD_START_SEGMENT_ADDRESS ? (value << 4) + low : (value << 16) | low;
+                if (start > RAM_ADDRESS_MASK)
+                {
+                    return IMAGE_LOAD_TOO_LARGE;
+                }
+
+                // The start record wins over the first data record, wherever it appears
+                *entryPoint = (unsigned short) start;
+                entryKnown = TRUE;
+                break;
+            }
+            default:
+                return IMAGE_LOAD_INVALID_HEX;
+        }
+    }
+
+    // A file cut off before its end of file record
+    return IMAGE_LOAD_INVALID_HEX;
+}
+
+// The whole file is checked before the first byte is copied, a bad record leaves the RAM untouched
+static ImageLoadResult load_intel_hex(RAM* ram, const unsigned char* data, size_t size, unsigned short* entryPoint)
+{
+    ImageLoadResult result = read_intel_hex(NULL, data, size, entryPoint);
+    if (result != IMAGE_LOAD_OK)
+    {
+        return result;
+    }
+
+    return read_intel_hex(ram, data, size, entryPoint);
+}
+
+ImageLoadResult load_image(RAM* ram, const unsigned char* data, size_t size, ImageFormat format, unsigned short origin, unsigned short* entryPoint)
+{
+    switch (format)
+    {
+        case IMAGE_FORMAT_INTEL_HEX:
+            *entryPoint = 0;
+            return load_intel_hex(ram, data, size, entryPoint);
+        case IMAGE_FORMAT_COM:
+            if (size > RAM_MEMORY_SIZE - IMAGE_COM_ORIGIN)
+            {
+                return IMAGE_LOAD_TOO_LARGE;
+            }
+
+            origin = IMAGE_COM_ORIGIN;
+            break;
+        default:
+            break;
+    }
+
+    // Raw images wrap past 0xFFFF like ram_load
+    if (!ram_load(ram, origin, data, size))
+    {
+        return IMAGE_LOAD_TOO_LARGE;
+    }
+
+    *entryPoint = origin;
+    return IMAGE_LOAD_OK;
+}
+
+ImageLoadResult load_image_file(RAM* ram, const char* path, ImageFormat format, unsigned short origin, unsigned short* entryPoint)
+{
+    MappedFile file;
+    if (!map_file(path, &file))
+    {
+        return IMAGE_LOAD_CAN_NOT_OPEN;
+    }
+
+    if (format == IMAGE_FORMAT_AUTO)
+    {
+        format = image_format_from_path(path);
+    }
+
+    ImageLoadResult result = load_image(ram, file.data, file.size, format, origin, entryPoint);
+
+    unmap_file(&file);
+
+    return result;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "RAM.h"
+
+// CP/M loads .COM programs into the Transient Program Area and jumps to its start
+#define IMAGE_COM_ORIGIN 0x0100
+
+enum ImageFormat
+{
+	// Chosen from the file extension, see image_format_from_path
+	IMAGE_FORMAT_AUTO,
+	// Raw bytes loaded at the origin
+	IMAGE_FORMAT_BINARY,
+	// Text records carrying their own load addresses
+	IMAGE_FORMAT_INTEL_HEX,
+	// Raw bytes loaded and started at IMAGE_COM_ORIGIN
+	IMAGE_FORMAT_COM
+} typedef ImageFormat;
+
+enum ImageLoadResult
+{
+	IMAGE_LOAD_OK,
+	IMAGE_LOAD_CAN_NOT_OPEN,
+	// The image does not fit into the address space
+	IMAGE_LOAD_TOO_LARGE,
+	// Malformed record, bad checksum or no end of file record
+	IMAGE_LOAD_INVALID_HEX
+} typedef ImageLoadResult;
+
+// .hex and .ihx are Intel HEX, .com is a CP/M program, everything else a raw binary
+ImageFormat image_format_from_path(const char* path);
+
+// Accepts auto, binary, hex and com
+BOOL parse_image_format(const char* name, ImageFormat* format);
+
+const char* image_load_result_message(ImageLoadResult result);
+
+// Copies the image into the RAM and sets entryPoint to where execution starts:
+// the origin for raw binaries, IMAGE_COM_ORIGIN for .COM images, and for Intel HEX the start address record
+// or, without one, the address of the first data record. Page types are ignored like in ram_load.
+// An image that fails to load leaves the RAM as it was
+ImageLoadResult load_image(RAM* ram, const unsigned char* data, size_t size, ImageFormat format, unsigned short origin, unsigned short* entryPoint);
+
+// Maps the file instead of reading it into a buffer and loads it with load_image.
+// IMAGE_FORMAT_AUTO picks the format from the path
+ImageLoadResult load_image_file(RAM* ram, const char* path, ImageFormat format, unsigned short origin, unsigned short* entryPoint);
\ No newline at end of file
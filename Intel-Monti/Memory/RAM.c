@@ -1,45 +1,382 @@
+#include <string.h>
+
 #include "RAM.h"
+#include "../Tools/Thread.h"
+
+// Source of the snapshot ids, shared by all threads
+static volatile int64_t lastSnapshotId = 0;
+
+static unsigned char* allocate_memory()
+{
+#if defined(_MSC_VER)
+    return (unsigned char*) _aligned_malloc(RAM_MEMORY_SIZE, RAM_HOST_PAGE_SIZE);
+#else
+    void* memory = NULL;
+    return posix_memalign(&memory, RAM_HOST_PAGE_SIZE, RAM_MEMORY_SIZE) == 0 ? (unsigned char*) memory : NULL;
+#endif
+}
 
-// CS6011 warning is ambiguous
-#pragma warning(disable : 6011)
+static void free_memory(unsigned char* memory)
+{
+#if defined(_MSC_VER)
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+// Recomputes the direct access pointers of a page from its type, code tracking and dirty tracking
+static void update_page(RAM* ramPointer, unsigned int page)
+{
+    unsigned char* base = ramPointer->memory + page * RAM_PAGE_SIZE;
+    RAM_PageType type = ramPointer->pageTypes[page];
+    BOOL writable = type == RAM_PAGE_RAM
+        && ramPointer->codePageCounters[page] == 0
+        && (ramPointer->trackedSnapshotId == 0 || ramPointer->dirtyPages[page]);
+
+    ramPointer->readPages[page] = (type == RAM_PAGE_RAM || type == RAM_PAGE_ROM) ? base : NULL;
+    ramPointer->writePages[page] = writable ? base : NULL;
+}
+
+static void mark_page_dirty(RAM* ramPointer, unsigned int page)
+{
+    if (ramPointer->trackedSnapshotId == 0 || ramPointer->dirtyPages[page])
+    {
+        return;
+    }
+
+    ramPointer->dirtyPages[page] = TRUE;
+    ramPointer->dirtyPageList[ramPointer->dirtyPageCount++] = (unsigned char) page;
+    update_page(ramPointer, page);
+}
+
+// Makes every page clean and tracks the writes against the snapshot from now on
+static void start_dirty_tracking(RAM* ramPointer, int64_t snapshotId)
+{
+    ramPointer->trackedSnapshotId = snapshotId;
+    ramPointer->dirtyPageCount = 0;
+    ramPointer->mapChanged = FALSE;
+
+    memset(ramPointer->dirtyPages, 0, sizeof(ramPointer->dirtyPages));
+
+    for (unsigned int page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        update_page(ramPointer, page);
+    }
+}
 
 RAM* init_ram()
 {
-    RAM_MemoryBlock* memoryBlocks = (RAM_MemoryBlock*) malloc(sizeof(RAM_MemoryBlock) * RAM_MEMORY_SIZE);
+    RAM* ram = (RAM*) malloc(sizeof(RAM));
+    if (ram == NULL)
+    {
+        return NULL;
+    }
 
-    for (int i = 0; i < RAM_MEMORY_SIZE; i++)
+    ram->memory = allocate_memory();
+    if (ram->memory == NULL)
     {
-        memoryBlocks[i].rawByte = 0;
+        free(ram);
+        return NULL;
     }
 
-    RAM* ram = malloc(sizeof(RAM));
-    ram->blocks = memoryBlocks;
+    memset(ram->codePageCounters, 0, sizeof(ram->codePageCounters));
+
+    ram->codeWriteHandler = NULL;
+    ram->codeWriteContext = NULL;
+    ram->trackedSnapshotId = 0;
+    ram->dirtyPageCount = 0;
+    ram->mapChanged = FALSE;
+
+    memset(ram->dirtyPages, 0, sizeof(ram->dirtyPages));
+
+    ram_reset(ram);
 
     return ram;
 }
 
-char read_memory_ram(RAM* ramPointer, unsigned short offset)
+void ram_reset(RAM* ramPointer)
 {
-    if (offset < 0 || offset > RAM_MEMORY_SIZE)
+    memset(ramPointer->memory, 0, RAM_MEMORY_SIZE);
+    memset(ramPointer->mmioHandlers, 0, sizeof(ramPointer->mmioHandlers));
+
+    ramPointer->trackedSnapshotId = 0;
+
+    for (unsigned int page = 0; page < RAM_PAGE_COUNT; page++)
     {
+        ramPointer->pageTypes[page] = RAM_PAGE_RAM;
+        update_page(ramPointer, page);
+    }
+}
+
+// Drops the translations of a page whose contents change behind the guest's back
+static void notify_page_remap(RAM* ramPointer, unsigned int page)
+{
+    if (ramPointer->codePageCounters[page] == 0 || ramPointer->codeWriteHandler == NULL)
+    {
+        return;
+    }
+
+    for (unsigned int offset = 0; offset < RAM_PAGE_SIZE; offset++)
+    {
+        ramPointer->codeWriteHandler(ramPointer->codeWriteContext, (unsigned short) (page * RAM_PAGE_SIZE + offset));
+    }
+}
+
+void ram_map_pages(RAM* ramPointer, unsigned int firstPage, unsigned int pageCount, RAM_PageType type)
+{
+    for (unsigned int i = 0; i < pageCount; i++)
+    {
+        unsigned int page = (firstPage + i) % RAM_PAGE_COUNT;
+
+        notify_page_remap(ramPointer, page);
+
+        ramPointer->pageTypes[page] = type;
+        ramPointer->mapChanged = TRUE;
+        update_page(ramPointer, page);
+    }
+}
+
+void ram_map_mmio(RAM* ramPointer, unsigned int firstPage, unsigned int pageCount, RAM_MmioHandler handler)
+{
+    for (unsigned int i = 0; i < pageCount; i++)
+    {
+        ramPointer->mmioHandlers[(firstPage + i) % RAM_PAGE_COUNT] = handler;
+    }
+
+    ram_map_pages(ramPointer, firstPage, pageCount, RAM_PAGE_MMIO);
+}
+
+void ram_add_code_page(RAM* ramPointer, unsigned int page)
+{
+    if (ramPointer->codePageCounters[page]++ == 0)
+    {
+        update_page(ramPointer, page);
+    }
+}
+
+void ram_remove_code_page(RAM* ramPointer, unsigned int page)
+{
+    if (--ramPointer->codePageCounters[page] == 0)
+    {
+        update_page(ramPointer, page);
+    }
+}
+
+char read_memory_slow(RAM* ramPointer, unsigned int offset)
+{
+    offset &= RAM_ADDRESS_MASK;
+    unsigned int page = offset / RAM_PAGE_SIZE;
+
+    switch (ramPointer->pageTypes[page])
+    {
+        case RAM_PAGE_RAM:
+        case RAM_PAGE_ROM:
+            return (char) ramPointer->memory[offset];
+        case RAM_PAGE_MMIO:
+        {
+            RAM_MmioHandler* handler = &ramPointer->mmioHandlers[page];
+            if (handler->read != NULL)
+            {
+                return (char) handler->read(handler->context, (unsigned short) offset);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    return (char) RAM_UNMAPPED_VALUE;
+}
+
+void write_memory_slow(RAM* ramPointer, unsigned int offset, char byte)
+{
+    offset &= RAM_ADDRESS_MASK;
+    unsigned int page = offset / RAM_PAGE_SIZE;
+
+    switch (ramPointer->pageTypes[page])
+    {
+        case RAM_PAGE_RAM:
+            mark_page_dirty(ramPointer, page);
+            ramPointer->memory[offset] = (unsigned char) byte;
+
+            if (ramPointer->codePageCounters[page] != 0)
+            {
+                ramPointer->codeWriteHandler(ramPointer->codeWriteContext, (unsigned short) offset);
+            }
+            break;
+        case RAM_PAGE_MMIO:
+        {
+            RAM_MmioHandler* handler = &ramPointer->mmioHandlers[page];
+            if (handler->write != NULL)
+            {
+                handler->write(handler->context, (unsigned short) offset, (unsigned char) byte);
+            }
+            break;
+        }
+        // ROM and unmapped pages ignore guest writes
+        default:
+            break;
+    }
+}
+
+// Reports every loaded byte that lands in a page holding translated code
+static void notify_code_writes(RAM* ramPointer, unsigned int offset, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        unsigned int address = (unsigned int) (offset + i) & RAM_ADDRESS_MASK;
+
+        if (ramPointer->codePageCounters[address / RAM_PAGE_SIZE] != 0)
+        {
+            ramPointer->codeWriteHandler(ramPointer->codeWriteContext, (unsigned short) address);
+        }
+    }
+}
+
+BOOL ram_load(RAM* ramPointer, unsigned short offset, const void* data, size_t size)
+{
+    if (size > RAM_MEMORY_SIZE)
+    {
+        return FALSE;
+    }
+
+    // The part that does not fit below 0x10000 continues at address 0
+    size_t head = RAM_MEMORY_SIZE - offset;
+    if (head > size)
+    {
+        head = size;
+    }
+
+    memcpy(ramPointer->memory + offset, data, head);
+    memcpy(ramPointer->memory, (const unsigned char*) data + head, size - head);
+
+    if (ramPointer->trackedSnapshotId != 0)
+    {
+        for (size_t page = 0; page * RAM_PAGE_SIZE < offset % RAM_PAGE_SIZE + size; page++)
+        {
+            mark_page_dirty(ramPointer, (unsigned int) (offset / RAM_PAGE_SIZE + page) % RAM_PAGE_COUNT);
+        }
+    }
+
+    if (ramPointer->codeWriteHandler != NULL)
+    {
+        notify_code_writes(ramPointer, offset, size);
+    }
+
+    return TRUE;
+}
+
+BOOL ram_dump(RAM* ramPointer, unsigned short offset, void* buffer, size_t size)
+{
+    if (size > RAM_MEMORY_SIZE)
+    {
+        return FALSE;
+    }
+
+    size_t head = RAM_MEMORY_SIZE - offset;
+    if (head > size)
+    {
+        head = size;
+    }
+
+    memcpy(buffer, ramPointer->memory + offset, head);
+    memcpy((unsigned char*) buffer + head, ramPointer->memory, size - head);
+
+    return TRUE;
+}
+
+RAM_Snapshot* ram_snapshot(RAM* ramPointer)
+{
+    RAM_Snapshot* snapshot = (RAM_Snapshot*) malloc(sizeof(RAM_Snapshot));
+    if (snapshot == NULL)
+    {
+        return NULL;
+    }
+
+    snapshot->memory = allocate_memory();
+    if (snapshot->memory == NULL)
+    {
+        free(snapshot);
         return NULL;
     }
 
-    return ramPointer->blocks[offset].rawByte;
+    snapshot->id = atomic_fetch_add_64(&lastSnapshotId, 1) + 1;
+
+    memcpy(snapshot->memory, ramPointer->memory, RAM_MEMORY_SIZE);
+    memcpy(snapshot->pageTypes, ramPointer->pageTypes, sizeof(snapshot->pageTypes));
+    memcpy(snapshot->mmioHandlers, ramPointer->mmioHandlers, sizeof(snapshot->mmioHandlers));
+
+    start_dirty_tracking(ramPointer, snapshot->id);
+
+    return snapshot;
+}
+
+// Copies one page of the snapshot back, translations of the page are dropped
+static void restore_page(RAM* ramPointer, const RAM_Snapshot* snapshot, unsigned int page)
+{
+    notify_page_remap(ramPointer, page);
+
+    memcpy(ramPointer->memory + page * RAM_PAGE_SIZE, snapshot->memory + page * RAM_PAGE_SIZE, RAM_PAGE_SIZE);
 }
 
-void write_memory_ram(RAM* ramPointer, unsigned short offset, char byte)
+static void restore_memory_map(RAM* ramPointer, const RAM_Snapshot* snapshot)
 {
-    if (offset < 0 || offset > RAM_MEMORY_SIZE)
+    for (unsigned int page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        if (ramPointer->pageTypes[page] != snapshot->pageTypes[page]
+            || memcmp(&ramPointer->mmioHandlers[page], &snapshot->mmioHandlers[page], sizeof(RAM_MmioHandler)) != 0)
+        {
+            notify_page_remap(ramPointer, page);
+
+            ramPointer->pageTypes[page] = snapshot->pageTypes[page];
+            ramPointer->mmioHandlers[page] = snapshot->mmioHandlers[page];
+        }
+    }
+}
+
+void ram_restore(RAM* ramPointer, const RAM_Snapshot* snapshot)
+{
+    if (ramPointer->trackedSnapshotId == snapshot->id)
+    {
+        for (unsigned int i = 0; i < ramPointer->dirtyPageCount; i++)
+        {
+            restore_page(ramPointer, snapshot, ramPointer->dirtyPageList[i]);
+        }
+    }
+    else
     {
+        for (unsigned int page = 0; page < RAM_PAGE_COUNT; page++)
+        {
+            restore_page(ramPointer, snapshot, page);
+        }
+    }
+
+    if (ramPointer->trackedSnapshotId != snapshot->id || ramPointer->mapChanged)
+    {
+        restore_memory_map(ramPointer, snapshot);
+        start_dirty_tracking(ramPointer, snapshot->id);
         return;
     }
 
-    ramPointer->blocks[offset].rawByte = byte;
+    // Only the restored pages change their direct pointers
+    for (unsigned int i = 0; i < ramPointer->dirtyPageCount; i++)
+    {
+        ramPointer->dirtyPages[ramPointer->dirtyPageList[i]] = FALSE;
+        update_page(ramPointer, ramPointer->dirtyPageList[i]);
+    }
+
+    ramPointer->dirtyPageCount = 0;
+}
+
+void free_ram_snapshot(RAM_Snapshot* snapshot)
+{
+    free_memory(snapshot->memory);
+    free(snapshot);
 }
 
 void free_ram(RAM* ramPointer)
 {
-    free(ramPointer->blocks);
+    free_memory(ramPointer->memory);
     free(ramPointer);
 }
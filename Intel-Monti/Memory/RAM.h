@@ -1,26 +1,161 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "../Tools/Bool.h"
+
 // The Intel 8080 processor had an address space for RAM of up to 64 KB.
 // Corresponding to addresses ranging from 0x0000 to 0xFFFF
-#define RAM_MEMORY_SIZE 65535
+#define RAM_MEMORY_SIZE 65536
+#define RAM_ADDRESS_MASK 0xFFFF
+
+// Granularity of the memory map and of the code page tracking
+#define RAM_PAGE_SIZE 256
+#define RAM_PAGE_COUNT 256
+
+// Alignment of the guest memory, one host page
+#define RAM_HOST_PAGE_SIZE 4096
+
+// Value read from a page with nothing mapped, the floating data bus
+#define RAM_UNMAPPED_VALUE 0xFF
+
+enum RAM_PageType
+{
+	RAM_PAGE_RAM,
+	// Reads like RAM, guest writes are dropped
+	RAM_PAGE_ROM,
+	// Reads return RAM_UNMAPPED_VALUE, writes are dropped
+	RAM_PAGE_UNMAPPED,
+	// Every access goes to the callbacks of the page
+	RAM_PAGE_MMIO
+} typedef RAM_PageType;
+
+typedef unsigned char (*RAM_MmioRead)(void* context, unsigned short offset);
+typedef void (*RAM_MmioWrite)(void* context, unsigned short offset, unsigned char byte);
+
+struct RAM_MmioHandler
+{
+	// Either callback may be NULL, reads then return RAM_UNMAPPED_VALUE and writes are dropped
+	RAM_MmioRead read;
+	RAM_MmioWrite write;
+	void* context;
+} typedef RAM_MmioHandler;
 
-// Representation of a block of random-access memory.
-// The Intel 8080 processor stored 1 byte of information in a single memory cell
-struct RAM_MemoryBlock
+// Copy of the memory and the memory map, see ram_snapshot
+struct RAM_Snapshot
 {
-	char rawByte;
-} typedef RAM_MemoryBlock;
+	// Unique in the process, ties the dirty page tracking of a RAM to the snapshot it started from
+	int64_t id;
+
+	unsigned char* memory;
+	RAM_PageType pageTypes[RAM_PAGE_COUNT];
+	RAM_MmioHandler mmioHandlers[RAM_PAGE_COUNT];
+} typedef RAM_Snapshot;
+
+// Called when the guest writes into a page that holds translated code
+typedef void (*RAM_CodeWriteHandler)(void* context, unsigned short offset);
 
 struct RAM
 {
-	RAM_MemoryBlock* blocks;
+	// The whole address space as one flat array, the Intel 8080 processor stored 1 byte in a single memory cell.
+	// Backing store of RAM and ROM pages
+	unsigned char* memory;
+
+	// Host address of every page for direct access, NULL sends the access to the slow path.
+	// Reads are direct for RAM and ROM pages, writes only for RAM pages without translated code
+	unsigned char* readPages[RAM_PAGE_COUNT];
+	unsigned char* writePages[RAM_PAGE_COUNT];
+
+	RAM_PageType pageTypes[RAM_PAGE_COUNT];
+	RAM_MmioHandler mmioHandlers[RAM_PAGE_COUNT];
+
+	// Number of translated code blocks touching each page.
+	// A write into a page with a non-zero counter is reported to the code write handler
+	unsigned short codePageCounters[RAM_PAGE_COUNT];
+	RAM_CodeWriteHandler codeWriteHandler;
+	void* codeWriteContext;
+
+	// Dirty page tracking since the last ram_snapshot or ram_restore of the snapshot with this id, 0 when off.
+	// A clean RAM page has no direct write pointer, the first write goes through the slow path and marks it dirty
+	int64_t trackedSnapshotId;
+	BOOL dirtyPages[RAM_PAGE_COUNT];
+	unsigned char dirtyPageList[RAM_PAGE_COUNT];
+	unsigned int dirtyPageCount;
+	// Set by ram_map_pages while tracking, the memory map is then compared on restore
+	BOOL mapChanged;
 } typedef RAM;
 
+// Returns NULL when the memory can not be allocated.
+// Every page starts as RAM
 RAM* init_ram();
 
-char read_memory_ram(RAM* ramPointer, unsigned short offset);
-void write_memory_ram(RAM* ramPointer, unsigned short offset, char byte);
+// Clears the memory and maps every page as RAM again, dirty page tracking stops.
+// Translation caches on the RAM have to be released first
+void ram_reset(RAM* ramPointer);
+
+// Remaps pageCount pages starting at firstPage, the backing store keeps its contents.
+// Translations covering a remapped page are dropped
+void ram_map_pages(RAM* ramPointer, unsigned int firstPage, unsigned int pageCount, RAM_PageType type);
+void ram_map_mmio(RAM* ramPointer, unsigned int firstPage, unsigned int pageCount, RAM_MmioHandler handler);
+
+// Code page tracking for the translation caches, a page with translated code leaves the direct write path
+void ram_add_code_page(RAM* ramPointer, unsigned int page);
+void ram_remove_code_page(RAM* ramPointer, unsigned int page);
+
+// Accesses to pages without a direct mapping
+char read_memory_slow(RAM* ramPointer, unsigned int offset);
+void write_memory_slow(RAM* ramPointer, unsigned int offset, char byte);
+
+// Single byte accessors.
+// Addresses wrap around the 64 KB space like on the 8080 bus, masking replaces the bounds check.
+// A direct page always points at its own slot of the backing store, so the page table entry only gates the access
+// and the byte comes from the flat array. The data load then does not wait for the table load
+static inline char read_memory_ram(RAM* ramPointer, unsigned int offset)
+{
+	offset &= RAM_ADDRESS_MASK;
+
+	if (ramPointer->readPages[offset / RAM_PAGE_SIZE] != NULL)
+	{
+		return (char) ramPointer->memory[offset];
+	}
+
+	return read_memory_slow(ramPointer, offset);
+}
+
+static inline void write_memory_ram(RAM* ramPointer, unsigned int offset, char byte)
+{
+	offset &= RAM_ADDRESS_MASK;
+
+	if (ramPointer->writePages[offset / RAM_PAGE_SIZE] != NULL)
+	{
+		ramPointer->memory[offset] = (unsigned char) byte;
+		return;
+	}
+
+	write_memory_slow(ramPointer, offset, byte);
+}
+
+// TRUE when instructions at the address can be decoded ahead of time, reading them has no side effects
+static inline BOOL ram_is_direct_read(RAM* ramPointer, unsigned int offset)
+{
+	return ramPointer->readPages[(offset & RAM_ADDRESS_MASK) / RAM_PAGE_SIZE] != NULL;
+}
+
+// Bulk copies into and out of the backing store, wrapping past 0xFFFF.
+// They ignore the page types, so ROM images are loaded like RAM. Fail when size exceeds the address space
+BOOL ram_load(RAM* ramPointer, unsigned short offset, const void* data, size_t size);
+BOOL ram_dump(RAM* ramPointer, unsigned short offset, void* buffer, size_t size);
+
+// Copies the memory and the memory map and starts tracking the pages written from now on.
+// Returns NULL when the copy can not be allocated
+RAM_Snapshot* ram_snapshot(RAM* ramPointer);
+
+// Puts the memory and the memory map back to the snapshot.
+// When the RAM tracks dirty pages against this snapshot only those pages are copied, otherwise the whole memory.
+// Tracking then continues against the snapshot
+void ram_restore(RAM* ramPointer, const RAM_Snapshot* snapshot);
+
+void free_ram_snapshot(RAM_Snapshot* snapshot);
 
-void free_ram(RAM* ramPointer);
+void free_ram(RAM* ramPointer);
\ No newline at end of file
@@ -2,21 +2,7 @@
 
 #include <stdint.h>
 
-struct Register8Bit
-{
-	char data;
-} typedef Register8Bit;
-
 struct Register16Bit
 {
 	uint16_t data;
-} typedef Register16Bit;
-
-struct FlagRegister
-{
-	int zeroFlag;
-	int signFlag;
-	int partyFlag;
-	int auxiliaryCarry;
-	char carryFlag;
-} typedef FlagRegister;
\ No newline at end of file
+} typedef Register16Bit;
\ No newline at end of file
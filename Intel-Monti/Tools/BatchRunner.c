@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "BatchRunner.h"
+#include "File.h"
+#include "Thread.h"
+
+// Work stealing over job index ranges.
+// Every worker owns a contiguous range [front, back) packed into one 64-bit word. The owner takes jobs from the front,
+// an idle worker steals the back half of another range, both with a compare-exchange on the same word.
+// Jobs are never added after the start, so once every range is empty the batch is done
+struct CPU_CACHE_LINE_ALIGNED BatchDeque
+{
+    volatile int64_t range;
+} typedef BatchDeque;
+
+struct Batch
+{
+    BatchJob* jobs;
+    BatchResult* results;
+    size_t jobCount;
+
+    BatchDeque* deques;
+    int workerCount;
+} typedef Batch;
+
+struct BatchWorker
+{
+    Batch* batch;
+    int index;
+} typedef BatchWorker;
+
+static int64_t pack_range(uint32_t front, uint32_t back)
+{
+    return (int64_t) (((uint64_t) back << 32) | front);
+}
+
+static uint32_t range_front(int64_t range)
+{
+    return (uint32_t) range;
+}
+
+static uint32_t range_back(int64_t range)
+{
+    return (uint32_t) ((uint64_t) range >> 32);
+}
+
+static BOOL pop_job(BatchDeque* deque, size_t* job)
+{
+    for (;;)
+    {
+        int64_t range = atomic_load_64(&deque->range);
+        uint32_t front = range_front(range);
+        uint32_t back = range_back(range);
+
+        if (front >= back)
+        {
+            return FALSE;
+        }
+
+        if (atomic_compare_exchange_64(&deque->range, range, pack_range(front + 1, back)))
+        {
+            *job = front;
+            return TRUE;
+        }
+    }
+}
+
+// Moves the back half of the first non-empty range into the empty deque of the worker
+static BOOL steal_jobs(Batch* batch, int thief)
+{
+    for (int i = 1; i < batch->workerCount; i++)
+    {
+        BatchDeque* victim = &batch->deques[(thief + i) % batch->workerCount];
+
+        for (;;)
+        {
+            int64_t range = atomic_load_64(&victim->range);
+            uint32_t front = range_front(range);
+            uint32_t back = range_back(range);
+
+            if (front >= back)
+            {
+                break;
+            }
+
+            uint32_t middle = back - (back - front + 1) / 2;
+
+            if (atomic_compare_exchange_64(&victim->range, range, pack_range(front, middle)))
+            {
+                atomic_store_64(&batch->deques[thief].range, pack_range(middle, back));
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+static void run_job(Emulator* emulator, const EmulatorSnapshot* clean, BatchJob* job, BatchResult* result)
+{
+    unsigned short entryPoint = 0;
+
+    // Only the pages the previous run touched are copied back
+    restore_emulator(emulator, clean);
+
+    result->loaded = load_image_file(emulator->ram, job->imagePath, job->format, job->origin, &entryPoint) == IMAGE_LOAD_OK;
+    if (!result->loaded)
+    {
+        return;
+    }
+
+    CPU* cpu = &emulator->cpu;
+
+    cpu->core = job->core;
+    cpu->programCounter.data = entryPoint;
+
+    // The output device collects into the result, a run stopped by its budget is flushed below
+    emulator->output->capture = &result->output;
+
+    if (job->cycleBudget == 0)
+    {
+        result->exitReason = cpu_run_until_halt(cpu, emulator->ram);
+    }
+    else
+    {
+        result->exitReason = cpu_run_cycles(cpu, emulator->ram, job->cycleBudget);
+    }
+
+    output_device_flush(emulator->output);
+    emulator->output->capture = NULL;
+
+    result->PSW = (uint16_t) ((cpu->A << 8) | pack_flags(cpu));
+    result->BC = cpu->BC;
+    result->DE = cpu->DE;
+    result->HL = cpu->HL;
+    result->stackPointer = cpu->stackPointer.data;
+    result->programCounter = cpu->programCounter.data;
+    result->cycles = cpu->cycles;
+}
+
+static int worker_main(void* argument)
+{
+    BatchWorker* worker = (BatchWorker*) argument;
+    Batch* batch = worker->batch;
+
+    // Each worker reuses one emulator for all its runs, nothing but the job ranges is shared
+    Emulator emulator = init_emulator();
+    EmulatorSnapshot* clean = emulator.ram != NULL && emulator.bus != NULL && emulator.output != NULL ? snapshot_emulator(&emulator) : NULL;
+
+    if (clean == NULL)
+    {
+        // The jobs stay in the deque and are stolen by the other workers
+        if (emulator.ram != NULL)
+        {
+            free_emulator(&emulator);
+        }
+        return 1;
+    }
+
+    for (;;)
+    {
+        size_t job;
+
+        if (pop_job(&batch->deques[worker->index], &job))
+        {
+            run_job(&emulator, clean, &batch->jobs[job], &batch->results[job]);
+            continue;
+        }
+
+        if (!steal_jobs(batch, worker->index))
+        {
+            break;
+        }
+    }
+
+    free_emulator_snapshot(clean);
+    free_emulator(&emulator);
+
+    return 0;
+}
+
+static BOOL is_blank(char character)
+{
+    return character == ' ' || character == '\t' || character == '\r' || character == '\n';
+}
+
+// Splits the next whitespace separated token off the line, returns NULL at the end
+static char* next_token(char** cursor)
+{
+    char* token = *cursor;
+
+    while (is_blank(*token))
+    {
+        token++;
+    }
+
+    if (*token == '\0' || *token == '#')
+    {
+        return NULL;
+    }
+
+    char* end = token;
+    while (*end != '\0' && !is_blank(*end))
+    {
+        end++;
+    }
+
+    *cursor = *end == '\0' ? end : end + 1;
+    *end = '\0';
+
+    return token;
+}
+
+static BOOL parse_job_option(BatchJob* job, char* option)
+{
+    char* value = strchr(option, '=');
+    if (value == NULL)
+    {
+        return FALSE;
+    }
+
+    *value++ = '\0';
+
+    char* end = NULL;
+
+    if (strcmp(option, "core") == 0)
+    {
+        return parse_cpu_core(value, &job->core);
+    }
+
+    if (strcmp(option, "format") == 0)
+    {
+        return parse_image_format(value, &job->format);
+    }
+
+    if (strcmp(option, "origin") == 0)
+    {
+        unsigned long origin = strtoul(value, &end, 0);
+        job->origin = (unsigned short) origin;
+
+        return *end == '\0' && origin <= RAM_ADDRESS_MASK;
+    }
+
+    if (strcmp(option, "cycles") == 0)
+    {
+        job->cycleBudget = strtoull(value, &end, 0);
+
+        return *end == '\0';
+    }
+
+    return FALSE;
+}
+
+// Returns the number of jobs or -1 when the manifest can not be used, printing the reason
+static long read_manifest(const char* path, CPU_Core defaultCore, BatchJob** jobs)
+{
+    FILE* file = open_file(path, "r");
+    if (file == NULL)
+    {
+        printf("%s\n", "[ERROR] Can not open manifest");
+        return -1;
+    }
+
+    size_t count = 0;
+    size_t capacity = 0;
+    int lineNumber = 0;
+    BOOL valid = TRUE;
+    char line[BATCH_MAX_PATH + 256];
+
+    *jobs = NULL;
+
+    while (valid && fgets(line, sizeof(line), file) != NULL)
+    {
+        lineNumber++;
+
+        char* cursor = line;
+        char* path = next_token(&cursor);
+        if (path == NULL)
+        {
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+
+            BatchJob* grown = (BatchJob*) realloc(*jobs, capacity * sizeof(BatchJob));
+            if (grown == NULL)
+            {
+                printf("%s\n", "[ERROR] Out of memory reading manifest");
+                valid = FALSE;
+                break;
+            }
+
+            *jobs = grown;
+        }
+
+        BatchJob* job = &(*jobs)[count++];
+
+        job->origin = 0;
+        job->format = IMAGE_FORMAT_AUTO;
+        job->core = defaultCore;
+        job->cycleBudget = 0;
+
+        valid = strlen(path) < BATCH_MAX_PATH;
+        if (valid)
+        {
+            strcpy(job->imagePath, path);
+        }
+
+        for (char* option = next_token(&cursor); option != NULL && valid; option = next_token(&cursor))
+        {
+            valid = parse_job_option(job, option);
+        }
+
+        if (!valid)
+        {
+            printf("[ERROR] Invalid manifest line %d\n", lineNumber);
+        }
+    }
+
+    fclose(file);
+
+    if (!valid)
+    {
+        free(*jobs);
+        *jobs = NULL;
+        return -1;
+    }
+
+    return (long) count;
+}
+
+static void print_result(size_t index, BatchJob* job, BatchResult* result)
+{
+    if (!result->loaded)
+    {
+        printf("[RUN] %zu %s error\n", index, job->imagePath);
+        return;
+    }
+
+    printf("[RUN] %zu %s %s cycles=%llu PSW=%04X BC=%04X DE=%04X HL=%04X SP=%04X PC=%04X output=",
+        index,
+        job->imagePath,
+        cpu_exit_reason_name(result->exitReason),
+        (unsigned long long) result->cycles,
+        result->PSW,
+        result->BC,
+        result->DE,
+        result->HL,
+        result->stackPointer,
+        result->programCounter);
+
+    for (size_t i = 0; i < result->output.size; i++)
+    {
+        printf("%02X", result->output.data[i]);
+    }
+
+    if (result->output.dropped != 0)
+    {
+        printf(" dropped=%zu", result->output.dropped);
+    }
+
+    printf("\n");
+}
+
+static double wall_seconds()
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+
+    return (double) now.tv_sec + now.tv_nsec / 1e9;
+}
+
+BOOL run_batch(const char* manifestPath, CPU_Core defaultCore, int threadCount)
+{
+    BatchJob* jobs = NULL;
+    long jobCount = read_manifest(manifestPath, defaultCore, &jobs);
+    if (jobCount < 0)
+    {
+        return FALSE;
+    }
+
+    if (threadCount > jobCount)
+    {
+        threadCount = (int) jobCount;
+    }
+    if (threadCount < 1)
+    {
+        threadCount = 1;
+    }
+
+    Batch batch;
+    batch.jobs = jobs;
+    batch.jobCount = (size_t) jobCount;
+    batch.workerCount = threadCount;
+    batch.results = (BatchResult*) calloc(batch.jobCount > 0 ? batch.jobCount : 1, sizeof(BatchResult));
+    batch.deques = (BatchDeque*) calloc((size_t) threadCount, sizeof(BatchDeque));
+    BatchWorker* workers = (BatchWorker*) calloc((size_t) threadCount, sizeof(BatchWorker));
+    Thread** threads = (Thread**) calloc((size_t) threadCount, sizeof(Thread*));
+
+    if (batch.results == NULL || batch.deques == NULL || workers == NULL || threads == NULL)
+    {
+        printf("%s\n", "[ERROR] Out of memory starting batch");
+        free(batch.results);
+        free(batch.deques);
+        free(workers);
+        free(threads);
+        free(jobs);
+        return FALSE;
+    }
+
+    for (size_t job = 0; job < batch.jobCount; job++)
+    {
+        batch.results[job].output = init_output_capture(BATCH_OUTPUT_LIMIT);
+    }
+
+    // Equal contiguous shares to start with, stealing evens out runs of different length
+    for (int worker = 0; worker < threadCount; worker++)
+    {
+        uint32_t front = (uint32_t) (batch.jobCount * worker / threadCount);
+        uint32_t back = (uint32_t) (batch.jobCount * (worker + 1) / threadCount);
+
+        batch.deques[worker].range = pack_range(front, back);
+        workers[worker].batch = &batch;
+        workers[worker].index = worker;
+    }
+
+    double begin = wall_seconds();
+
+    // The calling thread is worker 0. Jobs of a worker whose thread fails to start are stolen by the others
+    for (int worker = 1; worker < threadCount; worker++)
+    {
+        threads[worker] = thread_start(worker_main, &workers[worker]);
+    }
+
+    worker_main(&workers[0]);
+
+    for (int worker = 1; worker < threadCount; worker++)
+    {
+        if (threads[worker] != NULL)
+        {
+            thread_join(threads[worker]);
+        }
+    }
+
+    double seconds = wall_seconds() - begin;
+
+    size_t failed = 0;
+    uint64_t cycles = 0;
+
+    for (size_t job = 0; job < batch.jobCount; job++)
+    {
+        print_result(job, &jobs[job], &batch.results[job]);
+
+        failed += !batch.results[job].loaded;
+        cycles += batch.results[job].cycles;
+
+        free_output_capture(&batch.results[job].output);
+    }
+
+    printf("[BATCH] %zu runs, %zu failed, %llu T-states on %d threads in %.3f s, %.1f runs/s\n",
+        batch.jobCount,
+        failed,
+        (unsigned long long) cycles,
+        threadCount,
+        seconds,
+        seconds > 0 ? batch.jobCount / seconds : 0.0);
+
+    free(batch.results);
+    free(batch.deques);
+    free(workers);
+    free(threads);
+    free(jobs);
+
+    return TRUE;
+}
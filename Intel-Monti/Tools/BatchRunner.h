@@ -0,0 +1,42 @@
+#pragma once
+
+#include "../emulator.h"
+
+// Captured output of one run is cut off after this many bytes
+#define BATCH_OUTPUT_LIMIT (64 * 1024)
+#define BATCH_MAX_PATH 512
+
+// One manifest line: <image path> [origin=N] [format=name] [core=name] [cycles=N]
+struct BatchJob
+{
+	char imagePath[BATCH_MAX_PATH];
+	unsigned short origin;
+	ImageFormat format;
+	CPU_Core core;
+
+	// T-state budget of the run, 0 runs until HLT
+	uint64_t cycleBudget;
+} typedef BatchJob;
+
+struct BatchResult
+{
+	// FALSE when the image could not be read, nothing ran
+	BOOL loaded;
+	CPU_ExitReason exitReason;
+
+	// Final state of the run
+	uint16_t PSW;
+	uint16_t BC;
+	uint16_t DE;
+	uint16_t HL;
+	uint16_t stackPointer;
+	uint16_t programCounter;
+	uint64_t cycles;
+
+	OutputCapture output;
+} typedef BatchResult;
+
+// Runs every manifest line on threadCount worker threads, each with its own emulator,
+// and prints one result line per run in manifest order.
+// Returns FALSE when the manifest can not be read
+BOOL run_batch(const char* manifestPath, CPU_Core defaultCore, int threadCount);
\ No newline at end of file
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <time.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "Benchmark.h"
+#include "../CPU/Flags.h"
+#include "../CPU/Lockstep.h"
+
+// Guest program: 256 outer passes over a 65536-iteration inner loop of six instructions
+//
+// 0000: MVI D, 0      ; outer counter, wraps to 256 passes
+// 0002: LXI H, 0      ; outer: inner counter, wraps to 65536 passes
+// 0005: ADD C         ; inner:
+// 0006: INR C
+// 0007: DCX H
+// 0008: MOV A, H
+// 0009: ORA L
+// 000A: JNZ inner
+// 000D: DCR D
+// 000E: JNZ outer
+// 0011: HLT
+static const unsigned char benchmarkProgram[] =
+{
+    0x16, 0x00,
+    0x21, 0x00, 0x00,
+    0x81,
+    0x0c,
+    0x2b,
+    0x7c,
+    0xb5,
+    0xc2, 0x05, 0x00,
+    0x15,
+    0xc2, 0x02, 0x00,
+    0x76
+};
+
+#define BENCHMARK_OUTER_PASSES 256ULL
+#define BENCHMARK_INNER_PASSES 65536ULL
+#define BENCHMARK_INNER_LENGTH 6ULL
+
+// MVI D and HLT, plus LXI H / DCR D / JNZ outer per outer pass
+#define BENCHMARK_INSTRUCTIONS (2 + BENCHMARK_OUTER_PASSES * (3 + BENCHMARK_INNER_PASSES * BENCHMARK_INNER_LENGTH))
+
+void run_core_benchmark()
+{
+    RAM* ram = init_ram();
+
+    ram_load(ram, 0, benchmarkProgram, sizeof(benchmarkProgram));
+
+    for (int core = 0; core < CPU_CORE_COUNT; core++)
+    {
+        CPU cpu = init_cpu();
+        cpu.core = (CPU_Core) core;
+
+        clock_t begin = clock();
+        cpu_run_until_halt(&cpu, ram);
+        double seconds = (double) (clock() - begin) / CLOCKS_PER_SEC;
+
+        free_cpu(&cpu);
+
+        printf("[BENCHMARK] %-8s %llu instructions in %.3f s, %.1f guest MIPS\n",
+            cpu_core_name((CPU_Core) core),
+            BENCHMARK_INSTRUCTIONS,
+            seconds,
+            seconds > 0 ? BENCHMARK_INSTRUCTIONS / seconds / 1e6 : 0.0);
+    }
+
+    free_ram(ram);
+}
+
+// Time stamp counter where available, otherwise clock ticks scaled to nanoseconds
+static uint64_t read_cycle_counter()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t) clock() * (1000000000ULL / CLOCKS_PER_SEC);
+#endif
+}
+
+#define ALU_BENCHMARK_PASSES 64
+
+// ADD with the flag computation the handlers used before the lookup table
+static unsigned char add_with_bit_loops(unsigned char* flags, unsigned char accumulator, unsigned char value)
+{
+    uint16_t result = accumulator + value;
+
+    *flags = (unsigned char) ((((unsigned char) result == 0) ? FLAG_ZERO : 0)
+        | (((unsigned char) result >> 7) ? FLAG_SIGN : 0)
+        | (is_bits_even((unsigned char) result) ? FLAG_PARITY : 0)
+        | (is_auxiliary_carry_set(accumulator ^ value ^ result) ? FLAG_AUXILIARY_CARRY : 0)
+        | FLAG_RESERVED
+        | ((result >> 8) & 1));
+
+    return (unsigned char) result;
+}
+
+// ADD with the flag lookup table and branch-free carries
+static unsigned char add_with_table(unsigned char* flags, unsigned char accumulator, unsigned char value)
+{
+    uint16_t result = accumulator + value;
+
+    *flags = (unsigned char) (zero_sign_parity_flags[(unsigned char) result]
+        | ((accumulator ^ value ^ result) & FLAG_AUXILIARY_CARRY)
+        | FLAG_RESERVED
+        | ((result >> 8) & 1));
+
+    return (unsigned char) result;
+}
+
+typedef unsigned char (*AluBenchmarkOperation)(unsigned char* flags, unsigned char accumulator, unsigned char value);
+
+static double measure_alu_operation(AluBenchmarkOperation operation)
+{
+    volatile int sink = 0;
+    unsigned char flags = 0;
+    unsigned char accumulator = 0;
+
+    uint64_t begin = read_cycle_counter();
+
+    // Every operand pair, the accumulator is fed back so the results can not be precomputed
+    for (int pass = 0; pass < ALU_BENCHMARK_PASSES; pass++)
+    {
+        for (int value = 0; value < 65536; value++)
+        {
+            accumulator = operation(&flags, (unsigned char) (accumulator ^ value), (unsigned char) (value >> 8));
+            sink += flags & (FLAG_PARITY | FLAG_AUXILIARY_CARRY);
+        }
+    }
+
+    uint64_t cycles = read_cycle_counter() - begin;
+
+    return (double) cycles / (ALU_BENCHMARK_PASSES * 65536.0);
+}
+
+void run_alu_benchmark()
+{
+    printf("[BENCHMARK] ALU flags with bit loops:    %.2f cycles per ADD\n", measure_alu_operation(add_with_bit_loops));
+    printf("[BENCHMARK] ALU flags with lookup table: %.2f cycles per ADD\n", measure_alu_operation(add_with_table));
+}
+
+// Guest program for the lockstep benchmark: the control flow is the same in every lane, the data is not
+//
+// 0000: MVI D, 16     ; outer counter
+// 0002: LXI H, 4096   ; outer: inner counter
+// 0005: ADD C         ; inner:
+// 0006: XRA B
+// 0007: RLC
+// 0008: INR C
+// 0009: DCX H
+// 000A: MOV E, A      ; keeps the accumulator while HL is tested
+// 000B: MOV A, H
+// 000C: ORA L
+// 000D: MOV A, E
+// 000E: JNZ inner
+// 0011: DCR D
+// 0012: JNZ outer
+// 0015: HLT
+static const unsigned char lockstepProgram[] =
+{
+    0x16, 0x10,
+    0x21, 0x00, 0x10,
+    0x81,
+    0xa8,
+    0x07,
+    0x0c,
+    0x2b,
+    0x5f,
+    0x7c,
+    0xb5,
+    0x7b,
+    0xc2, 0x05, 0x00,
+    0x15,
+    0xc2, 0x02, 0x00,
+    0x76
+};
+
+#define LOCKSTEP_BENCHMARK_LANES 256
+#define LOCKSTEP_BENCHMARK_INSTRUCTIONS (2ULL + 16ULL * (3ULL + 4096ULL * 10ULL))
+
+// Different inputs for every lane
+static void set_lockstep_inputs(CPU* cpu, int lane)
+{
+    cpu->A = (unsigned char) (lane * 13);
+    cpu->B = (unsigned char) lane;
+    cpu->C = (unsigned char) (lane * 7);
+}
+
+static BOOL same_final_state(CPU* first, CPU* second)
+{
+    return first->A == second->A && first->BC == second->BC && first->DE == second->DE && first->HL == second->HL
+        && pack_flags(first) == pack_flags(second) && first->programCounter.data == second->programCounter.data
+        && first->cycles == second->cycles && first->halted == second->halted;
+}
+
+static void print_lane_throughput(const char* name, double seconds)
+{
+    double laneInstructions = (double) LOCKSTEP_BENCHMARK_LANES * LOCKSTEP_BENCHMARK_INSTRUCTIONS;
+
+    printf("[BENCHMARK] %-16s %d lanes in %.3f s, %.1f million lane instructions/s\n",
+        name,
+        LOCKSTEP_BENCHMARK_LANES,
+        seconds,
+        seconds > 0 ? laneInstructions / seconds / 1e6 : 0.0);
+}
+
+void run_lockstep_benchmark()
+{
+    LockstepEngine* engine = init_lockstep(LOCKSTEP_BENCHMARK_LANES);
+    if (engine == NULL)
+    {
+        printf("%s\n", "[ERROR] Can not allocate the lockstep lanes");
+        return;
+    }
+
+    lockstep_load_shared(engine, 0, lockstepProgram, sizeof(lockstepProgram));
+
+    for (int lane = 0; lane < LOCKSTEP_BENCHMARK_LANES; lane++)
+    {
+        set_lockstep_inputs(&engine->lanes[lane], lane);
+    }
+
+    clock_t begin = clock();
+    lockstep_run_until_halt(engine, CPU_CORE_THREADED);
+    double seconds = (double) (clock() - begin) / CLOCKS_PER_SEC;
+
+    print_lane_throughput(engine->useAvx2 ? "lockstep avx2" : "lockstep", seconds);
+    printf("[BENCHMARK] %llu of %llu lane instructions in lockstep, %d lanes peeled\n",
+        (unsigned long long) engine->lockstepInstructions,
+        (unsigned long long) (LOCKSTEP_BENCHMARK_LANES * LOCKSTEP_BENCHMARK_INSTRUCTIONS),
+        engine->peeledLanes);
+
+    // The same lanes as independent emulators, one after another on every scalar core
+    RAM* ram = init_ram();
+    ram_load(ram, 0, lockstepProgram, sizeof(lockstepProgram));
+
+    for (int core = 0; core < CPU_CORE_COUNT; core++)
+    {
+        BOOL matches = TRUE;
+
+        begin = clock();
+
+        for (int lane = 0; lane < LOCKSTEP_BENCHMARK_LANES; lane++)
+        {
+            CPU cpu = init_cpu();
+            cpu.core = (CPU_Core) core;
+            set_lockstep_inputs(&cpu, lane);
+
+            cpu_run_until_halt(&cpu, ram);
+
+            matches = matches && same_final_state(&cpu, &engine->lanes[lane]);
+            free_cpu(&cpu);
+        }
+
+        seconds = (double) (clock() - begin) / CLOCKS_PER_SEC;
+
+        print_lane_throughput(cpu_core_name((CPU_Core) core), seconds);
+
+        if (!matches)
+        {
+            printf("%s\n", "[ERROR] Lockstep lanes differ from the scalar core");
+        }
+    }
+
+    free_ram(ram);
+    free_lockstep(engine);
+}
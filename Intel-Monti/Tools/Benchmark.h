@@ -0,0 +1,13 @@
+#pragma once
+
+#include "../CPU/cpu.h"
+
+// Runs a fixed guest loop on every dispatch core and prints the achieved guest MIPS
+void run_core_benchmark();
+
+// Measures host cycles per ALU flag update with the bit counting helpers and with the flag lookup table
+void run_alu_benchmark();
+
+// Runs many instances of one program in lockstep and as independent emulators on every core,
+// printing lane instructions per second of both and checking that the final states agree
+void run_lockstep_benchmark();
\ No newline at end of file
@@ -1,6 +1,6 @@
 #include "BitOperation.h"
 
-BOOL is_bits_even(char number)
+BOOL is_bits_even(unsigned char number)
 {
     int count = 0;
     while (number) {
@@ -8,7 +8,7 @@ BOOL is_bits_even(char number)
         number >>= 1;
     }
 
-    return count % 2;
+    return count % 2 == 0;
 }
 
 BOOL is_auxiliary_carry_set(int result) 
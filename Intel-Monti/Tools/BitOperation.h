@@ -2,8 +2,8 @@
 
 #include "Bool.h"
 
-// Function to check the parity of the bits in a number
-BOOL is_bits_even(char number);
+// Function to check the parity of the bits in a number (TRUE when the number of set bits is even)
+BOOL is_bits_even(unsigned char number);
 
 // Function to check if the Auxiliary Carry (AC) flag is set
 BOOL is_auxiliary_carry_set(int result);
@@ -0,0 +1,208 @@
+#include <string.h>
+
+#include "Compression.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+static uint32_t read_32(const uint8_t* data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint32_t hash_32(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes the part of a length above 14 as a run of 255 bytes and the rest
+static uint8_t* write_length(uint8_t* output, size_t length)
+{
+    while (length >= 255)
+    {
+        *output++ = 255;
+        length -= 255;
+    }
+
+    *output++ = (uint8_t) length;
+    return output;
+}
+
+size_t lz_compress_bound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+// Emits literals and, unless matchLength is 0, the match behind them. Returns NULL when capacity runs out
+static uint8_t* write_sequence(uint8_t* output, const uint8_t* outputEnd, const uint8_t* literals, size_t literalCount,
+    size_t offset, size_t matchLength)
+{
+    // Token, length bytes, literals, offset
+    if ((size_t) (outputEnd - output) < 1 + literalCount / 255 + 1 + literalCount + 2 + matchLength / 255 + 1)
+    {
+        return NULL;
+    }
+
+    uint8_t* token = output++;
+    size_t matchCode = matchLength != 0 ? matchLength - LZ_MIN_MATCH : 0;
+
+    *token = (uint8_t) (((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+
+    if (literalCount >= 15)
+    {
+        output = write_length(output, literalCount - 15);
+    }
+
+    memcpy(output, literals, literalCount);
+    output += literalCount;
+
+    if (matchLength == 0)
+    {
+        return output;
+    }
+
+    *output++ = (uint8_t) offset;
+    *output++ = (uint8_t) (offset >> 8);
+
+    if (matchCode >= 15)
+    {
+        output = write_length(output, matchCode - 15);
+    }
+
+    return output;
+}
+
+size_t lz_compress(const uint8_t* input, size_t size, uint8_t* output, size_t capacity)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t* outputEnd = output + capacity;
+    uint8_t* cursor = output;
+    size_t literalStart = 0;
+    size_t position = 0;
+
+    while (position + LZ_MIN_MATCH <= size)
+    {
+        uint32_t value = read_32(input + position);
+        uint32_t hash = hash_32(value);
+        // Positions are stored plus one, 0 marks an empty slot
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t) (position + 1);
+
+        if (candidate == 0 || position - (candidate - 1) > LZ_MAX_OFFSET || read_32(input + candidate - 1) != value)
+        {
+            position++;
+            continue;
+        }
+
+        candidate--;
+
+        size_t matchLength = LZ_MIN_MATCH;
+        while (position + matchLength < size && input[candidate + matchLength] == input[position + matchLength])
+        {
+            matchLength++;
+        }
+
+        cursor = write_sequence(cursor, outputEnd, input + literalStart, position - literalStart, position - candidate, matchLength);
+        if (cursor == NULL)
+        {
+            return 0;
+        }
+
+        position += matchLength;
+        literalStart = position;
+    }
+
+    cursor = write_sequence(cursor, outputEnd, input + literalStart, size - literalStart, 0, 0);
+    if (cursor == NULL)
+    {
+        return 0;
+    }
+
+    return (size_t) (cursor - output);
+}
+
+// Adds the length bytes that follow a nibble of 15. Returns FALSE when the input ends inside them
+static BOOL read_length(const uint8_t** input, const uint8_t* inputEnd, size_t* length)
+{
+    uint8_t part;
+
+    do
+    {
+        if (*input == inputEnd)
+        {
+            return FALSE;
+        }
+
+        part = *(*input)++;
+        *length += part;
+    } while (part == 255);
+
+    return TRUE;
+}
+
+BOOL lz_decompress(const uint8_t* input, size_t size, uint8_t* output, size_t outputSize)
+{
+    const uint8_t* inputEnd = input + size;
+    size_t position = 0;
+
+    while (input < inputEnd)
+    {
+        uint8_t token = *input++;
+        size_t literalCount = token >> 4;
+
+        if (literalCount == 15 && !read_length(&input, inputEnd, &literalCount))
+        {
+            return FALSE;
+        }
+
+        if (literalCount > (size_t) (inputEnd - input) || literalCount > outputSize - position)
+        {
+            return FALSE;
+        }
+
+        memcpy(output + position, input, literalCount);
+        input += literalCount;
+        position += literalCount;
+
+        // The last sequence carries no match
+        if (input == inputEnd)
+        {
+            break;
+        }
+
+        if (inputEnd - input < 2)
+        {
+            return FALSE;
+        }
+
+        size_t offset = input[0] | (input[1] << 8);
+        input += 2;
+
+        size_t matchLength = token & 0x0f;
+        if (matchLength == 15 && !read_length(&input, inputEnd, &matchLength))
+        {
+            return FALSE;
+        }
+        matchLength += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > position || matchLength > outputSize - position)
+        {
+            return FALSE;
+        }
+
+        // Byte by byte, a match may overlap the bytes it produces
+        for (size_t i = 0; i < matchLength; i++)
+        {
+            output[position + i] = output[position - offset + i];
+        }
+
+        position += matchLength;
+    }
+
+    return position == outputSize;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Bool.h"
+
+// Byte-oriented LZ77 block compression in the spirit of LZ4: fast enough to keep up with a writer thread,
+// no dictionary between blocks and no dependencies.
+// A block is a run of sequences, each a token (literal count in the high nibble, match length - 4 in the low one),
+// extra length bytes for counts of 15 and more, the literals, then a 16-bit offset and the extra match length bytes.
+// The last sequence has literals only
+
+// Largest compressed size of size input bytes
+size_t lz_compress_bound(size_t size);
+
+// Returns the compressed size, or 0 when it does not fit into capacity bytes
+size_t lz_compress(const uint8_t* input, size_t size, uint8_t* output, size_t capacity);
+
+// Returns FALSE when the block is damaged or does not expand to exactly outputSize bytes
+BOOL lz_decompress(const uint8_t* input, size_t size, uint8_t* output, size_t outputSize);
\ No newline at end of file
@@ -0,0 +1,122 @@
+#if defined(_WIN32)
+// Included before Bool.h, which redefines BOOL for the emulator code
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "File.h"
+
+FILE* open_file(const char* path, const char* mode)
+{
+#if defined(_MSC_VER)
+    FILE* file = NULL;
+    return fopen_s(&file, path, mode) == 0 ? file : NULL;
+#else
+    return fopen(path, mode);
+#endif
+}
+
+BOOL map_file(const char* path, MappedFile* file)
+{
+    file->data = NULL;
+    file->size = 0;
+    file->mapping = NULL;
+
+#if defined(_WIN32)
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return FALSE;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size))
+    {
+        CloseHandle(handle);
+        return FALSE;
+    }
+
+    // An empty file can not be mapped, it simply has no data
+    if (size.QuadPart == 0)
+    {
+        CloseHandle(handle);
+        return TRUE;
+    }
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(handle);
+
+    if (mapping == NULL)
+    {
+        return FALSE;
+    }
+
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL)
+    {
+        CloseHandle(mapping);
+        return FALSE;
+    }
+
+    file->data = (const unsigned char*) view;
+    file->size = (size_t) size.QuadPart;
+    file->mapping = mapping;
+#else
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0)
+    {
+        return FALSE;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || !S_ISREG(status.st_mode))
+    {
+        close(descriptor);
+        return FALSE;
+    }
+
+    if (status.st_size == 0)
+    {
+        close(descriptor);
+        return TRUE;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    void* view = mmap(NULL, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+
+    if (view == MAP_FAILED)
+    {
+        return FALSE;
+    }
+
+    file->data = (const unsigned char*) view;
+    file->size = (size_t) status.st_size;
+#endif
+
+    return TRUE;
+}
+
+void unmap_file(MappedFile* file)
+{
+    if (file->data == NULL)
+    {
+        return;
+    }
+
+#if defined(_WIN32)
+    UnmapViewOfFile(file->data);
+    CloseHandle((HANDLE) file->mapping);
+#else
+    munmap((void*) file->data, file->size);
+#endif
+
+    file->data = NULL;
+    file->size = 0;
+    file->mapping = NULL;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "Bool.h"
+
+// Host file access behind one small API, Win32 on Windows and POSIX elsewhere
+
+// fopen without the deprecation warnings of MSVC, returns NULL when the file can not be opened
+FILE* open_file(const char* path, const char* mode);
+
+// Read-only view of a whole file
+struct MappedFile
+{
+	// NULL for an empty file
+	const unsigned char* data;
+	size_t size;
+
+	// Host handles of the mapping
+	void* mapping;
+} typedef MappedFile;
+
+// Maps the file into the address space instead of reading it, returns FALSE when it can not be opened or mapped
+BOOL map_file(const char* path, MappedFile* file);
+void unmap_file(MappedFile* file);
\ No newline at end of file
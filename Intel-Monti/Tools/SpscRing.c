@@ -0,0 +1,26 @@
+#include <stdlib.h>
+
+#include "SpscRing.h"
+
+BOOL init_spsc_ring(SpscRing* ring, size_t capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        return FALSE;
+    }
+
+    ring->data = (unsigned char*) malloc(capacity);
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->cachedTail = 0;
+    ring->tail = 0;
+    ring->cachedHead = 0;
+
+    return ring->data != NULL;
+}
+
+void free_spsc_ring(SpscRing* ring)
+{
+    free(ring->data);
+    ring->data = NULL;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "Thread.h"
+
+// Bounded lock-free byte queue between exactly one producer thread and one consumer thread.
+// Both positions only grow and are masked on access. Each side keeps a copy of the other side's position
+// and only reloads it when the copy says the ring is full or empty
+struct SpscRing
+{
+	unsigned char* data;
+	size_t mask;
+
+	// Producer side
+	THREAD_CACHE_LINE_ALIGNED volatile int64_t head;
+	int64_t cachedTail;
+
+	// Consumer side
+	THREAD_CACHE_LINE_ALIGNED volatile int64_t tail;
+	int64_t cachedHead;
+} typedef SpscRing;
+
+// The capacity has to be a power of two. Returns FALSE when the buffer can not be allocated
+BOOL init_spsc_ring(SpscRing* ring, size_t capacity);
+void free_spsc_ring(SpscRing* ring);
+
+// Producer: TRUE when a push would fail
+static inline BOOL spsc_ring_full(SpscRing* ring)
+{
+	if ((size_t) (ring->head - ring->cachedTail) <= ring->mask)
+	{
+		return FALSE;
+	}
+
+	ring->cachedTail = atomic_load_acquire_64(&ring->tail);
+
+	return (size_t) (ring->head - ring->cachedTail) > ring->mask;
+}
+
+// Producer: returns FALSE when the ring is full
+static inline BOOL spsc_ring_push(SpscRing* ring, unsigned char value)
+{
+	if (spsc_ring_full(ring))
+	{
+		return FALSE;
+	}
+
+	int64_t head = ring->head;
+
+	ring->data[(size_t) head & ring->mask] = value;
+	atomic_store_release_64(&ring->head, head + 1);
+
+	return TRUE;
+}
+
+// Producer: bytes pushed and not taken yet
+static inline size_t spsc_ring_size(SpscRing* ring)
+{
+	ring->cachedTail = atomic_load_acquire_64(&ring->tail);
+
+	return (size_t) (ring->head - ring->cachedTail);
+}
+
+// Producer: TRUE when the consumer took everything pushed so far
+static inline BOOL spsc_ring_drained(SpscRing* ring)
+{
+	return atomic_load_acquire_64(&ring->tail) == ring->head;
+}
+
+// Consumer: returns FALSE when the ring is empty
+static inline BOOL spsc_ring_pop(SpscRing* ring, unsigned char* value)
+{
+	int64_t tail = ring->tail;
+
+	if (tail == ring->cachedHead)
+	{
+		ring->cachedHead = atomic_load_acquire_64(&ring->head);
+
+		if (tail == ring->cachedHead)
+		{
+			return FALSE;
+		}
+	}
+
+	*value = ring->data[(size_t) tail & ring->mask];
+	atomic_store_release_64(&ring->tail, tail + 1);
+
+	return TRUE;
+}
+
+// Consumer: points data at the longest contiguous run of queued bytes and returns its length.
+// The bytes stay queued until spsc_ring_consume
+static inline size_t spsc_ring_peek(SpscRing* ring, const unsigned char** data)
+{
+	int64_t tail = ring->tail;
+
+	ring->cachedHead = atomic_load_acquire_64(&ring->head);
+
+	size_t offset = (size_t) tail & ring->mask;
+	size_t size = (size_t) (ring->cachedHead - tail);
+
+	if (size > ring->mask + 1 - offset)
+	{
+		size = ring->mask + 1 - offset;
+	}
+
+	*data = ring->data + offset;
+	return size;
+}
+
+static inline void spsc_ring_consume(SpscRing* ring, size_t count)
+{
+	atomic_store_release_64(&ring->tail, ring->tail + (int64_t) count);
+}
\ No newline at end of file
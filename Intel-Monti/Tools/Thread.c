@@ -0,0 +1,224 @@
+#if defined(_WIN32)
+// Included before Bool.h, which redefines BOOL for the emulator code
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <stdlib.h>
+
+#include "Thread.h"
+
+struct Thread
+{
+#if defined(_WIN32)
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+
+    ThreadFunction function;
+    void* argument;
+};
+
+struct ThreadEvent
+{
+#if defined(_WIN32)
+    SRWLOCK lock;
+    CONDITION_VARIABLE condition;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t condition;
+#endif
+
+    // Guarded by lock, set by a signal nobody consumed yet
+    BOOL signalled;
+};
+
+#if defined(_WIN32)
+static DWORD WINAPI thread_entry(LPVOID parameter)
+{
+    Thread* thread = (Thread*) parameter;
+    return (DWORD) thread->function(thread->argument);
+}
+#else
+static void* thread_entry(void* parameter)
+{
+    Thread* thread = (Thread*) parameter;
+    thread->function(thread->argument);
+    return NULL;
+}
+#endif
+
+Thread* thread_start(ThreadFunction function, void* argument)
+{
+    Thread* thread = (Thread*) malloc(sizeof(Thread));
+    if (thread == NULL)
+    {
+        return NULL;
+    }
+
+    thread->function = function;
+    thread->argument = argument;
+
+#if defined(_WIN32)
+    thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+    if (thread->handle == NULL)
+    {
+        free(thread);
+        return NULL;
+    }
+#else
+    if (pthread_create(&thread->handle, NULL, thread_entry, thread) != 0)
+    {
+        free(thread);
+        return NULL;
+    }
+#endif
+
+    return thread;
+}
+
+void thread_join(Thread* thread)
+{
+#if defined(_WIN32)
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->handle, NULL);
+#endif
+
+    free(thread);
+}
+
+int thread_hardware_concurrency()
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int count = (int) info.dwNumberOfProcessors;
+#else
+    int count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return count > 0 ? count : 1;
+}
+
+void thread_yield()
+{
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+void thread_sleep_microseconds(unsigned int microseconds)
+{
+#if defined(_WIN32)
+    // The Win32 sleep granularity is a millisecond at best
+    Sleep((microseconds + 999) / 1000);
+#else
+    usleep(microseconds);
+#endif
+}
+
+double monotonic_seconds()
+{
+#if defined(_WIN32)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+ThreadEvent* init_thread_event()
+{
+    ThreadEvent* event = (ThreadEvent*) malloc(sizeof(ThreadEvent));
+    if (event == NULL)
+    {
+        return NULL;
+    }
+
+    event->signalled = FALSE;
+
+#if defined(_WIN32)
+    InitializeSRWLock(&event->lock);
+    InitializeConditionVariable(&event->condition);
+#else
+    if (pthread_mutex_init(&event->lock, NULL) != 0)
+    {
+        free(event);
+        return NULL;
+    }
+
+    if (pthread_cond_init(&event->condition, NULL) != 0)
+    {
+        pthread_mutex_destroy(&event->lock);
+        free(event);
+        return NULL;
+    }
+#endif
+
+    return event;
+}
+
+void free_thread_event(ThreadEvent* event)
+{
+#if !defined(_WIN32)
+    pthread_cond_destroy(&event->condition);
+    pthread_mutex_destroy(&event->lock);
+#endif
+
+    free(event);
+}
+
+void thread_event_signal(ThreadEvent* event)
+{
+#if defined(_WIN32)
+    AcquireSRWLockExclusive(&event->lock);
+    event->signalled = TRUE;
+    ReleaseSRWLockExclusive(&event->lock);
+    WakeConditionVariable(&event->condition);
+#else
+    pthread_mutex_lock(&event->lock);
+    event->signalled = TRUE;
+    pthread_mutex_unlock(&event->lock);
+    pthread_cond_signal(&event->condition);
+#endif
+}
+
+void thread_event_wait(ThreadEvent* event)
+{
+    // The flag is checked in a loop, condition variables may wake up spuriously
+#if defined(_WIN32)
+    AcquireSRWLockExclusive(&event->lock);
+    while (!event->signalled)
+    {
+        SleepConditionVariableSRW(&event->condition, &event->lock, INFINITE, 0);
+    }
+    event->signalled = FALSE;
+    ReleaseSRWLockExclusive(&event->lock);
+#else
+    pthread_mutex_lock(&event->lock);
+    while (!event->signalled)
+    {
+        pthread_cond_wait(&event->condition, &event->lock);
+    }
+    event->signalled = FALSE;
+    pthread_mutex_unlock(&event->lock);
+#endif
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "Bool.h"
+
+// Keeps data written by different threads on separate cache lines
+#if defined(_MSC_VER)
+#define THREAD_CACHE_LINE_ALIGNED __declspec(align(64))
+#else
+#define THREAD_CACHE_LINE_ALIGNED __attribute__((aligned(64)))
+#endif
+
+// Host threads behind one small API, Win32 threads on Windows and POSIX threads elsewhere
+typedef int (*ThreadFunction)(void* argument);
+
+struct Thread typedef Thread;
+
+// Returns NULL when the thread can not be created
+Thread* thread_start(ThreadFunction function, void* argument);
+
+// Waits for the thread to finish and releases it
+void thread_join(Thread* thread);
+
+// Number of logical processors of the host, at least 1
+int thread_hardware_concurrency();
+
+// Gives the rest of the time slice to another thread
+void thread_yield();
+void thread_sleep_microseconds(unsigned int microseconds);
+
+// Seconds on a clock that never jumps, only differences between two readings mean anything
+double monotonic_seconds();
+
+// Auto-reset event: a signal wakes one waiter, or the next one when nobody waits yet.
+// Lets a thread sleep on the host until another thread has something for it
+struct ThreadEvent typedef ThreadEvent;
+
+// Returns NULL when the event can not be created
+ThreadEvent* init_thread_event();
+void free_thread_event(ThreadEvent* event);
+
+// Safe to call from any thread, signals before a wait are not lost
+void thread_event_signal(ThreadEvent* event);
+
+// Blocks until the event is signalled, consuming the signal
+void thread_event_wait(ThreadEvent* event);
+
+// Sequentially consistent atomics on naturally aligned 64-bit values
+static inline int64_t atomic_load_64(volatile int64_t* target)
+{
+#if defined(_MSC_VER)
+	return _InterlockedOr64((volatile __int64*) target, 0);
+#else
+	return __atomic_load_n(target, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void atomic_store_64(volatile int64_t* target, int64_t value)
+{
+#if defined(_MSC_VER)
+	_InterlockedExchange64((volatile __int64*) target, value);
+#else
+	__atomic_store_n(target, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Acquire and release ordering for the single-producer single-consumer handoffs, plain moves on x86
+static inline int64_t atomic_load_acquire_64(volatile int64_t* target)
+{
+#if defined(_MSC_VER)
+	int64_t value = *target;
+	_ReadWriteBarrier();
+	return value;
+#else
+	return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void atomic_store_release_64(volatile int64_t* target, int64_t value)
+{
+#if defined(_MSC_VER)
+	_ReadWriteBarrier();
+	*target = value;
+#else
+	__atomic_store_n(target, value, __ATOMIC_RELEASE);
+#endif
+}
+
+// Returns the value before the addition
+static inline int64_t atomic_fetch_add_64(volatile int64_t* target, int64_t value)
+{
+#if defined(_MSC_VER)
+	return _InterlockedExchangeAdd64((volatile __int64*) target, value);
+#else
+	return __atomic_fetch_add(target, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Returns the value before the exchange
+static inline int64_t atomic_exchange_64(volatile int64_t* target, int64_t value)
+{
+#if defined(_MSC_VER)
+	return _InterlockedExchange64((volatile __int64*) target, value);
+#else
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Stores desired when the target still holds expected
+static inline BOOL atomic_compare_exchange_64(volatile int64_t* target, int64_t expected, int64_t desired)
+{
+#if defined(_MSC_VER)
+	return _InterlockedCompareExchange64((volatile __int64*) target, desired, expected) == expected;
+#else
+	return __atomic_compare_exchange_n(target, &expected, desired, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include "Throttle.h"
+#include "Thread.h"
+
+Throttle init_throttle(uint64_t clockHz)
+{
+    Throttle throttle;
+
+    throttle.clockHz = clockHz;
+    throttle.sliceCycles = (uint64_t) (clockHz * THROTTLE_SLICE_SECONDS);
+    if (throttle.sliceCycles == 0)
+    {
+        throttle.sliceCycles = 1;
+    }
+
+    throttle.running = FALSE;
+    throttle.baseCycles = 0;
+    throttle.baseSeconds = 0;
+    throttle.runCycles = 0;
+    throttle.runSeconds = 0;
+
+    throttle.cycles = 0;
+    throttle.seconds = 0;
+    throttle.slices = 0;
+    throttle.maxLatenessSeconds = 0;
+    throttle.resyncs = 0;
+
+    return throttle;
+}
+
+void throttle_start(Throttle* throttle, uint64_t cycles)
+{
+    if (throttle->clockHz == 0)
+    {
+        return;
+    }
+
+    throttle->running = TRUE;
+    throttle->baseCycles = cycles;
+    throttle->baseSeconds = monotonic_seconds();
+    throttle->runCycles = cycles;
+    throttle->runSeconds = throttle->baseSeconds;
+}
+
+void throttle_stop(Throttle* throttle, uint64_t cycles)
+{
+    if (!throttle->running)
+    {
+        return;
+    }
+
+    throttle->running = FALSE;
+    throttle->cycles += cycles - throttle->runCycles;
+    throttle->seconds += monotonic_seconds() - throttle->runSeconds;
+}
+
+uint64_t throttle_slice_end(const Throttle* throttle, uint64_t cycles, uint64_t deadline)
+{
+    if (!throttle->running)
+    {
+        return deadline;
+    }
+
+    uint64_t sliceEnd = cycles + throttle->sliceCycles;
+
+    return sliceEnd < deadline ? sliceEnd : deadline;
+}
+
+void throttle_wait(Throttle* throttle, uint64_t cycles)
+{
+    if (!throttle->running)
+    {
+        return;
+    }
+
+    double due = throttle->baseSeconds + (double) (cycles - throttle->baseCycles) / (double) throttle->clockHz;
+    double now = monotonic_seconds();
+
+    // Only ever sleeps, host CPU time stays proportional to the guest clock
+    if (now < due)
+    {
+        thread_sleep_microseconds((unsigned int) ((due - now) * 1e6));
+        now = monotonic_seconds();
+    }
+
+    double lateness = now - due;
+
+    throttle->slices++;
+    if (lateness > throttle->maxLatenessSeconds)
+    {
+        throttle->maxLatenessSeconds = lateness;
+    }
+
+    if (lateness > THROTTLE_MAX_LAG_SECONDS)
+    {
+        throttle->baseCycles = cycles;
+        throttle->baseSeconds = now;
+        throttle->resyncs++;
+    }
+}
+
+double throttle_achieved_hz(const Throttle* throttle)
+{
+    return throttle->seconds > 0 ? throttle->cycles / throttle->seconds : 0.0;
+}
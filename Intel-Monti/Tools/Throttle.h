@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Bool.h"
+
+// Clock of the original Intel 8080
+#define THROTTLE_8080_CLOCK_HZ 2000000
+
+// Guest time run between two looks at the host clock
+#define THROTTLE_SLICE_SECONDS 0.001
+
+// Further behind than this the throttle stops catching up and starts its schedule again from now,
+// a host hiccup then does not turn into a burst of flat out execution
+#define THROTTLE_MAX_LAG_SECONDS 0.05
+
+// Paces a run to a guest clock rate.
+// The CPU runs a slice of cycles flat out, then the host thread sleeps until the wall clock has caught up with
+// the guest cycle counter. The schedule is absolute, so a slice that ends late is made up by the next ones
+struct Throttle
+{
+	// 0 runs flat out and leaves everything else untouched
+	uint64_t clockHz;
+	uint64_t sliceCycles;
+
+	// Guest cycle and host time the current schedule started at
+	BOOL running;
+	uint64_t baseCycles;
+	double baseSeconds;
+	// Where the current throttled run started, for the achieved clock rate
+	uint64_t runCycles;
+	double runSeconds;
+
+	// Cycles and host seconds of all throttled runs so far
+	uint64_t cycles;
+	double seconds;
+	uint64_t slices;
+	// Largest distance by which the end of a slice missed its wall clock time
+	double maxLatenessSeconds;
+	// Schedules given up after falling THROTTLE_MAX_LAG_SECONDS behind
+	uint64_t resyncs;
+} typedef Throttle;
+
+Throttle init_throttle(uint64_t clockHz);
+
+// Starts pacing at the current guest cycle counter
+void throttle_start(Throttle* throttle, uint64_t cycles);
+// Ends pacing and adds the run to the statistics
+void throttle_stop(Throttle* throttle, uint64_t cycles);
+
+// Cycle counter to run to before the next throttle_wait, deadline when that comes first
+uint64_t throttle_slice_end(const Throttle* throttle, uint64_t cycles, uint64_t deadline);
+
+// Sleeps until the guest cycle counter is due on the wall clock
+void throttle_wait(Throttle* throttle, uint64_t cycles);
+
+// Guest cycles per host second over all throttled runs, 0 before the first one
+double throttle_achieved_hz(const Throttle* throttle);
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+
+#include "TraceTool.h"
+
+TraceFilter init_trace_filter()
+{
+    TraceFilter filter;
+
+    filter.addressFirst = 0;
+    filter.addressLast = RAM_ADDRESS_MASK;
+    filter.onlyWrites = FALSE;
+    filter.writeFirst = 0;
+    filter.writeLast = RAM_ADDRESS_MASK;
+    filter.skip = 0;
+    filter.limit = 0;
+
+    return filter;
+}
+
+static BOOL parse_address(const char* text, char** end, uint16_t* address)
+{
+    unsigned long value = strtoul(text, end, 0);
+    *address = (uint16_t) value;
+
+    return *end != text && value <= RAM_ADDRESS_MASK;
+}
+
+BOOL parse_trace_range(const char* text, uint16_t* first, uint16_t* last)
+{
+    char* end = NULL;
+
+    if (!parse_address(text, &end, first))
+    {
+        return FALSE;
+    }
+
+    if (*end == '\0')
+    {
+        *last = *first;
+        return TRUE;
+    }
+
+    return *end == '-' && parse_address(end + 1, &end, last) && *end == '\0' && *first <= *last;
+}
+
+static BOOL matches(const TraceFilter* filter, const TraceRecord* record)
+{
+    if (record->index < filter->skip || record->address < filter->addressFirst || record->address > filter->addressLast)
+    {
+        return FALSE;
+    }
+
+    if (!filter->onlyWrites)
+    {
+        return TRUE;
+    }
+
+    for (int i = 0; i < record->writeCount; i++)
+    {
+        uint16_t address = (uint16_t) (record->writeAddress + i);
+
+        if (address >= filter->writeFirst && address <= filter->writeLast)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void print_record(const TraceRecord* record)
+{
+    const uint8_t* registers = record->registers;
+
+    printf("#%llu cycles=%llu %04X: %02X %-8s A=%02X F=%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X",
+        (unsigned long long) record->index,
+        (unsigned long long) record->cycles,
+        record->address,
+        record->opCode,
+        record->interrupt ? "int" : instruction_names[record->opCode],
+        registers[6],
+        registers[7],
+        registers[0], registers[1],
+        registers[2], registers[3],
+        registers[4], registers[5],
+        record->stackPointer);
+
+    if (record->writeCount != 0)
+    {
+        printf(" [%04X]=", record->writeAddress);
+
+        for (int i = 0; i < record->writeCount; i++)
+        {
+            printf("%s%02X", i != 0 ? "," : "", record->writeValues[i]);
+        }
+    }
+
+    printf("\n");
+}
+
+BOOL decode_trace(const char* path, const TraceFilter* filter)
+{
+    TraceReader* reader = open_trace_reader(path);
+    if (reader == NULL)
+    {
+        printf("%s\n", "[ERROR] Can not open trace");
+        return FALSE;
+    }
+
+    TraceRecord record;
+    uint64_t shown = 0;
+
+    while ((filter->limit == 0 || shown < filter->limit) && trace_next(reader, &record))
+    {
+        if (matches(filter, &record))
+        {
+            print_record(&record);
+            shown++;
+        }
+    }
+
+    BOOL damaged = reader->damaged;
+
+    printf("[TRACE] %llu records read, %llu shown%s\n",
+        (unsigned long long) reader->index,
+        (unsigned long long) shown,
+        damaged ? ", trace damaged" : "");
+
+    close_trace_reader(reader);
+
+    return !damaged;
+}
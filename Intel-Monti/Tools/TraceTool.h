@@ -0,0 +1,30 @@
+#pragma once
+
+#include "../CPU/Trace.h"
+
+// Which records decode_trace prints
+struct TraceFilter
+{
+	// Instruction addresses, inclusive
+	uint16_t addressFirst;
+	uint16_t addressLast;
+
+	// Only records writing a byte in this range, when onlyWrites is set
+	BOOL onlyWrites;
+	uint16_t writeFirst;
+	uint16_t writeLast;
+
+	// Records skipped from the start, and the most records printed (0 prints all)
+	uint64_t skip;
+	uint64_t limit;
+} typedef TraceFilter;
+
+// Passes every record
+TraceFilter init_trace_filter();
+
+// Accepts ADDRESS or FIRST-LAST, each in any strtoul base
+BOOL parse_trace_range(const char* text, uint16_t* first, uint16_t* last);
+
+// Prints the matching records of a trace written by --trace, one line each, and a summary.
+// Returns FALSE when the trace can not be read or is damaged
+BOOL decode_trace(const char* path, const TraceFilter* filter);
\ No newline at end of file
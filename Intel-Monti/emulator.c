@@ -4,34 +4,320 @@ Emulator init_emulator()
 {
     Emulator emulator;
 
+    emulator.cpu = init_cpu();
     emulator.ram = init_ram();
+    emulator.bus = init_io_bus();
+    emulator.output = init_output_device(stdout, OUTPUT_ENCODING_DECIMAL);
+    emulator.asyncOutput = NULL;
+    emulator.scheduler = init_scheduler();
+    emulator.throttle = init_throttle(0);
+    emulator.wakeEvent = init_thread_event();
+    emulator.wakeSources = 0;
+
+    // Without a bus of its own the CPU keeps the unbuffered standart_io_bus
+    if (emulator.bus != NULL && emulator.output != NULL)
+    {
+        output_device_connect(emulator.output, emulator.bus, STANDART_OUTPUT_PORT);
+        emulator.cpu.bus = emulator.bus;
+    }
 
     return emulator;
 }
 
-void free_emulator(Emulator emulator)
+void free_emulator(Emulator* emulator)
 {
-    free_ram(emulator.ram);
+    free_cpu(&emulator->cpu);
+    free_ram(emulator->ram);
+
+    // Hands the last queued bytes to the output device before it goes
+    if (emulator->asyncOutput != NULL)
+    {
+        detach_async_device(emulator->asyncOutput);
+    }
+
+    if (emulator->output != NULL)
+    {
+        free_output_device(emulator->output);
+    }
+
+    if (emulator->bus != NULL)
+    {
+        free_io_bus(emulator->bus);
+    }
+
+    if (emulator->scheduler != NULL)
+    {
+        free_scheduler(emulator->scheduler);
+    }
+
+    if (emulator->wakeEvent != NULL)
+    {
+        free_thread_event(emulator->wakeEvent);
+    }
 }
 
-void execute_program(Emulator emulator, char* opCodesBuffer, int opCodesBufferSize, int start)
+void reset_emulator(Emulator* emulator)
+{
+    CPU_Core core = emulator->cpu.core;
+    const IoBus* bus = emulator->cpu.bus;
+    struct CpuProfile* profile = emulator->cpu.profile;
+    struct CallProfile* callProfile = emulator->cpu.callProfile;
+    struct TraceWriter* trace = emulator->cpu.trace;
+    struct InputLog* inputLog = emulator->cpu.inputLog;
+
+    free_cpu(&emulator->cpu);
+    ram_reset(emulator->ram);
+
+    emulator->cpu = init_cpu();
+    emulator->cpu.core = core;
+    emulator->cpu.bus = bus;
+    emulator->cpu.profile = profile;
+    emulator->cpu.callProfile = callProfile;
+    emulator->cpu.trace = trace;
+    emulator->cpu.inputLog = inputLog;
+}
+
+EmulatorSnapshot* snapshot_emulator(Emulator* emulator)
+{
+    EmulatorSnapshot* snapshot = (EmulatorSnapshot*) malloc(sizeof(EmulatorSnapshot));
+    if (snapshot == NULL)
+    {
+        return NULL;
+    }
+
+    snapshot->ram = ram_snapshot(emulator->ram);
+    if (snapshot->ram == NULL)
+    {
+        free(snapshot);
+        return NULL;
+    }
+
+    snapshot->cpu = emulator->cpu;
+    snapshot->cpu.blockCache = NULL;
+    snapshot->cpu.jit = NULL;
+    snapshot->cpu.bus = NULL;
+    snapshot->cpu.profile = NULL;
+    snapshot->cpu.callProfile = NULL;
+    snapshot->cpu.trace = NULL;
+    snapshot->cpu.inputLog = NULL;
+
+    return snapshot;
+}
+
+void restore_emulator(Emulator* emulator, const EmulatorSnapshot* snapshot)
+{
+    CPU* cpu = &emulator->cpu;
+
+    // The translations stay valid, ram_restore drops the ones of every page it copies back
+    CPU_Core core = cpu->core;
+    struct BlockCache* blockCache = cpu->blockCache;
+    struct Jit* jit = cpu->jit;
+    const IoBus* bus = cpu->bus;
+    struct CpuProfile* profile = cpu->profile;
+    struct CallProfile* callProfile = cpu->callProfile;
+    struct TraceWriter* trace = cpu->trace;
+    struct InputLog* inputLog = cpu->inputLog;
+
+    ram_restore(emulator->ram, snapshot->ram);
+
+    *cpu = snapshot->cpu;
+    cpu->core = core;
+    cpu->blockCache = blockCache;
+    cpu->jit = jit;
+    cpu->bus = bus;
+    cpu->profile = profile;
+    cpu->callProfile = callProfile;
+    cpu->trace = trace;
+    cpu->inputLog = inputLog;
+}
+
+void free_emulator_snapshot(EmulatorSnapshot* snapshot)
+{
+    free_ram_snapshot(snapshot->ram);
+    free(snapshot);
+}
+
+static BOOL replaying(const Emulator* emulator)
+{
+    return emulator->cpu.inputLog != NULL && emulator->cpu.inputLog->replaying;
+}
+
+// A replay ignores the devices, only the log raises interrupts
+static BOOL can_be_woken(Emulator* emulator)
+{
+    return emulator->cpu.interruptsEnabled && emulator->wakeEvent != NULL && atomic_load_64(&emulator->wakeSources) != 0
+        && !replaying(emulator);
+}
+
+CPU_ExitReason emulator_run(Emulator* emulator)
+{
+    CPU* cpu = &emulator->cpu;
+    Throttle* throttle = &emulator->throttle;
+    CPU_ExitReason reason;
+
+    throttle_start(throttle, cpu->cycles);
+
+    for (;;)
+    {
+        uint64_t deadline = emulator->scheduler != NULL ? scheduler_next_deadline(emulator->scheduler) : SCHEDULER_NO_EVENT;
+
+        // A replay also stops at the logged inputs, so each logged interrupt is raised at the boundary it was accepted at
+        if (replaying(emulator))
+        {
+            uint64_t logged = input_log_next_cycle(cpu->inputLog, cpu->cycles);
+            deadline = logged < deadline ? logged : deadline;
+        }
+
+        uint64_t limit = throttle_slice_end(throttle, cpu->cycles, deadline);
+
+        // The bus is synced when the core halts, queued output is out before the thread goes to sleep.
+        // Events are dispatched up to one basic block late, the cores only stop at block boundaries
+        reason = limit == SCHEDULER_NO_EVENT
+            ? cpu_run_until_halt(cpu, emulator->ram)
+            : cpu_run_cycles(cpu, emulator->ram, limit > cpu->cycles ? limit - cpu->cycles : 0);
+
+        if (reason == CPU_EXIT_HALTED)
+        {
+            if (!cpu->interruptsEnabled)
+            {
+                break;
+            }
+
+            if (deadline != SCHEDULER_NO_EVENT)
+            {
+                // The clock keeps running in HLT, nothing happens until the next event
+                if (cpu->cycles < deadline)
+                {
+                    cpu->cycles = deadline;
+                }
+            }
+            else
+            {
+                // Time spent waiting for the host is not guest time, the throttle starts over afterwards
+                throttle_stop(throttle, cpu->cycles);
+
+                // Each signal rechecks the line, a wake without an interrupt sends the thread back to sleep.
+                // The core accepts the request when it runs again
+                while (cpu->interruptRequest == 0 && can_be_woken(emulator))
+                {
+                    thread_event_wait(emulator->wakeEvent);
+                }
+
+                if (cpu->interruptRequest == 0)
+                {
+                    return reason;
+                }
+
+                throttle_start(throttle, cpu->cycles);
+                continue;
+            }
+        }
+
+        throttle_wait(throttle, cpu->cycles);
+
+        if (deadline != SCHEDULER_NO_EVENT)
+        {
+            if (emulator->scheduler != NULL)
+            {
+                scheduler_dispatch(emulator->scheduler, cpu->cycles);
+            }
+
+            if (replaying(emulator))
+            {
+                input_log_dispatch(cpu->inputLog, cpu);
+            }
+        }
+    }
+
+    throttle_stop(throttle, cpu->cycles);
+
+    return reason;
+}
+
+void emulator_add_wake_source(Emulator* emulator)
+{
+    atomic_fetch_add_64(&emulator->wakeSources, 1);
+}
+
+void emulator_remove_wake_source(Emulator* emulator)
+{
+    atomic_fetch_add_64(&emulator->wakeSources, -1);
+
+    // A CPU waiting on the last source has to find out that nothing will wake it anymore
+    emulator_wake(emulator);
+}
+
+void emulator_wake(Emulator* emulator)
+{
+    if (emulator->wakeEvent != NULL)
+    {
+        thread_event_signal(emulator->wakeEvent);
+    }
+}
+
+void emulator_raise_interrupt(Emulator* emulator, unsigned char vector)
+{
+    cpu_raise_interrupt(&emulator->cpu, vector);
+    emulator_wake(emulator);
+}
+
+void emulator_set_clock(Emulator* emulator, uint64_t clockHz)
+{
+    emulator->throttle = init_throttle(clockHz);
+}
+
+static void raise_scheduled_interrupt(void* context, uint64_t vector, uint64_t deadline)
+{
+    Emulator* emulator = (Emulator*) context;
+
+    // On the emulator thread itself, nobody sleeps on the wake event
+    cpu_raise_interrupt(&emulator->cpu, (unsigned char) vector);
+}
+
+BOOL emulator_schedule_interrupt(Emulator* emulator, uint64_t cycle, unsigned char vector)
+{
+    return emulator->scheduler != NULL && scheduler_add(emulator->scheduler, cycle, 0, raise_scheduled_interrupt, emulator, vector);
+}
+
+BOOL emulator_add_interrupt_timer(Emulator* emulator, uint64_t period, unsigned char vector)
+{
+    return emulator->scheduler != NULL && period != 0
+        && scheduler_add(emulator->scheduler, emulator->cpu.cycles + period, period, raise_scheduled_interrupt, emulator, vector);
+}
+
+void execute_program(Emulator* emulator, char* opCodesBuffer, int opCodesBufferSize, int start)
 {
     int programStart = start;
 
-    if (opCodesBufferSize + programStart >= RAM_MEMORY_SIZE)
+    if (opCodesBufferSize + programStart > RAM_MEMORY_SIZE)
     {
         printf("%s\n", "[ERROR] Out of range memory size");
         return;
     }
 
     // Loading program opcodes into virtual RAM
-    for (int i = programStart; i < opCodesBufferSize; i++)
+    ram_load(emulator->ram, (unsigned short) programStart, opCodesBuffer, opCodesBufferSize);
+
+    // Moving the PC register to the beginning of the program
+    emulator->cpu.programCounter.data = programStart;
+
+    emulator_run(emulator);
+}
+
+BOOL execute_program_file(Emulator* emulator, const char* path, ImageFormat format, unsigned short origin)
+{
+    unsigned short entryPoint = 0;
+
+    ImageLoadResult result = load_image_file(emulator->ram, path, format, origin, &entryPoint);
+    if (result != IMAGE_LOAD_OK)
     {
-        write_memory_ram(emulator.ram, i, opCodesBuffer[i]);
+        printf("[ERROR] %s\n", image_load_result_message(result));
+        return FALSE;
     }
 
-    // Moving the PC register to the beginning of the program
-    emulator.cpu.programCounter.data = programStart;
+    emulator->cpu.programCounter.data = entryPoint;
+
+    emulator_run(emulator);
 
-    execute_cpu(emulator.cpu, emulator.ram);
+    return TRUE;
 }
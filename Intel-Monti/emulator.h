@@ -1,15 +1,101 @@
+#pragma once
+
 #include <stdio.h>
 
 #include "CPU/cpu.h"
 #include "Memory/RAM.h"
+#include "Memory/ImageLoader.h"
+#include "IO/StandartOutput.h"
+#include "IO/AsyncDevice.h"
+#include "IO/Scheduler.h"
+#include "IO/InputLog.h"
+#include "Tools/Thread.h"
+#include "Tools/Throttle.h"
 
 struct Emulator
 {
+	// The dispatch core is selected through cpu.core
 	CPU cpu;
 	RAM* ram;
+
+	// Ports of the CPU, cpu.bus points here
+	IoBus* bus;
+	// Buffered stdout in the decimal encoding on STANDART_OUTPUT_PORT
+	OutputDevice* output;
+	// Set when the output device runs on its own thread, see attach_async_device. Detached by free_emulator
+	AsyncDevice* asyncOutput;
+
+	// Timed device events on the guest cycle counter, dispatched by emulator_run. NULL when it can not be allocated
+	Scheduler* scheduler;
+
+	// Paces emulator_run to a guest clock rate, flat out while throttle.clockHz is 0. See emulator_set_clock
+	Throttle throttle;
+
+	// A CPU halted with interrupts enabled sleeps on this until another thread calls emulator_wake.
+	// NULL when it can not be created, HLT then always ends the run
+	ThreadEvent* wakeEvent;
+	// Threads that may still wake the CPU, see emulator_add_wake_source
+	volatile int64_t wakeSources;
 } typedef Emulator;
 
+// Machine state of an emulator, see snapshot_emulator
+struct EmulatorSnapshot
+{
+	// Registers, flags and cycle counter. The translation caches, the profiles, the trace, the input log and the I/O bus are not part of it
+	CPU cpu;
+	RAM_Snapshot* ram;
+} typedef EmulatorSnapshot;
+
 Emulator init_emulator();
-void free_emulator(Emulator emulator);
+void free_emulator(Emulator* emulator);
+
+// Puts a used emulator back into the state after init_emulator, keeping its allocations, its core, its profiles, its trace, its input log and its devices
+void reset_emulator(Emulator* emulator);
+
+// Copies the CPU and the RAM. From here on the RAM tracks the pages the guest writes,
+// so restoring this snapshot copies back only those. Returns NULL when the copy can not be allocated
+EmulatorSnapshot* snapshot_emulator(Emulator* emulator);
+
+// Puts the CPU and the RAM back to the snapshot. The core, the translation caches, the profiles, the trace, the input log, the I/O bus and the scheduled events stay
+void restore_emulator(Emulator* emulator, const EmulatorSnapshot* snapshot);
+
+void free_emulator_snapshot(EmulatorSnapshot* snapshot);
+
+// Runs from the current PC until the guest is done.
+// The core runs straight to the next scheduled event and dispatches the due events there.
+// A throttled emulator runs slices of THROTTLE_SLICE_SECONDS guest time and sleeps after each until the host clock agrees.
+// HLT stops the core. With interrupts disabled nothing can resume it and CPU_EXIT_HALTED is returned.
+// With interrupts enabled guest time skips ahead to the next scheduled event. Without one the host thread blocks
+// until an interrupt is raised, instead of spinning on the halted CPU, and returns once no wake source is left.
+// While cpu.inputLog replays, the logged interrupts take the place of the devices and timers
+CPU_ExitReason emulator_run(Emulator* emulator);
+
+// A device or timer running on another thread registers before it may interrupt the emulator,
+// and removes itself when it never will again. Safe to call from any thread
+void emulator_add_wake_source(Emulator* emulator);
+void emulator_remove_wake_source(Emulator* emulator);
+
+// Wakes a CPU waiting in HLT inside emulator_run. Safe to call from any thread, a signal sent before the wait is kept
+void emulator_wake(Emulator* emulator);
+
+// Requests the interrupt RST vector (0 to 7) and wakes a halted CPU, see cpu_raise_interrupt.
+// Safe to call from any thread, the running core notices it at its next block boundary
+void emulator_raise_interrupt(Emulator* emulator, unsigned char vector);
+
+// Paces emulator_run to clockHz guest cycles per second, THROTTLE_8080_CLOCK_HZ for authentic speed.
+// 0 runs flat out. Resets the statistics in emulator->throttle
+void emulator_set_clock(Emulator* emulator, uint64_t clockHz);
+
+// Raises the interrupt RST vector once the cycle counter reaches cycle. Returns FALSE when it can not be scheduled
+BOOL emulator_schedule_interrupt(Emulator* emulator, uint64_t cycle, unsigned char vector);
+
+// Raises the interrupt RST vector every period cycles, starting one period from now.
+// Returns FALSE when it can not be scheduled
+BOOL emulator_add_interrupt_timer(Emulator* emulator, uint64_t period, unsigned char vector);
+
+// Loads the program and runs it until HLT, the final state stays in emulator->cpu
+void execute_program(Emulator* emulator, char* opCodesBuffer, int opCodesBufferSize, int start);
 
-void execute_program(Emulator emulator, char* opCodesBuffer, int opCodesBufferSize, int start);
\ No newline at end of file
+// Loads the image file (see load_image_file) and runs it from its entry point until HLT.
+// Returns FALSE when the image can not be loaded, nothing runs then
+BOOL execute_program_file(Emulator* emulator, const char* path, ImageFormat format, unsigned short origin);
\ No newline at end of file
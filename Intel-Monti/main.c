@@ -1,43 +1,421 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "emulator.h"
+#include "Tools/Benchmark.h"
+#include "Tools/BatchRunner.h"
+#include "Tools/File.h"
+#include "Tools/Thread.h"
+#include "CPU/Profiler.h"
+#include "CPU/CallProfiler.h"
+#include "Tools/TraceTool.h"
 
-int main(int argv, char* argc)
+int main(int argc, char** argv)
 {
-	if (argv == 1)
+	CPU_Core core = CPU_CORE_SWITCH;
+	const char* fileName = NULL;
+	const char* manifestName = NULL;
+	ImageFormat format = IMAGE_FORMAT_AUTO;
+	unsigned short origin = 0;
+	OutputEncoding encoding = OUTPUT_ENCODING_DECIMAL;
+	BOOL asyncOutput = FALSE;
+	AsyncOverflowPolicy overflowPolicy = ASYNC_OVERFLOW_BLOCK;
+	int threadCount = thread_hardware_concurrency();
+	uint64_t clockHz = 0;
+	BOOL profile = FALSE;
+	const char* flamegraphName = NULL;
+	const char* traceName = NULL;
+	BOOL compressTrace = FALSE;
+	const char* decodeTraceName = NULL;
+	TraceFilter traceFilter = init_trace_filter();
+	const char* recordName = NULL;
+	const char* replayName = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--benchmark") == 0)
+		{
+			run_core_benchmark();
+			return 0;
+		}
+
+		if (strcmp(argv[i], "--benchmark-alu") == 0)
+		{
+			run_alu_benchmark();
+			return 0;
+		}
+
+		if (strcmp(argv[i], "--benchmark-lockstep") == 0)
+		{
+			run_lockstep_benchmark();
+			return 0;
+		}
+
+		if (strncmp(argv[i], "--core=", 7) == 0)
+		{
+			if (!parse_cpu_core(argv[i] + 7, &core))
+			{
+				printf("%s", "[ERROR] Unknown core, expected switch, table, threaded, cached or jit");
+				return 1;
+			}
+
+			continue;
+		}
+
+		if (strncmp(argv[i], "--format=", 9) == 0)
+		{
+			if (!parse_image_format(argv[i] + 9, &format))
+			{
+				printf("%s", "[ERROR] Unknown image format, expected auto, binary, hex or com");
+				return 1;
+			}
+
+			continue;
+		}
+
+		if (strncmp(argv[i], "--origin=", 9) == 0)
+		{
+			char* end = NULL;
+			unsigned long value = strtoul(argv[i] + 9, &end, 0);
+
+			if (*end != '\0' || value > RAM_ADDRESS_MASK)
+			{
+				printf("%s", "[ERROR] Origin must be an address from 0 to 0xFFFF");
+				return 1;
+			}
+
+			origin = (unsigned short) value;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--output=", 9) == 0)
+		{
+			if (!parse_output_encoding(argv[i] + 9, &encoding))
+			{
+				printf("%s", "[ERROR] Unknown output encoding, expected raw, decimal or hex");
+				return 1;
+			}
+
+			continue;
+		}
+
+		if (strcmp(argv[i], "--async-output") == 0)
+		{
+			asyncOutput = TRUE;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--async-output=", 15) == 0)
+		{
+			if (!parse_async_overflow_policy(argv[i] + 15, &overflowPolicy))
+			{
+				printf("%s", "[ERROR] Unknown overflow policy, expected block or drop");
+				return 1;
+			}
+
+			asyncOutput = TRUE;
+			continue;
+		}
+
+		if (strcmp(argv[i], "--profile") == 0)
+		{
+			profile = TRUE;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--flamegraph=", 13) == 0)
+		{
+			flamegraphName = argv[i] + 13;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--trace=", 8) == 0)
+		{
+			traceName = argv[i] + 8;
+			continue;
+		}
+
+		if (strcmp(argv[i], "--trace-compress") == 0)
+		{
+			compressTrace = TRUE;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--decode-trace=", 15) == 0)
+		{
+			decodeTraceName = argv[i] + 15;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--trace-address=", 16) == 0)
+		{
+			if (!parse_trace_range(argv[i] + 16, &traceFilter.addressFirst, &traceFilter.addressLast))
+			{
+				printf("%s", "[ERROR] Trace address filter must be ADDRESS or FIRST-LAST");
+				return 1;
+			}
+
+			continue;
+		}
+
+		if (strncmp(argv[i], "--trace-write=", 14) == 0)
+		{
+			if (!parse_trace_range(argv[i] + 14, &traceFilter.writeFirst, &traceFilter.writeLast))
+			{
+				printf("%s", "[ERROR] Trace write filter must be ADDRESS or FIRST-LAST");
+				return 1;
+			}
+
+			traceFilter.onlyWrites = TRUE;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--trace-skip=", 13) == 0)
+		{
+			traceFilter.skip = strtoull(argv[i] + 13, NULL, 0);
+			continue;
+		}
+
+		if (strncmp(argv[i], "--trace-limit=", 14) == 0)
+		{
+			traceFilter.limit = strtoull(argv[i] + 14, NULL, 0);
+			continue;
+		}
+
+		if (strcmp(argv[i], "--throttle") == 0)
+		{
+			clockHz = THROTTLE_8080_CLOCK_HZ;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--throttle=", 11) == 0)
+		{
+			char* end = NULL;
+			clockHz = strtoull(argv[i] + 11, &end, 0);
+
+			if (*end != '\0' || clockHz == 0)
+			{
+				printf("%s", "[ERROR] Throttle clock must be a positive rate in Hz");
+				return 1;
+			}
+
+			continue;
+		}
+
+		if (strncmp(argv[i], "--record=", 9) == 0)
+		{
+			recordName = argv[i] + 9;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--replay=", 9) == 0)
+		{
+			replayName = argv[i] + 9;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--batch=", 8) == 0)
+		{
+			manifestName = argv[i] + 8;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--threads=", 10) == 0)
+		{
+			threadCount = atoi(argv[i] + 10);
+			continue;
+		}
+
+		fileName = argv[i];
+	}
+
+	if (decodeTraceName != NULL)
+	{
+		return decode_trace(decodeTraceName, &traceFilter) ? 0 : 1;
+	}
+
+	if (manifestName != NULL)
+	{
+		return run_batch(manifestName, core, threadCount) ? 0 : 1;
+	}
+
+	if (fileName == NULL)
 	{
 		printf("%s", "[ERROR] Need executable file");
 		return 1;
 	}
 
-	FILE* file = NULL;
-	errno_t errno_file = fopen_s(&file, argc[1], "rb");
-	if (errno_file != 0)
+	Emulator emulator = init_emulator();
+	emulator.cpu.core = core;
+	emulator_set_clock(&emulator, clockHz);
+
+	if (profile)
 	{
-		printf("%s", "[ERROR] Can not open file");
-		return 1;
+		emulator.cpu.profile = init_cpu_profile();
 	}
 
-	fseek(file, 0, SEEK_END);
-	long file_size = ftell(file);
+	if (flamegraphName != NULL)
+	{
+		emulator.cpu.callProfile = init_call_profile(emulator.cpu.cycles);
+	}
+
+	if (traceName != NULL)
+	{
+		emulator.cpu.trace = open_trace_writer(traceName, compressTrace);
+
+		if (emulator.cpu.trace == NULL)
+		{
+			printf("%s", "[ERROR] Can not open trace file");
+			free_emulator(&emulator);
+			return 1;
+		}
+	}
 
-	rewind(file);
+	if (emulator.output != NULL)
+	{
+		output_device_set_encoding(emulator.output, encoding);
+	}
+
+	if (asyncOutput && emulator.bus != NULL)
+	{
+		emulator.asyncOutput = attach_async_device(emulator.bus, STANDART_OUTPUT_PORT, overflowPolicy, 0, ASYNC_UNDERRUN_BLOCK);
+	}
 
-	char* opCodesBuffer = (char*) malloc(file_size);
-	if (opCodesBuffer == NULL)
+	// The devices are connected by now, the log stands in front of them
+	if ((recordName != NULL || replayName != NULL) && emulator.bus != NULL)
 	{
-		printf("%s", "[ERROR] Can not open file");
+		emulator.cpu.inputLog = recordName != NULL
+			? open_input_recording(recordName, &emulator.cpu, emulator.bus)
+			: open_input_replay(replayName, &emulator.cpu, emulator.bus);
+	}
+
+	if ((recordName != NULL || replayName != NULL) && emulator.cpu.inputLog == NULL)
+	{
+		printf("%s", recordName != NULL ? "[ERROR] Can not open input log file" : "[ERROR] Can not read input log file");
+		free_emulator(&emulator);
 		return 1;
 	}
 
-	size_t read_size = fread(opCodesBuffer, 1, file_size, file);
+	if (replayName != NULL && emulator.cpu.inputLog->profilingCore
+		!= (emulator.cpu.profile != NULL || emulator.cpu.callProfile != NULL || emulator.cpu.trace != NULL))
+	{
+		fprintf(stderr, "%s\n", "[REPLAY] The recording ran with other profiling options, the interrupts may not line up");
+	}
+
+	BOOL executed = execute_program_file(&emulator, fileName, format, origin);
 
-	Emulator emulator = init_emulator();
-	execute_program(emulator, opCodesBuffer, read_size, 0);
+	if (emulator.cpu.inputLog != NULL)
+	{
+		InputLog* inputLog = emulator.cpu.inputLog;
+		BOOL closed = close_input_log(inputLog, emulator.ram);
+
+		if (!inputLog->replaying)
+		{
+			fprintf(stderr, "[RECORD] %llu inputs, %llu interrupts, %llu entries, %llu bytes written\n",
+				(unsigned long long) inputLog->inputs,
+				(unsigned long long) inputLog->interrupts,
+				(unsigned long long) inputLog->entries,
+				(unsigned long long) inputLog->bytes);
+
+			if (!closed)
+			{
+				printf("%s", "[ERROR] Can not write the input log");
+			}
+		}
+		else if (closed)
+		{
+			fprintf(stderr, "[REPLAY] %llu inputs, %llu interrupts, identical to the recording\n",
+				(unsigned long long) inputLog->inputs,
+				(unsigned long long) inputLog->interrupts);
+		}
+		else
+		{
+			fprintf(stderr, "[REPLAY] %llu inputs, %llu interrupts, %llu mismatches from cycle %llu%s\n",
+				(unsigned long long) inputLog->inputs,
+				(unsigned long long) inputLog->interrupts,
+				(unsigned long long) inputLog->divergences,
+				(unsigned long long) inputLog->firstDivergenceCycle,
+				inputLog->truncated ? ", the log is incomplete" : "");
+
+			executed = FALSE;
+		}
+
+		free_input_log(inputLog);
+		emulator.cpu.inputLog = NULL;
+	}
+
+	// On stderr, so the guest output on stdout stays byte-exact
+	if (emulator.asyncOutput != NULL)
+	{
+		AsyncDevice* device = emulator.asyncOutput;
+
+		fprintf(stderr, "[ASYNC] %llu bytes queued, %llu dropped, %llu full ring events, %.3f s stalled, %llu input underruns\n",
+			(unsigned long long) device->bytesQueued,
+			(unsigned long long) device->bytesDropped,
+			(unsigned long long) device->fullEvents,
+			device->stallSeconds,
+			(unsigned long long) device->inputUnderruns);
+	}
+
+	if (clockHz != 0)
+	{
+		Throttle* throttle = &emulator.throttle;
+
+		fprintf(stderr, "[THROTTLE] %llu Hz target, %.0f Hz achieved over %.3f s, %llu slices, max slice lateness %.3f ms, %llu resyncs\n",
+			(unsigned long long) throttle->clockHz,
+			throttle_achieved_hz(throttle),
+			throttle->seconds,
+			(unsigned long long) throttle->slices,
+			throttle->maxLatenessSeconds * 1000,
+			(unsigned long long) throttle->resyncs);
+	}
+
+	if (emulator.cpu.profile != NULL)
+	{
+		print_cpu_profile(emulator.cpu.profile, stderr);
+		free_cpu_profile(emulator.cpu.profile);
+	}
+
+	if (emulator.cpu.trace != NULL)
+	{
+		TraceWriter* trace = emulator.cpu.trace;
+
+		// The statistics are complete once the writer thread is done
+		if (close_trace_writer(trace))
+		{
+			fprintf(stderr, "[TRACE] %llu records, %llu bytes encoded, %llu bytes written, %.2f bytes per record\n",
+				(unsigned long long) trace->records,
+				(unsigned long long) trace->rawBytes,
+				(unsigned long long) trace->storedBytes,
+				trace->records != 0 ? (double) trace->storedBytes / trace->records : 0.0);
+		}
+		else
+		{
+			printf("%s", "[ERROR] Can not write the trace");
+		}
+
+		free_trace_writer(trace);
+		emulator.cpu.trace = NULL;
+	}
+
+	if (emulator.cpu.callProfile != NULL)
+	{
+		FILE* flamegraph = open_file(flamegraphName, "w");
+
+		if (flamegraph == NULL || !write_folded_stacks(emulator.cpu.callProfile, flamegraph))
+		{
+			printf("%s", "[ERROR] Can not write the folded call stacks");
+		}
+
+		if (flamegraph != NULL)
+		{
+			fclose(flamegraph);
+		}
+
+		free_call_profile(emulator.cpu.callProfile);
+	}
 
-	free_emulator(emulator);
-	free(opCodesBuffer);
-	fclose(file);
+	free_emulator(&emulator);
 
-	return 0;
+	return executed ? 0 : 1;
 }